@@ -0,0 +1,1053 @@
+/*****************************************************************************
+
+        Eedi3Avx2.cpp
+
+Optimizations for AVX2:
+
+Uses the same packed data as the SSE2 version (8 lines of 16-bit pixels per
+column, see Eedi3Sse.cpp). The difference is that the 8 lines fit in a single
+__m256 vector of floats, so the path cost, backtrack and interpolation stages
+are done in one pass instead of two 4-line blocks.
+
+The connection costs are computed on 8 x 32-bit lanes, the pixel differences
+are still done on 16-bit data then widened.
+
+The final interpolation is vectorized with gathers, each lane having its own
+direction. The cubic taps are only fetched for the lanes where they are
+valid, so we never read outside the margins.
+
+Results are bit-exact with Eedi3Sse::interp_lines_full_pel(). This is why
+we don't use FMA instructions here.
+
+The helper functions are duplicated from Eedi3Sse.cpp instead of being shared
+inline: this file is compiled with AVX2 code generation and must not provide
+code to the SSE2 path.
+
+Copyright (C) 2010 Kevin Stone - some part by Laurent de Soras, 2013
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*Tab=3***********************************************************************/
+
+
+
+#if defined (_MSC_VER)
+#pragma warning (1 : 4130 4223 4705 4706)
+#pragma warning (4 : 4355 4786 4800)
+#endif
+
+
+
+/*\\\ INCLUDE FILES \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+#include	"Eedi3Avx2.h"
+
+#include	<algorithm>
+
+#include	<cassert>
+#include	<cfloat>
+#include	<cstring>
+
+
+
+static __forceinline __m128i	difabs16(__m128i a, __m128i b)
+{
+  return (_mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a)));
+}
+
+
+
+/*\\\ PUBLIC \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+
+
+/*
+==============================================================================
+Name: interp_lines_full_pel
+Description:
+  Interpolates COL_H lines at once, full-pixel precision.
+  Data must be packed with Eedi3Sse::prepare_lines*() and the result unpacked
+  with Eedi3Sse::copy_result_lines*().
+  The parameters are the same as Eedi3Sse::interp_lines_full_pel(), only the
+  temporary buffer differs.
+Input/output parameters:
+  - tmp_ptr: A temporary buffer, 32-byte aligned. Its size in bytes is at
+    least:
+    ((mdis * 2 + 1) * VECTSIZE + VECTSIZE + 2) * width
+    + (mdis * 2 + 5) * (mdis * 2 + 1) * sizeof (__m256i)
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Avx2::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m128i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3, bool fixed, int bits)
+{
+  assert(src_ptr != 0);
+  assert(dst_ptr != 0);
+  assert(tmp_ptr != 0);
+  assert((reinterpret_cast <intptr_t> (tmp_ptr) & 31) == 0);
+  assert(dmap_ptr != 0);
+  assert(width > 0);
+  assert(pitch > 0);
+  assert(alpha >= 0);
+  assert(beta >= 0);
+  assert(alpha + beta <= 1.0f);
+  assert(gamma >= 0);
+  assert(nrad >= 0);
+  assert(nrad <= 3);
+  assert(mdis > 0);
+
+  // First, shifts everything so we point on actual data.
+  src_ptr += MARGIN_H;
+
+  const __m128i* src3p_ptr = src_ptr;
+  const __m128i* src1p_ptr = src_ptr + 1 * pitch;
+  const __m128i* src1n_ptr = src_ptr + 2 * pitch;
+  const __m128i* src3n_ptr = src_ptr + 3 * pitch;
+
+  const int      tpitch = mdis * 2 + 1;
+  int            tmpofs = 0;
+
+#define Eedi3Avx2_DECL( T, N, S) \
+	T  *          N = reinterpret_cast <T *> (tmp_ptr + tmpofs); \
+	tmpofs += S * sizeof (T);
+
+  // The connection costs of a column are fed to the path cost recursion as
+  // soon as they are computed, see Eedi3Sse::interp_lines_full_pel().
+  // ccosts (current column), pcosts (previous and current columns), pbackt
+  // and fpath are made of all the 8 packed lines,
+  // s0tab contains the s0 sums of the last tpitch centers (cost3),
+  // bmask contains a single boolean for each 8-line column.
+  // pbackt and fpath store the directions as bytes.
+  Eedi3Avx2_DECL(float, ccosts, tpitch * VECTSIZE); // Array of mdis*2+1 costs for the current column
+  Eedi3Avx2_DECL(float, pcosts, 2 * tpitch * VECTSIZE);
+  Eedi3Avx2_DECL(__m256i, rsums, tpitch);     // Running sums of the nrad window, for each u
+  Eedi3Avx2_DECL(__m256i, s0tab, tpitch * tpitch);
+  Eedi3Avx2_DECL(int8_t, pbackt, width * tpitch * VECTSIZE);
+  Eedi3Avx2_DECL(int8_t, fpath, width          * VECTSIZE);
+  Eedi3Avx2_DECL(bool, bmask, width);
+  Eedi3Avx2_DECL(bool, tmask, width);            // Centers needed in the s0 table (cost3)
+
+#undef Eedi3Avx2_DECL
+
+  if (msk_ptr != 0)
+  {
+    Eedi3Sse::expand_mask(bmask, msk_ptr, width, mdis, COL_H);
+    if (cost3)
+    {
+      Eedi3Sse::expand_mask(tmask, msk_ptr, width, mdis * 2, COL_H);
+    }
+  }
+
+  const __m256   alpha_8 = _mm256_set1_ps((cost3) ? alpha / 3.f : alpha);
+  const __m256   ab_8 = _mm256_set1_ps(1.0f - alpha - beta);
+
+  const int      tpitch_v = tpitch * VECTSIZE;
+
+  // beta is calibrated for 8-bit content. We have to scale it because it is
+  // not multiplied by a pixel value in the formula, contrary to the global
+  // result which depends on the data scale.
+  const float    beta16 = beta * 256;
+
+  const __m256   fltmax9 = _mm256_set1_ps(FLT_MAX * 0.9f);
+  const __m256i  zero = _mm256_setzero_si256();
+
+  // Same reason as beta16
+  const float    gamma16 = gamma * 256;
+
+  // Fixed-point mode, see Eedi3Sse::interp_lines_full_pel()
+  int            ka;
+  int            kb;
+  int            kc;
+  int            kg;
+  Eedi3Sse::quantize_costs(ka, kb, kc, kg, alpha, beta, gamma, cost3);
+  const __m256i  kac = _mm256_set1_epi32((kc << 16) + ka);
+  const __m256i  fixmax = _mm256_set1_epi32(Eedi3Sse::FIXED_MAX);
+
+  // Path costs outside the u range of a column are set to the maximum
+  // value, because a masked column copies all of them and the next one may
+  // read them.
+  for (int k = 0; k < 2 * tpitch; ++k)
+  {
+    if (fixed)
+    {
+      _mm256_store_si256(reinterpret_cast <__m256i *> (pcosts) + k, fixmax);
+    }
+    else
+    {
+      _mm256_store_ps(pcosts + k * VECTSIZE, fltmax9);
+    }
+  }
+
+  // The nrad window sums are slid along x, see Eedi3Sse::interp_lines_full_pel()
+  int            umaxp = -1;
+
+  // With cost3, s1 and s2 are read from a table of the s0 sums, filled mdis
+  // columns ahead. See Eedi3Sse::interp_lines_full_pel() for the details.
+  int            cnext = 0;
+  int            unegp = -1;
+  int            uposp = -1;
+
+  for (int x = 0; x < width; ++x)
+  {
+    // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+    // Calculate the connection costs
+
+    if (cost3)
+    {
+      for (const int cend = std::min(x + mdis, width - 1); cnext <= cend; ++cnext)
+      {
+        const int      c = cnext;
+        if (msk_ptr == 0 || tmask[c] != 0)
+        {
+          const int      uneg = std::min(std::min(c, width - 1 - c), mdis);
+          const int      upos = std::min(c, mdis);
+          __m256i *      sT = s0tab + (c % tpitch) * tpitch + mdis;
+          const __m256i *psT = s0tab + ((c + tpitch - 1) % tpitch) * tpitch + mdis;
+          for (int u = -uneg; u <= upos; ++u)
+          {
+            sT[u] = (-u > unegp || u > uposp)
+              ? sum_nrad(
+                  nrad, c - u, c + u,
+                  src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+                )
+              : slide_sum_nrad(
+                  psT[u], nrad, c - u, c + u,
+                  src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+                );
+          }
+          unegp = uneg;
+          uposp = upos;
+        }
+        else
+        {
+          unegp = -1;
+          uposp = -1;
+        }
+      }
+    }
+
+    if (msk_ptr == 0 || bmask[x] != 0)
+    {
+      const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+      for (int u = -umax; u <= umax; ++u)
+      {
+        __m256i        s;
+        if (cost3)
+        {
+          const bool     s1_flag = ((u >= 0 && x >= u * 2)
+            || (u <= 0 && x < width + u * 2));
+          const bool     s2_flag = ((u <= 0 && x >= u * -2)
+            || (u >= 0 && x < width + u * 2));
+
+          const int      mu = mdis + u;
+          const __m256i  s0 = s0tab [(x % tpitch) * tpitch + mu];
+          __m256i        s1 = s0;
+          __m256i        s2 = s0;
+          if (s1_flag)
+          {
+            s1 = s0tab [((x - u) % tpitch) * tpitch + mu]; // Center x - u
+          }
+          if (s2_flag)
+          {
+            s2 = s0tab [((x + u) % tpitch) * tpitch + mu]; // Center x + u
+          }
+          s1 = (s1_flag) ? s1 : s2;
+          s2 = (s2_flag) ? s2 : s1;
+
+          s = _mm256_add_epi32(_mm256_add_epi32(s0, s1), s2);
+        }
+        else
+        {
+          __m256i &      rs = rsums[mdis + u];
+          rs = (std::abs(u) > umaxp)
+            ? sum_nrad(
+                nrad, x - u, x + u,
+                src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+              )
+            : slide_sum_nrad(
+                rs, nrad, x - u, x + u,
+                src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+              );
+          s = rs;
+        }
+
+        if (fixed)
+        {
+          const __m256i  cc = conn_cost_fixed(
+            s, src1p_ptr, src1n_ptr, x, u, kac, kb
+          );
+          _mm256_store_si256(
+            reinterpret_cast <__m256i *> (ccosts + (mdis + u) * VECTSIZE), cc
+          );
+          continue;
+        }
+
+        const __m256   cc = conn_cost(
+          s, src1p_ptr, src1n_ptr, x, u, alpha_8, ab_8, beta16
+        );
+        _mm256_store_ps(ccosts + (mdis + u) * VECTSIZE, cc);
+      }
+      umaxp = umax;
+    }
+    else
+    {
+      memset(ccosts, 0, tpitch_v * sizeof(*ccosts));
+      umaxp = -1;
+    }
+
+    // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+    // Calculate the path costs
+
+    const float *  tT = ccosts;
+    float *        ppT = pcosts + ((x + 1) & 1) * tpitch_v;
+    float *        pT = pcosts + (x & 1) * tpitch_v;
+
+    if (x == 0)
+    {
+      const int      p = mdis * VECTSIZE;
+      _mm256_store_ps(pT + p, _mm256_load_ps(tT + p));
+      continue;
+    }
+
+    int8_t *       piT = pbackt + (x - 1) * tpitch_v;
+
+
+    if (msk_ptr != 0 && bmask[x] == 0)
+    {
+      if (x == 1)
+      {
+        const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+        const int      p = (mdis - umax) * VECTSIZE;
+        memcpy(pT + p, tT + p, (umax * 2 + 1) * VECTSIZE * sizeof(*pT));
+        memset(piT, 0, tpitch_v * sizeof(*piT));
+      }
+      else
+      {
+        memcpy(pT, ppT, tpitch_v * sizeof(*pT));
+        memcpy(piT, piT - tpitch_v, tpitch_v * sizeof(*piT));
+        const int      pumax = std::min(x - 1, width - x);
+        if (pumax < mdis)
+        {
+          memset(piT + (mdis - pumax) * VECTSIZE, 1 - pumax, VECTSIZE);
+          memset(piT + (mdis + pumax) * VECTSIZE, pumax - 1, VECTSIZE);
+        }
+      }
+    }
+
+    else if (fixed)
+    {
+      path_cost_fixed(
+        reinterpret_cast <int32_t *> (pT), piT,
+        reinterpret_cast <const int32_t *> (ppT),
+        reinterpret_cast <const int32_t *> (tT),
+        x, width, mdis, kg
+      );
+    }
+
+    else
+    {
+      path_cost(pT, piT, ppT, tT, x, width, mdis, gamma16);
+    }
+  }
+
+  // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+  // Backtrack
+
+  memset(fpath + (width - 1) * VECTSIZE, 0, VECTSIZE * sizeof(*fpath));
+  for (int x = width - 2; x >= 0; --x)
+  {
+    const int      idx_n = (x + 1)             * VECTSIZE;
+    const int      idx_c = x * VECTSIZE;
+    const int      idx_p = (x * tpitch + mdis) * VECTSIZE;
+    for (int k = 0; k < VECTSIZE; ++k)
+    {
+      const int      n = fpath[idx_n + k];
+      fpath[idx_c + k] = pbackt[idx_p + n * VECTSIZE + k];
+    }
+  }
+
+  // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+  // Interpolate
+
+  // The gathers read 32 bits at 16-bit positions, the unused upper word is
+  // always in the next column or in the right margin.
+  const int *    src1p16_ptr = reinterpret_cast <const int *> (src1p_ptr);
+  const int *    src1n16_ptr = reinterpret_cast <const int *> (src1n_ptr);
+  const int *    src3p16_ptr = reinterpret_cast <const int *> (src3p_ptr);
+  const int *    src3n16_ptr = reinterpret_cast <const int *> (src3n_ptr);
+  const __m256i  lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i  mask16 = _mm256_set1_epi32(0xFFFF);
+  const __m256i  one = _mm256_set1_epi32(1);
+  const __m256i  nine = _mm256_set1_epi32(9);
+  // Rounding of the cubic interpolation, see
+  // Eedi3Sse::interp_lines_full_pel()
+  const int      cubic_rnd = (bits < 16) ? 0 : 8;
+  const __m256i  rnd = _mm256_set1_epi32(cubic_rnd);
+  const __m256i  rnd_h = _mm256_set1_epi32(cubic_rnd >> 1);
+  const __m256i  max16 = _mm256_set1_epi32(65535);
+  for (int x = 0; x < width; ++x)
+  {
+    if (msk_ptr != 0 && bmask[x] == 0)
+    {
+      _mm_store_si128(dmap_ptr + x, _mm_setzero_si128());
+
+      __m128i        res;
+      if (ucubic)
+      {
+        res = interp_cubic8(
+          _mm_load_si128(src1p_ptr + x),
+          _mm_load_si128(src1n_ptr + x),
+          _mm_load_si128(src3p_ptr + x),
+          _mm_load_si128(src3n_ptr + x),
+          rnd_h
+        );
+      }
+      else
+      {
+        res = _mm_avg_epu16(
+          _mm_load_si128(src1p_ptr + x),
+          _mm_load_si128(src1n_ptr + x)
+        );
+      }
+      _mm_store_si128(dst_ptr + x, res);
+    }
+
+    else
+    {
+      const __m256i  dir = _mm256_cvtepi8_epi32(_mm_loadl_epi64(
+        reinterpret_cast <const __m128i *> (fpath + x * VECTSIZE)
+      ));
+      _mm_store_si128(dmap_ptr + x, _mm_packs_epi32(
+        _mm256_castsi256_si128(dir),
+        _mm256_extracti128_si256(dir, 1)
+      ));
+
+      const __m256i  xv = _mm256_set1_epi32(x);
+      const __m256i  xp1 = _mm256_add_epi32(xv, dir);
+      const __m256i  xn1 = _mm256_sub_epi32(xv, dir);
+      const __m256i  i1p = _mm256_add_epi32(_mm256_slli_epi32(xp1, 3), lane);
+      const __m256i  i1n = _mm256_add_epi32(_mm256_slli_epi32(xn1, 3), lane);
+      const __m256i  x1p = _mm256_and_si256(_mm256_i32gather_epi32(src1p16_ptr, i1p, 2), mask16);
+      const __m256i  x1n = _mm256_and_si256(_mm256_i32gather_epi32(src1n16_ptr, i1n, 2), mask16);
+      const __m256i  sum_1 = _mm256_add_epi32(x1p, x1n);
+
+      __m256i        res = _mm256_srli_epi32(_mm256_add_epi32(sum_1, one), 1);
+
+      if (ucubic)
+      {
+        // Lanes where x >= ad * 3 && x <= width - 1 - ad * 3
+        const __m256i  ad3 = _mm256_mullo_epi32(_mm256_abs_epi32(dir), _mm256_set1_epi32(3));
+        const __m256i  cnd = _mm256_andnot_si256(
+          _mm256_or_si256(
+            _mm256_cmpgt_epi32(ad3, xv),
+            _mm256_cmpgt_epi32(ad3, _mm256_set1_epi32(width - 1 - x))
+          ),
+          _mm256_set1_epi32(-1)
+        );
+        if (! _mm256_testz_si256(cnd, cnd))
+        {
+          const __m256i  dir3 = _mm256_add_epi32(dir, _mm256_add_epi32(dir, dir));
+          const __m256i  i3p = _mm256_add_epi32(
+            _mm256_slli_epi32(_mm256_add_epi32(xv, dir3), 3), lane
+          );
+          const __m256i  i3n = _mm256_add_epi32(
+            _mm256_slli_epi32(_mm256_sub_epi32(xv, dir3), 3), lane
+          );
+          const __m256i  x3p = _mm256_and_si256(_mm256_mask_i32gather_epi32(
+            zero, src3p16_ptr, i3p, cnd, 2
+          ), mask16);
+          const __m256i  x3n = _mm256_and_si256(_mm256_mask_i32gather_epi32(
+            zero, src3n16_ptr, i3n, cnd, 2
+          ), mask16);
+          const __m256i  sum_3 = _mm256_add_epi32(x3p, x3n);
+
+          // (9 * sum_1 - sum_3 + cubic_rnd) >> 4
+          __m256i        cub = _mm256_mullo_epi32(sum_1, nine);
+          cub = _mm256_sub_epi32(cub, sum_3);
+          cub = _mm256_srai_epi32(_mm256_add_epi32(cub, rnd), 4);
+          cub = _mm256_min_epi32(_mm256_max_epi32(cub, zero), max16);
+
+          res = _mm256_blendv_epi8(res, cub, cnd);
+        }
+      }
+
+      _mm_store_si128(dst_ptr + x, _mm_packus_epi32(
+        _mm256_castsi256_si128(res),
+        _mm256_extracti128_si256(res, 1)
+      ));
+    }
+  }  // for x
+
+  _mm256_zeroupper();
+}
+
+
+
+/*
+==============================================================================
+Name: vcheck_line
+Description:
+  Vertical consistency check of an interpolated line, 8 pixels at once.
+  Same as Eedi3Sse::vcheck_line(), the pixels at the direction offsets are
+  fetched with gathers.
+  The caller must make sure there are at least 7 readable bytes after
+  x_end on all the lines, as well as on the direction map.
+Output parameters:
+  - dst_ptr: The checked line. Up to 7 bytes after x_end may be overwritten.
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Avx2::vcheck_line(uint8_t *dst_ptr, const uint8_t *dst2p_ptr, const uint8_t *cur_ptr, int cur_pitch, const uint8_t *src3p_ptr, const uint8_t *src3n_ptr, const uint8_t *scp_ptr, const int8_t *dmap_ptr, int dmap_pitch, int x_beg, int x_end, int vcheck, float vthresh0, float vthresh1, float vthresh2, bool hp)
+{
+  assert(dst_ptr != 0);
+  assert(dst2p_ptr != 0);
+  assert(cur_ptr != 0);
+  assert(cur_pitch > 0);
+  assert(src3p_ptr != 0);
+  assert(src3n_ptr != 0);
+  assert(dmap_ptr != 0);
+  assert(dmap_pitch > 0);
+  assert(x_beg >= 0);
+  assert(x_beg <= x_end);
+  assert(vcheck >= 1 && vcheck <= 3);
+  assert(vthresh0 > 0);
+  assert(vthresh1 > 0);
+  assert(vthresh2 > 0);
+
+  const uint8_t* dst1p_ptr = cur_ptr - cur_pitch;
+  const uint8_t* dst1n_ptr = cur_ptr + cur_pitch;
+  const uint8_t* dst2n_ptr = cur_ptr + cur_pitch * 2;
+  const int8_t * dmapt_ptr = dmap_ptr - dmap_pitch;
+  const int8_t * dmapb_ptr = dmap_ptr + dmap_pitch;
+
+  const __m256i  zero = _mm256_setzero_si256();
+  const __m256i  one = _mm256_set1_epi32(1);
+  const __m256i  eight = _mm256_set1_epi32(8);
+  const __m256i  c255 = _mm256_set1_epi32(255);
+  const __m256i  lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256   vt0 = _mm256_set1_ps(vthresh0);
+  const __m256   vt1 = _mm256_set1_ps(vthresh1);
+  const __m256   vt2 = _mm256_set1_ps(vthresh2);
+  const __m256   onef = _mm256_set1_ps(1.0f);
+  const __m256d  oned = _mm256_set1_pd(1.0);
+
+  for (int x = x_beg; x < x_end; x += 8)
+  {
+    const __m256i  d1p = load_pix8(dst1p_ptr + x);
+    const __m256i  d1n = load_pix8(dst1n_ptr + x);
+    const __m256i  cur = load_pix8(cur_ptr + x);
+    __m256i        cint;
+    if (scp_ptr != 0)
+    {
+      cint = load_pix8(scp_ptr + x);
+    }
+    else
+    {
+      // (9 * (d1p + d1n) - (d3p + d3n) + 8) >> 4, clipped to [0 ; 255]
+      const __m256i  s1 = _mm256_add_epi32(d1p, d1n);
+      const __m256i  s3 = _mm256_add_epi32(load_pix8(src3p_ptr + x), load_pix8(src3n_ptr + x));
+      cint = _mm256_add_epi32(_mm256_slli_epi32(s1, 3), s1);
+      cint = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(cint, s3), eight), 4);
+      cint = _mm256_min_epi32(_mm256_max_epi32(cint, zero), c255);
+    }
+
+    // Pixels keeping the cubic interpolation, see Eedi3Sse::vcheck_line()
+    const __m256i  valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(x_end - x), lane);
+    const __m256i  dirc = _mm256_and_si256(load_dir8(dmap_ptr + x), valid);
+    const __m256i  dirt = load_dir8(dmapt_ptr + x);
+    const __m256i  dirb = load_dir8(dmapb_ptr + x);
+    const __m256i  opp_t = _mm256_cmpgt_epi32(zero, _mm256_mullo_epi32(dirc, dirt));
+    const __m256i  opp_b = _mm256_cmpgt_epi32(zero, _mm256_mullo_epi32(dirc, dirb));
+    const __m256i  keep = _mm256_or_si256(
+      _mm256_or_si256(
+        _mm256_cmpeq_epi32(dirc, zero),
+        _mm256_cmpeq_epi32(_mm256_or_si256(dirt, dirb), zero)
+      ),
+      _mm256_and_si256(opp_t, opp_b)
+    );
+
+    __m256i        res = cint;
+    if (_mm256_movemask_epi8(keep) != -1)
+    {
+      // Offsets of the pixel pairs
+      const __m256i  dirk = _mm256_andnot_si256(keep, dirc);
+      __m256i        o0 = dirk;
+      __m256i        o1 = dirk;
+      __m256i        dircv = _mm256_abs_epi32(dirk);
+      if (hp)
+      {
+        o0 = _mm256_srai_epi32(dirk, 1);
+        o1 = _mm256_srai_epi32(_mm256_add_epi32(dirk, one), 1);
+        dircv = _mm256_srai_epi32(dircv, 1);
+      }
+      const __m256i  xl = _mm256_add_epi32(_mm256_set1_epi32(x), lane);
+      const __m256i  xp0 = _mm256_add_epi32(xl, o0);
+      const __m256i  xp1 = _mm256_add_epi32(xl, o1);
+      const __m256i  xn0 = _mm256_sub_epi32(xl, o0);
+      const __m256i  xn1 = _mm256_sub_epi32(xl, o1);
+
+      // Pair sums + 1
+      const __m256i  pa2p = sum_pair(dst2p_ptr, xp0, xp1);
+      const __m256i  pa1p = sum_pair(dst1p_ptr, xp0, xp1);
+      const __m256i  pa0  = sum_pair(cur_ptr,   xp0, xp1);
+      const __m256i  ps0  = sum_pair(cur_ptr,   xn0, xn1);
+      const __m256i  ps1n = sum_pair(dst1n_ptr, xn0, xn1);
+      const __m256i  ps2n = sum_pair(dst2n_ptr, xn0, xn1);
+
+      const __m256i  it = _mm256_srai_epi32(_mm256_add_epi32(pa2p, ps0), 2);
+      const __m256i  ib = _mm256_srai_epi32(_mm256_add_epi32(pa0, ps2n), 2);
+      const __m256i  vt = _mm256_srai_epi32(_mm256_add_epi32(
+        _mm256_abs_epi32(_mm256_sub_epi32(pa2p, pa1p)),
+        _mm256_abs_epi32(_mm256_sub_epi32(pa0, pa1p))
+      ), 1);
+      const __m256i  vb = _mm256_srai_epi32(_mm256_add_epi32(
+        _mm256_abs_epi32(_mm256_sub_epi32(ps2n, ps1n)),
+        _mm256_abs_epi32(_mm256_sub_epi32(ps0, ps1n))
+      ), 1);
+      const __m256i  vc = _mm256_add_epi32(
+        _mm256_abs_epi32(_mm256_sub_epi32(cur, d1p)),
+        _mm256_abs_epi32(_mm256_sub_epi32(cur, d1n))
+      );
+      const __m256i  d0 = _mm256_abs_epi32(_mm256_sub_epi32(it, d1p));
+      const __m256i  d1 = _mm256_abs_epi32(_mm256_sub_epi32(ib, d1n));
+      const __m256i  d2 = _mm256_abs_epi32(_mm256_sub_epi32(vt, vc));
+      const __m256i  d3 = _mm256_abs_epi32(_mm256_sub_epi32(vb, vc));
+      __m256i        mdiff0;
+      __m256i        mdiff1;
+      if (vcheck == 1)
+      {
+        mdiff0 = _mm256_min_epi32(d0, d1);
+        mdiff1 = _mm256_min_epi32(d2, d3);
+      }
+      else if (vcheck == 2)
+      {
+        mdiff0 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(d0, d1), one), 1);
+        mdiff1 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(d2, d3), one), 1);
+      }
+      else
+      {
+        mdiff0 = _mm256_max_epi32(d0, d1);
+        mdiff1 = _mm256_max_epi32(d2, d3);
+      }
+
+      const __m256   a0 = _mm256_div_ps(_mm256_cvtepi32_ps(mdiff0), vt0);
+      const __m256   a1 = _mm256_div_ps(_mm256_cvtepi32_ps(mdiff1), vt1);
+      const __m256   a2 = _mm256_max_ps(
+        _mm256_div_ps(_mm256_sub_ps(vt2, _mm256_cvtepi32_ps(dircv)), vt2),
+        _mm256_setzero_ps()
+      );
+      const __m256   a = _mm256_min_ps(_mm256_max_ps(_mm256_max_ps(a0, a1), a2), onef);
+
+      // (1 - a) * cur + a * cint, see Eedi3Sse::vcheck_line(). No FMA here,
+      // the result would differ.
+      const __m256   curf = _mm256_cvtepi32_ps(cur);
+      const __m256   acf = _mm256_mul_ps(a, _mm256_cvtepi32_ps(cint));
+      const __m256d  a_lo = _mm256_cvtps_pd(_mm256_castps256_ps128(a));
+      const __m256d  a_hi = _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1));
+      const __m256d  r_lo = _mm256_add_pd(
+        _mm256_mul_pd(
+          _mm256_sub_pd(oned, a_lo),
+          _mm256_cvtps_pd(_mm256_castps256_ps128(curf))
+        ),
+        _mm256_cvtps_pd(_mm256_castps256_ps128(acf))
+      );
+      const __m256d  r_hi = _mm256_add_pd(
+        _mm256_mul_pd(
+          _mm256_sub_pd(oned, a_hi),
+          _mm256_cvtps_pd(_mm256_extractf128_ps(curf, 1))
+        ),
+        _mm256_cvtps_pd(_mm256_extractf128_ps(acf, 1))
+      );
+      const __m256i  blend = _mm256_setr_m128i(
+        _mm256_cvttpd_epi32(r_lo), _mm256_cvttpd_epi32(r_hi)
+      );
+      res = _mm256_blendv_epi8(blend, cint, keep);
+    }
+
+    const __m128i  res16 = _mm_packs_epi32(
+      _mm256_castsi256_si128(res), _mm256_extracti128_si256(res, 1)
+    );
+    _mm_storel_epi64(
+      reinterpret_cast <__m128i *> (dst_ptr + x), _mm_packus_epi16(res16, res16)
+    );
+  }
+}
+
+
+
+/*\\\ PROTECTED \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+
+
+/*\\\ PRIVATE \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+
+
+// The middle row pair is not computed, it is derived from the top one of
+// the next lane. See Eedi3Sse::sum_nrad() for the details.
+__m256i	Eedi3Avx2::sum_nrad(int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n)
+{
+  assert(nrad >= 0);
+  assert(src3p != 0);
+  assert(src1p != 0);
+  assert(src1n != 0);
+  assert(src3n != 0);
+
+  __m256i        a;
+  __m256i        b;
+  sum_row_pairs(a, b, nrad, xl, xr, src3p, src1p, src1n, src3n);
+
+  return (combine_row_pairs(a, b));
+}
+
+
+
+// Slides the nrad window sum s from x - 1 to x. xl and xr are the window
+// centers for x, as in sum_nrad().
+__m256i	Eedi3Avx2::slide_sum_nrad(const __m256i &s, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n)
+{
+  assert(nrad >= 0);
+
+  __m256i        aa;
+  __m256i        ab;
+  sum_row_pairs(aa, ab, 0, xl + nrad, xr + nrad, src3p, src1p, src1n, src3n);
+  __m256i        ra;
+  __m256i        rb;
+  sum_row_pairs(ra, rb, 0, xl - 1 - nrad, xr - 1 - nrad, src3p, src1p, src1n, src3n);
+
+  // The combination is linear, we can apply it to the difference.
+  const __m256i  d = combine_row_pairs(
+    _mm256_sub_epi32(aa, ra), _mm256_sub_epi32(ab, rb)
+  );
+
+  return (_mm256_add_epi32(s, d));
+}
+
+
+
+// Sums the absolute differences of the top (a: 3p-1p) and bottom (b: 1n-3n)
+// row pairs over the window.
+void	Eedi3Avx2::sum_row_pairs(__m256i &a, __m256i &b, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n)
+{
+  assert(nrad >= 0);
+  assert(src3p != 0);
+  assert(src1p != 0);
+  assert(src1n != 0);
+  assert(src3n != 0);
+
+  a = _mm256_setzero_si256();
+  b = _mm256_setzero_si256();
+  for (int k = -nrad; k <= nrad; ++k)
+  {
+    const int      xrk = xr + k;
+    const int      xlk = xl + k;
+    const __m128i  x3pr = _mm_load_si128(src3p + xrk);
+    const __m128i  x1pl = _mm_load_si128(src1p + xlk);
+    const __m128i  x1nr = _mm_load_si128(src1n + xrk);
+    const __m128i  x3nl = _mm_load_si128(src3n + xlk);
+
+    const __m128i  d3p1p = difabs16(x3pr, x1pl);
+    const __m128i  d1n3n = difabs16(x1nr, x3nl);
+
+    a = _mm256_add_epi32(a, _mm256_cvtepu16_epi32(d3p1p));
+    b = _mm256_add_epi32(b, _mm256_cvtepu16_epi32(d1n3n));
+  }
+}
+
+
+
+// Returns a + b + m, m being the middle row pair rebuilt from a and b.
+__m256i	Eedi3Avx2::combine_row_pairs(const __m256i &a, const __m256i &b)
+{
+  // m: lanes 1 to 7 of a, then lane 6 of b
+  const __m256i  idx = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 6);
+  const __m256i  m = _mm256_blend_epi32(
+    _mm256_permutevar8x32_epi32(a, idx),
+    _mm256_permutevar8x32_epi32(b, idx),
+    0x80
+  );
+
+  return (_mm256_add_epi32(_mm256_add_epi32(a, b), m));
+}
+
+
+
+// s is the neighbourhood sum (already summed over the 3 neighbourhoods
+// with cost3).
+__m256	Eedi3Avx2::conn_cost(const __m256i &s, const __m128i *src1p, const __m128i *src1n, int x, int u, const __m256 &alpha_8, const __m256 &ab_8, float beta16)
+{
+  // should use cubic if ucubic=true
+  const __m128i  x1pr = _mm_load_si128(src1p + x + u);
+  const __m128i  x1nl = _mm_load_si128(src1n + x - u);
+  const __m128i  ip = _mm_avg_epu16(x1pr, x1nl);
+
+  const __m128i  x1p = _mm_load_si128(src1p + x);
+  const __m128i  x1n = _mm_load_si128(src1n + x);
+  const __m128i  vdp = difabs16(x1p, ip);
+  const __m128i  vdn = difabs16(x1n, ip);
+  const __m256i  v = _mm256_add_epi32(
+    _mm256_cvtepu16_epi32(vdp),
+    _mm256_cvtepu16_epi32(vdn)
+  );
+
+  const __m256   cc_a = _mm256_mul_ps(_mm256_cvtepi32_ps(s), alpha_8);
+  const __m256   cc_b = _mm256_set1_ps(beta16 * std::abs(u));
+  const __m256   cc_c = _mm256_mul_ps(_mm256_cvtepi32_ps(v), ab_8);
+
+  return (_mm256_add_ps(_mm256_add_ps(cc_a, cc_b), cc_c));
+}
+
+
+
+// Fixed-point counterpart of conn_cost(), see Eedi3Sse::conn_cost_fixed()
+__m256i	Eedi3Avx2::conn_cost_fixed(const __m256i &s, const __m128i *src1p, const __m128i *src1n, int x, int u, const __m256i &kac, int kb)
+{
+  const __m128i  x1pr = _mm_load_si128(src1p + x + u);
+  const __m128i  x1nl = _mm_load_si128(src1n + x - u);
+  const __m128i  ip = _mm_avg_epu16(x1pr, x1nl);
+
+  const __m128i  x1p = _mm_load_si128(src1p + x);
+  const __m128i  x1n = _mm_load_si128(src1n + x);
+  const __m128i  vdp = difabs16(x1p, ip);
+  const __m128i  vdn = difabs16(x1n, ip);
+  const __m256i  v = _mm256_add_epi32(
+    _mm256_cvtepu16_epi32(vdp),
+    _mm256_cvtepu16_epi32(vdn)
+  );
+
+  const __m256i  sv = _mm256_or_si256(
+    _mm256_srli_epi32(s, 8),
+    _mm256_slli_epi32(_mm256_srli_epi32(v, 7), 16)
+  );
+  const __m256i  cc_b = _mm256_set1_epi32(kb * std::abs(u));
+
+  return (_mm256_add_epi32(_mm256_madd_epi16(sv, kac), cc_b));
+}
+
+
+
+// Path cost recursion for a column, see Eedi3Sse::path_cost()
+void	Eedi3Avx2::path_cost(float *pT, int8_t *piT, const float *ppT, const float *tT, int x, int width, int mdis, float gamma16)
+{
+  assert(pT != 0);
+  assert(piT != 0);
+  assert(ppT != 0);
+  assert(tT != 0);
+  assert(x > 0);
+  assert(x < width);
+  assert(mdis > 0);
+  assert(gamma16 >= 0);
+
+  const __m256   fltmax = _mm256_set1_ps(FLT_MAX);
+  const __m256   fltmax9 = _mm256_set1_ps(FLT_MAX * 0.9f);
+  const __m256   pen = _mm256_set1_ps(gamma16);
+  const __m256i  one = _mm256_set1_epi32(1);
+  const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+  const int      umax2 = std::min(std::min(x - 1, width - x), mdis);
+  __m256i        dir_l = _mm256_set1_epi32(-umax - 1);
+  for (int u = -umax; u <= umax; ++u)
+  {
+    const int      mu = (mdis + u) * VECTSIZE;
+    const float *  ppT_u = ppT + mu;
+    const __m256i  dir_c = _mm256_add_epi32(dir_l, one);
+    __m256         bval = fltmax;
+    __m256i        idx = _mm256_setzero_si256();
+    if (u > -umax2)
+    {
+      // Always taken: bval is above any clipped cost
+      bval = _mm256_min_ps(_mm256_add_ps(_mm256_load_ps(ppT_u - VECTSIZE), pen), fltmax9);
+      idx = dir_l;
+    }
+    if (std::abs(u) <= umax2)
+    {
+      const __m256   ccost = _mm256_min_ps(_mm256_load_ps(ppT_u), fltmax9);
+      idx = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_castsi256_ps(idx),
+        _mm256_castsi256_ps(dir_c),
+        _mm256_cmp_ps(ccost, bval, _CMP_LT_OQ)
+      ));
+      bval = _mm256_min_ps(ccost, bval);
+    }
+    if (u < umax2)
+    {
+      const __m256   ccost = _mm256_min_ps(_mm256_add_ps(_mm256_load_ps(ppT_u + VECTSIZE), pen), fltmax9);
+      idx = _mm256_castps_si256(_mm256_blendv_ps(
+        _mm256_castsi256_ps(idx),
+        _mm256_castsi256_ps(_mm256_add_epi32(dir_c, one)),
+        _mm256_cmp_ps(ccost, bval, _CMP_LT_OQ)
+      ));
+      bval = _mm256_min_ps(ccost, bval);
+    }
+    dir_l = dir_c;
+
+    __m256         y = _mm256_add_ps(bval, _mm256_load_ps(tT + mu));
+    y = _mm256_min_ps(y, fltmax9);
+    _mm256_store_ps(pT + mu, y);
+    const __m128i  idx16 = _mm_packs_epi32(
+      _mm256_castsi256_si128(idx),
+      _mm256_extracti128_si256(idx, 1)
+    );
+    _mm_storel_epi64(
+      reinterpret_cast <__m128i *> (piT + mu),
+      _mm_packs_epi16(idx16, idx16)
+    );
+  }
+
+  for (int u = umax + 1; u <= mdis; ++u)
+  {
+    _mm256_store_ps(pT + (mdis - u) * VECTSIZE, fltmax9);
+    _mm256_store_ps(pT + (mdis + u) * VECTSIZE, fltmax9);
+  }
+}
+
+
+
+// Fixed-point path cost recursion for a column, see
+// Eedi3Sse::path_cost_fixed()
+void	Eedi3Avx2::path_cost_fixed(int32_t *pT, int8_t *piT, const int32_t *ppT, const int32_t *tT, int x, int width, int mdis, int kg)
+{
+  assert(pT != 0);
+  assert(piT != 0);
+  assert(ppT != 0);
+  assert(tT != 0);
+  assert(x > 0);
+  assert(x < width);
+  assert(mdis > 0);
+  assert(kg >= 0);
+
+  __m256i *      pT_v = reinterpret_cast <__m256i *> (pT);
+  const __m256i* ppT_v = reinterpret_cast <const __m256i *> (ppT);
+  const __m256i* tT_v = reinterpret_cast <const __m256i *> (tT);
+
+  const __m256i  fixmax = _mm256_set1_epi32(Eedi3Sse::FIXED_MAX);
+  const __m256i  pen = _mm256_set1_epi32(kg);
+  const __m256i  one = _mm256_set1_epi32(1);
+  const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+  const int      umax2 = std::min(std::min(x - 1, width - x), mdis);
+  __m256i        pmin = fixmax;
+  __m256i        dir_l = _mm256_set1_epi32(-umax - 1);
+  for (int u = -umax; u <= umax; ++u)
+  {
+    const __m256i* ppT_u = ppT_v + mdis + u;
+    const __m256i  dir_c = _mm256_add_epi32(dir_l, one);
+    __m256i        bval = _mm256_set1_epi32(INT32_MAX);
+    __m256i        idx = _mm256_setzero_si256();
+    if (u > -umax2)
+    {
+      // Always taken: bval is above any clipped cost
+      bval = _mm256_min_epi32(_mm256_add_epi32(_mm256_load_si256(ppT_u - 1), pen), fixmax);
+      idx = dir_l;
+    }
+    if (std::abs(u) <= umax2)
+    {
+      const __m256i  ccost = _mm256_min_epi32(_mm256_load_si256(ppT_u), fixmax);
+      idx = _mm256_blendv_epi8(idx, dir_c, _mm256_cmpgt_epi32(bval, ccost));
+      bval = _mm256_min_epi32(ccost, bval);
+    }
+    if (u < umax2)
+    {
+      const __m256i  ccost = _mm256_min_epi32(_mm256_add_epi32(_mm256_load_si256(ppT_u + 1), pen), fixmax);
+      idx = _mm256_blendv_epi8(idx, _mm256_add_epi32(dir_c, one), _mm256_cmpgt_epi32(bval, ccost));
+      bval = _mm256_min_epi32(ccost, bval);
+    }
+    dir_l = dir_c;
+
+    __m256i        y = _mm256_add_epi32(bval, _mm256_load_si256(tT_v + mdis + u));
+    y = _mm256_min_epi32(y, fixmax);
+    _mm256_store_si256(pT_v + mdis + u, y);
+    pmin = _mm256_min_epi32(y, pmin);
+    const __m128i  idx16 = _mm_packs_epi32(
+      _mm256_castsi256_si128(idx),
+      _mm256_extracti128_si256(idx, 1)
+    );
+    _mm_storel_epi64(
+      reinterpret_cast <__m128i *> (piT + (mdis + u) * VECTSIZE),
+      _mm_packs_epi16(idx16, idx16)
+    );
+  }
+
+  for (int u = -umax; u <= umax; ++u)
+  {
+    _mm256_store_si256(pT_v + mdis + u, _mm256_sub_epi32(pT_v [mdis + u], pmin));
+  }
+  for (int u = umax + 1; u <= mdis; ++u)
+  {
+    _mm256_store_si256(pT_v + mdis - u, fixmax);
+    _mm256_store_si256(pT_v + mdis + u, fixmax);
+  }
+}
+
+
+
+// Loads 8 consecutive 8-bit pixels and returns them as 32-bit int.
+__m256i	Eedi3Avx2::load_pix8(const uint8_t *src_ptr)
+{
+  assert(src_ptr != 0);
+
+  return (_mm256_cvtepu8_epi32(
+    _mm_loadl_epi64(reinterpret_cast <const __m128i *> (src_ptr))
+  ));
+}
+
+
+
+// Loads 8 directions stored as bytes and returns them as 32-bit signed int.
+__m256i	Eedi3Avx2::load_dir8(const int8_t *src_ptr)
+{
+  assert(src_ptr != 0);
+
+  return (_mm256_cvtepi8_epi32(
+    _mm_loadl_epi64(reinterpret_cast <const __m128i *> (src_ptr))
+  ));
+}
+
+
+
+// Returns src_ptr [x0] + src_ptr [x1] + 1 for each lane. The gathers read 32
+// bits, the caller makes sure the 3 bytes after each pixel are readable.
+__m256i	Eedi3Avx2::sum_pair(const uint8_t *src_ptr, const __m256i &x0, const __m256i &x1)
+{
+  assert(src_ptr != 0);
+
+  const int *    src32_ptr = reinterpret_cast <const int *> (src_ptr);
+  const __m256i  mask8 = _mm256_set1_epi32(0xFF);
+  const __m256i  p0 = _mm256_and_si256(_mm256_i32gather_epi32(src32_ptr, x0, 1), mask8);
+  const __m256i  p1 = _mm256_and_si256(_mm256_i32gather_epi32(src32_ptr, x1, 1), mask8);
+
+  return (_mm256_add_epi32(_mm256_add_epi32(p0, p1), _mm256_set1_epi32(1)));
+}
+
+
+
+// Same as Eedi3Sse::interp_cubic8(), rnd is the rounding constant
+__m128i	Eedi3Avx2::interp_cubic8(const __m128i &src1p, const __m128i &src1n, const __m128i &src3p, const __m128i &src3n, const __m256i &rnd)
+{
+  const __m256i  avg1 = _mm256_cvtepu16_epi32(_mm_avg_epu16(src1p, src1n));
+  const __m256i  avg3 = _mm256_cvtepu16_epi32(_mm_avg_epu16(src3p, src3n));
+  __m256i        s = _mm256_mullo_epi32(avg1, _mm256_set1_epi32(9));
+  s = _mm256_sub_epi32(s, avg3);
+  s = _mm256_add_epi32(s, rnd);
+  s = _mm256_srai_epi32(s, 3);
+
+  return (_mm_packus_epi32(
+    _mm256_castsi256_si128(s),
+    _mm256_extracti128_si256(s, 1)
+  ));
+}
+
+
+
+/*\\\ EOF \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
@@ -0,0 +1,121 @@
+/*****************************************************************************
+
+        Eedi3Avx2.h
+
+Copyright (C) 2010 Kevin Stone - some part by Laurent de Soras, 2013
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*Tab=3***********************************************************************/
+
+
+
+#if ! defined (Eedi3Avx2_HEADER_INCLUDED)
+#define	Eedi3Avx2_HEADER_INCLUDED
+
+#if defined (_MSC_VER)
+	#pragma once
+	#pragma warning (4 : 4250)
+#endif
+
+
+
+/*\\\ INCLUDE FILES \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+#include "Eedi3Sse.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+
+
+// Same packed data layout as Eedi3Sse (use its prepare/copy functions), but
+// the 8 lines of a column fit in a single 256-bit float vector, so the
+// cost, path and interpolation stages are done in a single pass.
+// This file must be compiled with AVX2 code generation enabled. Nothing here
+// should be called unless the CPU supports AVX2.
+class Eedi3Avx2
+{
+
+/*\\\ PUBLIC \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+public:
+
+	enum {         VECTSIZE = 8 };  // Vector size for internal processing (32-bit data)
+	enum {         COL_H    = Eedi3Sse::COL_H }; // Number of simultaneously processed lines
+	enum {         MARGIN_H = Eedi3Sse::MARGIN_H };
+
+	virtual        ~Eedi3Avx2 () {}
+
+	static void    interp_lines_full_pel (const __m128i *src_ptr, __m128i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m128i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3, bool fixed, int bits);
+	static void    vcheck_line (uint8_t *dst_ptr, const uint8_t *dst2p_ptr, const uint8_t *cur_ptr, int cur_pitch, const uint8_t *src3p_ptr, const uint8_t *src3n_ptr, const uint8_t *scp_ptr, const int8_t *dmap_ptr, int dmap_pitch, int x_beg, int x_end, int vcheck, float vthresh0, float vthresh1, float vthresh2, bool hp);
+
+
+
+/*\\\ PROTECTED \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+protected:
+
+
+
+/*\\\ PRIVATE \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+private:
+
+	static __forceinline __m256i
+	               sum_nrad (int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n);
+	static __forceinline __m256i
+	               slide_sum_nrad (const __m256i &s, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n);
+	static __forceinline void
+	               sum_row_pairs (__m256i &a, __m256i &b, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n);
+	static __forceinline __m256i
+	               combine_row_pairs (const __m256i &a, const __m256i &b);
+	static __forceinline __m256
+	               conn_cost (const __m256i &s, const __m128i *src1p, const __m128i *src1n, int x, int u, const __m256 &alpha_8, const __m256 &ab_8, float beta16);
+	static __forceinline __m256i
+	               conn_cost_fixed (const __m256i &s, const __m128i *src1p, const __m128i *src1n, int x, int u, const __m256i &kac, int kb);
+	static __forceinline void
+	               path_cost (float *pT, int8_t *piT, const float *ppT, const float *tT, int x, int width, int mdis, float gamma16);
+	static __forceinline void
+	               path_cost_fixed (int32_t *pT, int8_t *piT, const int32_t *ppT, const int32_t *tT, int x, int width, int mdis, int kg);
+	static __forceinline __m256i
+	               load_pix8 (const uint8_t *src_ptr);
+	static __forceinline __m256i
+	               load_dir8 (const int8_t *src_ptr);
+	static __forceinline __m256i
+	               sum_pair (const uint8_t *src_ptr, const __m256i &x0, const __m256i &x1);
+	static __forceinline __m128i
+	               interp_cubic8 (const __m128i &src1p, const __m128i &src1n, const __m128i &src3p, const __m128i &src3n, const __m256i &rnd);
+
+
+
+/*\\\ FORBIDDEN MEMBER FUNCTIONS \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+private:
+
+	               Eedi3Avx2 ();
+	               Eedi3Avx2 (const Eedi3Avx2 &other);
+	Eedi3Avx2 &    operator = (const Eedi3Avx2 &other);
+	bool           operator == (const Eedi3Avx2 &other) const;
+	bool           operator != (const Eedi3Avx2 &other) const;
+
+};	// class Eedi3Avx2
+
+
+
+#endif	// Eedi3Avx2_HEADER_INCLUDED
+
+
+
+/*\\\ EOF \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
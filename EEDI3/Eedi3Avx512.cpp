@@ -0,0 +1,793 @@
+/*****************************************************************************
+
+        Eedi3Avx512.cpp
+
+Optimizations for AVX-512 (F and BW):
+
+Same algorithm as the SSE2 and AVX2 versions, but 16 lines are processed at
+once. The data is packed with the Eedi3Sse functions using col_h = 16, so a
+column of 16-bit pixels is a __m256i and a column of 32-bit costs a __m512.
+
+The select() operations of the other versions are replaced with mask
+registers: the v in [u-1, u+1] argmin of the path cost uses a compare-to-mask
+and a masked move of the index.
+
+The final interpolation is vectorized with gathers, as in the AVX2 version.
+The cubic taps are fetched with a masked gather, only for the lanes where
+they are valid.
+
+Results are bit-exact with Eedi3Sse::interp_lines_full_pel() on the same
+lines. This is why we don't use FMA instructions here.
+
+Copyright (C) 2010 Kevin Stone - some part by Laurent de Soras, 2013
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*Tab=3***********************************************************************/
+
+
+
+#if defined (_MSC_VER)
+#pragma warning (1 : 4130 4223 4705 4706)
+#pragma warning (4 : 4355 4786 4800)
+#endif
+
+
+
+/*\\\ INCLUDE FILES \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+#include	"Eedi3Avx512.h"
+
+#include	<algorithm>
+
+#include	<cassert>
+#include	<cfloat>
+#include	<cstring>
+
+
+
+static __forceinline __m256i	difabs16(__m256i a, __m256i b)
+{
+  return (_mm256_or_si256(_mm256_subs_epu16(a, b), _mm256_subs_epu16(b, a)));
+}
+
+
+
+/*\\\ PUBLIC \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+
+
+/*
+==============================================================================
+Name: interp_lines_full_pel
+Description:
+  Interpolates COL_H (16) lines at once, full-pixel precision.
+  Data must be packed with Eedi3Sse::prepare_lines*() and the result unpacked
+  with Eedi3Sse::copy_result_lines*(), with col_h = COL_H.
+  The parameters are the same as Eedi3Sse::interp_lines_full_pel(), except
+  that each vector is made of 16 16-bit pixels.
+Input/output parameters:
+  - tmp_ptr: A temporary buffer, 64-byte aligned. Its size in bytes is at
+    least:
+    ((mdis * 2 + 1) * VECTSIZE + VECTSIZE + 2) * width
+    + (mdis * 2 + 5) * (mdis * 2 + 1) * sizeof (__m512i)
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Avx512::interp_lines_full_pel(const __m256i *src_ptr, __m256i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m256i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3, bool fixed, int bits)
+{
+  assert(src_ptr != 0);
+  assert(dst_ptr != 0);
+  assert(tmp_ptr != 0);
+  assert((reinterpret_cast <intptr_t> (tmp_ptr) & 63) == 0);
+  assert(dmap_ptr != 0);
+  assert(width > 0);
+  assert(pitch > 0);
+  assert(alpha >= 0);
+  assert(beta >= 0);
+  assert(alpha + beta <= 1.0f);
+  assert(gamma >= 0);
+  assert(nrad >= 0);
+  assert(nrad <= 3);
+  assert(mdis > 0);
+
+  // First, shifts everything so we point on actual data.
+  src_ptr += MARGIN_H;
+
+  const __m256i* src3p_ptr = src_ptr;
+  const __m256i* src1p_ptr = src_ptr + 1 * pitch;
+  const __m256i* src1n_ptr = src_ptr + 2 * pitch;
+  const __m256i* src3n_ptr = src_ptr + 3 * pitch;
+
+  const int      tpitch = mdis * 2 + 1;
+  int            tmpofs = 0;
+
+#define Eedi3Avx512_DECL( T, N, S) \
+	T  *          N = reinterpret_cast <T *> (tmp_ptr + tmpofs); \
+	tmpofs += S * sizeof (T);
+
+  // The connection costs of a column are fed to the path cost recursion as
+  // soon as they are computed, see Eedi3Sse::interp_lines_full_pel().
+  // ccosts (current column), pcosts (previous and current columns), pbackt
+  // and fpath are made of all the 16 packed lines,
+  // s0tab contains the s0 sums of the last tpitch centers (cost3),
+  // bmask contains a single boolean for each 16-line column.
+  // pbackt and fpath store the directions as bytes.
+  Eedi3Avx512_DECL(float, ccosts, tpitch * VECTSIZE); // Array of mdis*2+1 costs for the current column
+  Eedi3Avx512_DECL(float, pcosts, 2 * tpitch * VECTSIZE);
+  Eedi3Avx512_DECL(__m512i, rsums, tpitch);     // Running sums of the nrad window, for each u
+  Eedi3Avx512_DECL(__m512i, s0tab, tpitch * tpitch);
+  Eedi3Avx512_DECL(int8_t, pbackt, width * tpitch * VECTSIZE);
+  Eedi3Avx512_DECL(int8_t, fpath, width          * VECTSIZE);
+  Eedi3Avx512_DECL(bool, bmask, width);
+  Eedi3Avx512_DECL(bool, tmask, width);            // Centers needed in the s0 table (cost3)
+
+#undef Eedi3Avx512_DECL
+
+  if (msk_ptr != 0)
+  {
+    Eedi3Sse::expand_mask(bmask, msk_ptr, width, mdis, COL_H);
+    if (cost3)
+    {
+      Eedi3Sse::expand_mask(tmask, msk_ptr, width, mdis * 2, COL_H);
+    }
+  }
+
+  const __m512   alpha_16 = _mm512_set1_ps((cost3) ? alpha / 3.f : alpha);
+  const __m512   ab_16 = _mm512_set1_ps(1.0f - alpha - beta);
+
+  const int      tpitch_v = tpitch * VECTSIZE;
+
+  // beta is calibrated for 8-bit content. We have to scale it because it is
+  // not multiplied by a pixel value in the formula, contrary to the global
+  // result which depends on the data scale.
+  const float    beta16 = beta * 256;
+
+  const __m512   fltmax9 = _mm512_set1_ps(FLT_MAX * 0.9f);
+  const __m512i  zero = _mm512_setzero_si512();
+
+  // Same reason as beta16
+  const float    gamma16 = gamma * 256;
+
+  // Fixed-point mode, see Eedi3Sse::interp_lines_full_pel()
+  int            ka;
+  int            kb;
+  int            kc;
+  int            kg;
+  Eedi3Sse::quantize_costs(ka, kb, kc, kg, alpha, beta, gamma, cost3);
+  const __m512i  kac = _mm512_set1_epi32((kc << 16) + ka);
+  const __m512i  fixmax = _mm512_set1_epi32(Eedi3Sse::FIXED_MAX);
+
+  // Path costs outside the u range of a column are set to the maximum
+  // value, because a masked column copies all of them and the next one may
+  // read them.
+  for (int k = 0; k < 2 * tpitch; ++k)
+  {
+    if (fixed)
+    {
+      _mm512_store_si512(reinterpret_cast <__m512i *> (pcosts) + k, fixmax);
+    }
+    else
+    {
+      _mm512_store_ps(pcosts + k * VECTSIZE, fltmax9);
+    }
+  }
+
+  // The nrad window sums are slid along x, see Eedi3Sse::interp_lines_full_pel()
+  int            umaxp = -1;
+
+  // With cost3, s1 and s2 are read from a table of the s0 sums, filled mdis
+  // columns ahead. See Eedi3Sse::interp_lines_full_pel() for the details.
+  int            cnext = 0;
+  int            unegp = -1;
+  int            uposp = -1;
+
+  for (int x = 0; x < width; ++x)
+  {
+    // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+    // Calculate the connection costs
+
+    if (cost3)
+    {
+      for (const int cend = std::min(x + mdis, width - 1); cnext <= cend; ++cnext)
+      {
+        const int      c = cnext;
+        if (msk_ptr == 0 || tmask[c] != 0)
+        {
+          const int      uneg = std::min(std::min(c, width - 1 - c), mdis);
+          const int      upos = std::min(c, mdis);
+          __m512i *      sT = s0tab + (c % tpitch) * tpitch + mdis;
+          const __m512i *psT = s0tab + ((c + tpitch - 1) % tpitch) * tpitch + mdis;
+          for (int u = -uneg; u <= upos; ++u)
+          {
+            sT[u] = (-u > unegp || u > uposp)
+              ? sum_nrad(
+                  nrad, c - u, c + u,
+                  src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+                )
+              : slide_sum_nrad(
+                  psT[u], nrad, c - u, c + u,
+                  src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+                );
+          }
+          unegp = uneg;
+          uposp = upos;
+        }
+        else
+        {
+          unegp = -1;
+          uposp = -1;
+        }
+      }
+    }
+
+    if (msk_ptr == 0 || bmask[x] != 0)
+    {
+      const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+      for (int u = -umax; u <= umax; ++u)
+      {
+        __m512i        s;
+        if (cost3)
+        {
+          const bool     s1_flag = ((u >= 0 && x >= u * 2)
+            || (u <= 0 && x < width + u * 2));
+          const bool     s2_flag = ((u <= 0 && x >= u * -2)
+            || (u >= 0 && x < width + u * 2));
+
+          const int      mu = mdis + u;
+          const __m512i  s0 = s0tab [(x % tpitch) * tpitch + mu];
+          __m512i        s1 = s0;
+          __m512i        s2 = s0;
+          if (s1_flag)
+          {
+            s1 = s0tab [((x - u) % tpitch) * tpitch + mu]; // Center x - u
+          }
+          if (s2_flag)
+          {
+            s2 = s0tab [((x + u) % tpitch) * tpitch + mu]; // Center x + u
+          }
+          s1 = (s1_flag) ? s1 : s2;
+          s2 = (s2_flag) ? s2 : s1;
+
+          s = _mm512_add_epi32(_mm512_add_epi32(s0, s1), s2);
+        }
+        else
+        {
+          __m512i &      rs = rsums[mdis + u];
+          rs = (std::abs(u) > umaxp)
+            ? sum_nrad(
+                nrad, x - u, x + u,
+                src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+              )
+            : slide_sum_nrad(
+                rs, nrad, x - u, x + u,
+                src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+              );
+          s = rs;
+        }
+
+        if (fixed)
+        {
+          const __m512i  cc = conn_cost_fixed(
+            s, src1p_ptr, src1n_ptr, x, u, kac, kb
+          );
+          _mm512_store_si512(
+            reinterpret_cast <__m512i *> (ccosts + (mdis + u) * VECTSIZE), cc
+          );
+          continue;
+        }
+
+        const __m512   cc = conn_cost(
+          s, src1p_ptr, src1n_ptr, x, u, alpha_16, ab_16, beta16
+        );
+        _mm512_store_ps(ccosts + (mdis + u) * VECTSIZE, cc);
+      }
+      umaxp = umax;
+    }
+    else
+    {
+      memset(ccosts, 0, tpitch_v * sizeof(*ccosts));
+      umaxp = -1;
+    }
+
+    // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+    // Calculate the path costs
+
+    const float *  tT = ccosts;
+    float *        ppT = pcosts + ((x + 1) & 1) * tpitch_v;
+    float *        pT = pcosts + (x & 1) * tpitch_v;
+
+    if (x == 0)
+    {
+      const int      p = mdis * VECTSIZE;
+      _mm512_store_ps(pT + p, _mm512_load_ps(tT + p));
+      continue;
+    }
+
+    int8_t *       piT = pbackt + (x - 1) * tpitch_v;
+
+
+    if (msk_ptr != 0 && bmask[x] == 0)
+    {
+      if (x == 1)
+      {
+        const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+        const int      p = (mdis - umax) * VECTSIZE;
+        memcpy(pT + p, tT + p, (umax * 2 + 1) * VECTSIZE * sizeof(*pT));
+        memset(piT, 0, tpitch_v * sizeof(*piT));
+      }
+      else
+      {
+        memcpy(pT, ppT, tpitch_v * sizeof(*pT));
+        memcpy(piT, piT - tpitch_v, tpitch_v * sizeof(*piT));
+        const int      pumax = std::min(x - 1, width - x);
+        if (pumax < mdis)
+        {
+          memset(piT + (mdis - pumax) * VECTSIZE, 1 - pumax, VECTSIZE);
+          memset(piT + (mdis + pumax) * VECTSIZE, pumax - 1, VECTSIZE);
+        }
+      }
+    }
+
+    else if (fixed)
+    {
+      path_cost_fixed(
+        reinterpret_cast <int32_t *> (pT), piT,
+        reinterpret_cast <const int32_t *> (ppT),
+        reinterpret_cast <const int32_t *> (tT),
+        x, width, mdis, kg
+      );
+    }
+
+    else
+    {
+      path_cost(pT, piT, ppT, tT, x, width, mdis, gamma16);
+    }
+  }
+
+  // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+  // Backtrack
+
+  memset(fpath + (width - 1) * VECTSIZE, 0, VECTSIZE * sizeof(*fpath));
+  for (int x = width - 2; x >= 0; --x)
+  {
+    const int      idx_n = (x + 1)             * VECTSIZE;
+    const int      idx_c = x * VECTSIZE;
+    const int      idx_p = (x * tpitch + mdis) * VECTSIZE;
+    for (int k = 0; k < VECTSIZE; ++k)
+    {
+      const int      n = fpath[idx_n + k];
+      fpath[idx_c + k] = pbackt[idx_p + n * VECTSIZE + k];
+    }
+  }
+
+  // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+  // Interpolate
+
+  // The gathers read 32 bits at 16-bit positions, the unused upper word is
+  // always in the next column or in the right margin.
+  const int *    src1p16_ptr = reinterpret_cast <const int *> (src1p_ptr);
+  const int *    src1n16_ptr = reinterpret_cast <const int *> (src1n_ptr);
+  const int *    src3p16_ptr = reinterpret_cast <const int *> (src3p_ptr);
+  const int *    src3n16_ptr = reinterpret_cast <const int *> (src3n_ptr);
+  const __m512i  lane = _mm512_setr_epi32(
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+  );
+  const __m512i  mask16 = _mm512_set1_epi32(0xFFFF);
+  const __m512i  one = _mm512_set1_epi32(1);
+  const __m512i  nine = _mm512_set1_epi32(9);
+  // Rounding of the cubic interpolation, see
+  // Eedi3Sse::interp_lines_full_pel()
+  const int      cubic_rnd = (bits < 16) ? 0 : 8;
+  const __m512i  rnd = _mm512_set1_epi32(cubic_rnd);
+  const __m512i  rnd_h = _mm512_set1_epi32(cubic_rnd >> 1);
+  const __m512i  three = _mm512_set1_epi32(3);
+  for (int x = 0; x < width; ++x)
+  {
+    if (msk_ptr != 0 && bmask[x] == 0)
+    {
+      _mm256_store_si256(dmap_ptr + x, _mm256_setzero_si256());
+
+      __m256i        res;
+      if (ucubic)
+      {
+        res = interp_cubic16(
+          _mm256_load_si256(src1p_ptr + x),
+          _mm256_load_si256(src1n_ptr + x),
+          _mm256_load_si256(src3p_ptr + x),
+          _mm256_load_si256(src3n_ptr + x),
+          rnd_h
+        );
+      }
+      else
+      {
+        res = _mm256_avg_epu16(
+          _mm256_load_si256(src1p_ptr + x),
+          _mm256_load_si256(src1n_ptr + x)
+        );
+      }
+      _mm256_store_si256(dst_ptr + x, res);
+    }
+
+    else
+    {
+      const __m512i  dir = _mm512_cvtepi8_epi32(_mm_load_si128(
+        reinterpret_cast <const __m128i *> (fpath + x * VECTSIZE)
+      ));
+      _mm256_store_si256(dmap_ptr + x, _mm512_cvtsepi32_epi16(dir));
+
+      const __m512i  xv = _mm512_set1_epi32(x);
+      const __m512i  i1p = _mm512_add_epi32(
+        _mm512_slli_epi32(_mm512_add_epi32(xv, dir), 4), lane
+      );
+      const __m512i  i1n = _mm512_add_epi32(
+        _mm512_slli_epi32(_mm512_sub_epi32(xv, dir), 4), lane
+      );
+      const __m512i  x1p = _mm512_and_si512(_mm512_i32gather_epi32(i1p, src1p16_ptr, 2), mask16);
+      const __m512i  x1n = _mm512_and_si512(_mm512_i32gather_epi32(i1n, src1n16_ptr, 2), mask16);
+      const __m512i  sum_1 = _mm512_add_epi32(x1p, x1n);
+
+      __m512i        res = _mm512_srli_epi32(_mm512_add_epi32(sum_1, one), 1);
+
+      if (ucubic)
+      {
+        // Lanes where x >= ad * 3 && x <= width - 1 - ad * 3
+        const __m512i  ad3 = _mm512_mullo_epi32(_mm512_abs_epi32(dir), three);
+        const __mmask16 cnd =
+            _mm512_cmple_epi32_mask(ad3, xv)
+          & _mm512_cmple_epi32_mask(ad3, _mm512_set1_epi32(width - 1 - x));
+        if (cnd != 0)
+        {
+          const __m512i  dir3 = _mm512_mullo_epi32(dir, three);
+          const __m512i  i3p = _mm512_add_epi32(
+            _mm512_slli_epi32(_mm512_add_epi32(xv, dir3), 4), lane
+          );
+          const __m512i  i3n = _mm512_add_epi32(
+            _mm512_slli_epi32(_mm512_sub_epi32(xv, dir3), 4), lane
+          );
+          const __m512i  x3p = _mm512_and_si512(_mm512_mask_i32gather_epi32(
+            zero, cnd, i3p, src3p16_ptr, 2
+          ), mask16);
+          const __m512i  x3n = _mm512_and_si512(_mm512_mask_i32gather_epi32(
+            zero, cnd, i3n, src3n16_ptr, 2
+          ), mask16);
+          const __m512i  sum_3 = _mm512_add_epi32(x3p, x3n);
+
+          // (9 * sum_1 - sum_3 + cubic_rnd) >> 4, clipped to 16 bits on packing
+          __m512i        cub = _mm512_mullo_epi32(sum_1, nine);
+          cub = _mm512_sub_epi32(cub, sum_3);
+          cub = _mm512_srai_epi32(_mm512_add_epi32(cub, rnd), 4);
+          cub = _mm512_max_epi32(cub, zero);
+
+          res = _mm512_mask_mov_epi32(res, cnd, cub);
+        }
+      }
+
+      _mm256_store_si256(dst_ptr + x, _mm512_cvtusepi32_epi16(res));
+    }
+  }  // for x
+
+  _mm256_zeroupper();
+}
+
+
+
+/*\\\ PROTECTED \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+
+
+/*\\\ PRIVATE \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+
+
+// The middle row pair is not computed, it is derived from the top one of
+// the next lane. See Eedi3Sse::sum_nrad() for the details.
+__m512i	Eedi3Avx512::sum_nrad(int nrad, int xl, int xr, const __m256i *src3p, const __m256i *src1p, const __m256i *src1n, const __m256i *src3n)
+{
+  assert(nrad >= 0);
+  assert(src3p != 0);
+  assert(src1p != 0);
+  assert(src1n != 0);
+  assert(src3n != 0);
+
+  __m512i        a;
+  __m512i        b;
+  sum_row_pairs(a, b, nrad, xl, xr, src3p, src1p, src1n, src3n);
+
+  return (combine_row_pairs(a, b));
+}
+
+
+
+// Slides the nrad window sum s from x - 1 to x. xl and xr are the window
+// centers for x, as in sum_nrad().
+__m512i	Eedi3Avx512::slide_sum_nrad(const __m512i &s, int nrad, int xl, int xr, const __m256i *src3p, const __m256i *src1p, const __m256i *src1n, const __m256i *src3n)
+{
+  assert(nrad >= 0);
+
+  __m512i        aa;
+  __m512i        ab;
+  sum_row_pairs(aa, ab, 0, xl + nrad, xr + nrad, src3p, src1p, src1n, src3n);
+  __m512i        ra;
+  __m512i        rb;
+  sum_row_pairs(ra, rb, 0, xl - 1 - nrad, xr - 1 - nrad, src3p, src1p, src1n, src3n);
+
+  // The combination is linear, we can apply it to the difference.
+  const __m512i  d = combine_row_pairs(
+    _mm512_sub_epi32(aa, ra), _mm512_sub_epi32(ab, rb)
+  );
+
+  return (_mm512_add_epi32(s, d));
+}
+
+
+
+// Sums the absolute differences of the top (a: 3p-1p) and bottom (b: 1n-3n)
+// row pairs over the window.
+void	Eedi3Avx512::sum_row_pairs(__m512i &a, __m512i &b, int nrad, int xl, int xr, const __m256i *src3p, const __m256i *src1p, const __m256i *src1n, const __m256i *src3n)
+{
+  assert(nrad >= 0);
+  assert(src3p != 0);
+  assert(src1p != 0);
+  assert(src1n != 0);
+  assert(src3n != 0);
+
+  a = _mm512_setzero_si512();
+  b = _mm512_setzero_si512();
+  for (int k = -nrad; k <= nrad; ++k)
+  {
+    const int      xrk = xr + k;
+    const int      xlk = xl + k;
+    const __m256i  x3pr = _mm256_load_si256(src3p + xrk);
+    const __m256i  x1pl = _mm256_load_si256(src1p + xlk);
+    const __m256i  x1nr = _mm256_load_si256(src1n + xrk);
+    const __m256i  x3nl = _mm256_load_si256(src3n + xlk);
+
+    const __m256i  d3p1p = difabs16(x3pr, x1pl);
+    const __m256i  d1n3n = difabs16(x1nr, x3nl);
+
+    a = _mm512_add_epi32(a, _mm512_cvtepu16_epi32(d3p1p));
+    b = _mm512_add_epi32(b, _mm512_cvtepu16_epi32(d1n3n));
+  }
+}
+
+
+
+// Returns a + b + m, m being the middle row pair rebuilt from a and b.
+__m512i	Eedi3Avx512::combine_row_pairs(const __m512i &a, const __m512i &b)
+{
+  // m: lanes 1 to 15 of a, then lane 14 of b
+  const __m512i  idx = _mm512_setr_epi32(
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 + 14
+  );
+  const __m512i  m = _mm512_permutex2var_epi32(a, idx, b);
+
+  return (_mm512_add_epi32(_mm512_add_epi32(a, b), m));
+}
+
+
+
+// s is the neighbourhood sum (already summed over the 3 neighbourhoods
+// with cost3).
+__m512	Eedi3Avx512::conn_cost(const __m512i &s, const __m256i *src1p, const __m256i *src1n, int x, int u, const __m512 &alpha_16, const __m512 &ab_16, float beta16)
+{
+  // should use cubic if ucubic=true
+  const __m256i  x1pr = _mm256_load_si256(src1p + x + u);
+  const __m256i  x1nl = _mm256_load_si256(src1n + x - u);
+  const __m256i  ip = _mm256_avg_epu16(x1pr, x1nl);
+
+  const __m256i  x1p = _mm256_load_si256(src1p + x);
+  const __m256i  x1n = _mm256_load_si256(src1n + x);
+  const __m256i  vdp = difabs16(x1p, ip);
+  const __m256i  vdn = difabs16(x1n, ip);
+  const __m512i  v = _mm512_add_epi32(
+    _mm512_cvtepu16_epi32(vdp),
+    _mm512_cvtepu16_epi32(vdn)
+  );
+
+  const __m512   cc_a = _mm512_mul_ps(_mm512_cvtepi32_ps(s), alpha_16);
+  const __m512   cc_b = _mm512_set1_ps(beta16 * std::abs(u));
+  const __m512   cc_c = _mm512_mul_ps(_mm512_cvtepi32_ps(v), ab_16);
+
+  return (_mm512_add_ps(_mm512_add_ps(cc_a, cc_b), cc_c));
+}
+
+
+
+// Fixed-point counterpart of conn_cost(), see Eedi3Sse::conn_cost_fixed()
+__m512i	Eedi3Avx512::conn_cost_fixed(const __m512i &s, const __m256i *src1p, const __m256i *src1n, int x, int u, const __m512i &kac, int kb)
+{
+  const __m256i  x1pr = _mm256_load_si256(src1p + x + u);
+  const __m256i  x1nl = _mm256_load_si256(src1n + x - u);
+  const __m256i  ip = _mm256_avg_epu16(x1pr, x1nl);
+
+  const __m256i  x1p = _mm256_load_si256(src1p + x);
+  const __m256i  x1n = _mm256_load_si256(src1n + x);
+  const __m256i  vdp = difabs16(x1p, ip);
+  const __m256i  vdn = difabs16(x1n, ip);
+  const __m512i  v = _mm512_add_epi32(
+    _mm512_cvtepu16_epi32(vdp),
+    _mm512_cvtepu16_epi32(vdn)
+  );
+
+  const __m512i  sv = _mm512_or_si512(
+    _mm512_srli_epi32(s, 8),
+    _mm512_slli_epi32(_mm512_srli_epi32(v, 7), 16)
+  );
+  const __m512i  cc_b = _mm512_set1_epi32(kb * std::abs(u));
+
+  return (_mm512_add_epi32(_mm512_madd_epi16(sv, kac), cc_b));
+}
+
+
+
+// Path cost recursion for a column, see Eedi3Sse::path_cost()
+void	Eedi3Avx512::path_cost(float *pT, int8_t *piT, const float *ppT, const float *tT, int x, int width, int mdis, float gamma16)
+{
+  assert(pT != 0);
+  assert(piT != 0);
+  assert(ppT != 0);
+  assert(tT != 0);
+  assert(x > 0);
+  assert(x < width);
+  assert(mdis > 0);
+  assert(gamma16 >= 0);
+
+  const __m512   fltmax = _mm512_set1_ps(FLT_MAX);
+  const __m512   fltmax9 = _mm512_set1_ps(FLT_MAX * 0.9f);
+  const __m512   pen = _mm512_set1_ps(gamma16);
+  const __m512i  one = _mm512_set1_epi32(1);
+  const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+  const int      umax2 = std::min(std::min(x - 1, width - x), mdis);
+  __m512i        dir_l = _mm512_set1_epi32(-umax - 1);
+  for (int u = -umax; u <= umax; ++u)
+  {
+    const int      mu = (mdis + u) * VECTSIZE;
+    const float *  ppT_u = ppT + mu;
+    const __m512i  dir_c = _mm512_add_epi32(dir_l, one);
+    __m512         bval = fltmax;
+    __m512i        idx = _mm512_setzero_si512();
+    if (u > -umax2)
+    {
+      // Always taken: bval is above any clipped cost
+      bval = _mm512_min_ps(_mm512_add_ps(_mm512_load_ps(ppT_u - VECTSIZE), pen), fltmax9);
+      idx = dir_l;
+    }
+    if (std::abs(u) <= umax2)
+    {
+      const __m512   ccost = _mm512_min_ps(_mm512_load_ps(ppT_u), fltmax9);
+      idx = _mm512_mask_mov_epi32(
+        idx, _mm512_cmp_ps_mask(ccost, bval, _CMP_LT_OQ), dir_c
+      );
+      bval = _mm512_min_ps(ccost, bval);
+    }
+    if (u < umax2)
+    {
+      const __m512   ccost = _mm512_min_ps(_mm512_add_ps(_mm512_load_ps(ppT_u + VECTSIZE), pen), fltmax9);
+      idx = _mm512_mask_mov_epi32(
+        idx, _mm512_cmp_ps_mask(ccost, bval, _CMP_LT_OQ), _mm512_add_epi32(dir_c, one)
+      );
+      bval = _mm512_min_ps(ccost, bval);
+    }
+    dir_l = dir_c;
+
+    __m512         y = _mm512_add_ps(bval, _mm512_load_ps(tT + mu));
+    y = _mm512_min_ps(y, fltmax9);
+    _mm512_store_ps(pT + mu, y);
+    _mm_store_si128(
+      reinterpret_cast <__m128i *> (piT + mu), _mm512_cvtsepi32_epi8(idx)
+    );
+  }
+
+  for (int u = umax + 1; u <= mdis; ++u)
+  {
+    _mm512_store_ps(pT + (mdis - u) * VECTSIZE, fltmax9);
+    _mm512_store_ps(pT + (mdis + u) * VECTSIZE, fltmax9);
+  }
+}
+
+
+
+// Fixed-point path cost recursion for a column, see
+// Eedi3Sse::path_cost_fixed()
+void	Eedi3Avx512::path_cost_fixed(int32_t *pT, int8_t *piT, const int32_t *ppT, const int32_t *tT, int x, int width, int mdis, int kg)
+{
+  assert(pT != 0);
+  assert(piT != 0);
+  assert(ppT != 0);
+  assert(tT != 0);
+  assert(x > 0);
+  assert(x < width);
+  assert(mdis > 0);
+  assert(kg >= 0);
+
+  __m512i *      pT_v = reinterpret_cast <__m512i *> (pT);
+  const __m512i* ppT_v = reinterpret_cast <const __m512i *> (ppT);
+  const __m512i* tT_v = reinterpret_cast <const __m512i *> (tT);
+
+  const __m512i  fixmax = _mm512_set1_epi32(Eedi3Sse::FIXED_MAX);
+  const __m512i  pen = _mm512_set1_epi32(kg);
+  const __m512i  one = _mm512_set1_epi32(1);
+  const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+  const int      umax2 = std::min(std::min(x - 1, width - x), mdis);
+  __m512i        pmin = fixmax;
+  __m512i        dir_l = _mm512_set1_epi32(-umax - 1);
+  for (int u = -umax; u <= umax; ++u)
+  {
+    const __m512i* ppT_u = ppT_v + mdis + u;
+    const __m512i  dir_c = _mm512_add_epi32(dir_l, one);
+    __m512i        bval = _mm512_set1_epi32(INT32_MAX);
+    __m512i        idx = _mm512_setzero_si512();
+    if (u > -umax2)
+    {
+      // Always taken: bval is above any clipped cost
+      bval = _mm512_min_epi32(_mm512_add_epi32(_mm512_load_si512(ppT_u - 1), pen), fixmax);
+      idx = dir_l;
+    }
+    if (std::abs(u) <= umax2)
+    {
+      const __m512i  ccost = _mm512_min_epi32(_mm512_load_si512(ppT_u), fixmax);
+      idx = _mm512_mask_mov_epi32(idx, _mm512_cmplt_epi32_mask(ccost, bval), dir_c);
+      bval = _mm512_min_epi32(ccost, bval);
+    }
+    if (u < umax2)
+    {
+      const __m512i  ccost = _mm512_min_epi32(_mm512_add_epi32(_mm512_load_si512(ppT_u + 1), pen), fixmax);
+      idx = _mm512_mask_mov_epi32(idx, _mm512_cmplt_epi32_mask(ccost, bval), _mm512_add_epi32(dir_c, one));
+      bval = _mm512_min_epi32(ccost, bval);
+    }
+    dir_l = dir_c;
+
+    __m512i        y = _mm512_add_epi32(bval, _mm512_load_si512(tT_v + mdis + u));
+    y = _mm512_min_epi32(y, fixmax);
+    _mm512_store_si512(pT_v + mdis + u, y);
+    pmin = _mm512_min_epi32(y, pmin);
+    _mm_store_si128(
+      reinterpret_cast <__m128i *> (piT + (mdis + u) * VECTSIZE), _mm512_cvtsepi32_epi8(idx)
+    );
+  }
+
+  for (int u = -umax; u <= umax; ++u)
+  {
+    _mm512_store_si512(pT_v + mdis + u, _mm512_sub_epi32(pT_v [mdis + u], pmin));
+  }
+  for (int u = umax + 1; u <= mdis; ++u)
+  {
+    _mm512_store_si512(pT_v + mdis - u, fixmax);
+    _mm512_store_si512(pT_v + mdis + u, fixmax);
+  }
+}
+
+
+
+// Same as Eedi3Sse::interp_cubic8(), on 16 lines. rnd is the rounding
+// constant.
+__m256i	Eedi3Avx512::interp_cubic16(const __m256i &src1p, const __m256i &src1n, const __m256i &src3p, const __m256i &src3n, const __m512i &rnd)
+{
+  const __m512i  avg1 = _mm512_cvtepu16_epi32(_mm256_avg_epu16(src1p, src1n));
+  const __m512i  avg3 = _mm512_cvtepu16_epi32(_mm256_avg_epu16(src3p, src3n));
+  __m512i        s = _mm512_mullo_epi32(avg1, _mm512_set1_epi32(9));
+  s = _mm512_sub_epi32(s, avg3);
+  s = _mm512_add_epi32(s, rnd);
+  s = _mm512_srai_epi32(s, 3);
+  s = _mm512_max_epi32(s, _mm512_setzero_si512());
+
+  return (_mm512_cvtusepi32_epi16(s));
+}
+
+
+
+/*\\\ EOF \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
@@ -0,0 +1,114 @@
+/*****************************************************************************
+
+        Eedi3Avx512.h
+
+Copyright (C) 2010 Kevin Stone - some part by Laurent de Soras, 2013
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*Tab=3***********************************************************************/
+
+
+
+#if ! defined (Eedi3Avx512_HEADER_INCLUDED)
+#define	Eedi3Avx512_HEADER_INCLUDED
+
+#if defined (_MSC_VER)
+	#pragma once
+	#pragma warning (4 : 4250)
+#endif
+
+
+
+/*\\\ INCLUDE FILES \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+#include "Eedi3Sse.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+
+
+// Packs 16 lines per column instead of 8: use the Eedi3Sse prepare/copy
+// functions with col_h = COL_H. A column of 16-bit pixels is a __m256i and
+// the 16 lines fit in a single 512-bit float vector.
+// This file must be compiled with AVX-512 code generation enabled. Nothing
+// here should be called unless the CPU supports AVX-512 F and BW.
+class Eedi3Avx512
+{
+
+/*\\\ PUBLIC \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+public:
+
+	enum {         VECTSIZE = 16 }; // Vector size for internal processing (32-bit data)
+	enum {         COL_H    = VECTSIZE }; // Number of simultaneously processed lines
+	enum {         MARGIN_H = Eedi3Sse::MARGIN_H };
+
+	virtual        ~Eedi3Avx512 () {}
+
+	static void    interp_lines_full_pel (const __m256i *src_ptr, __m256i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m256i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3, bool fixed, int bits);
+
+
+
+/*\\\ PROTECTED \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+protected:
+
+
+
+/*\\\ PRIVATE \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+private:
+
+	static __forceinline __m512i
+	               sum_nrad (int nrad, int xl, int xr, const __m256i *src3p, const __m256i *src1p, const __m256i *src1n, const __m256i *src3n);
+	static __forceinline __m512i
+	               slide_sum_nrad (const __m512i &s, int nrad, int xl, int xr, const __m256i *src3p, const __m256i *src1p, const __m256i *src1n, const __m256i *src3n);
+	static __forceinline void
+	               sum_row_pairs (__m512i &a, __m512i &b, int nrad, int xl, int xr, const __m256i *src3p, const __m256i *src1p, const __m256i *src1n, const __m256i *src3n);
+	static __forceinline __m512i
+	               combine_row_pairs (const __m512i &a, const __m512i &b);
+	static __forceinline __m512
+	               conn_cost (const __m512i &s, const __m256i *src1p, const __m256i *src1n, int x, int u, const __m512 &alpha_16, const __m512 &ab_16, float beta16);
+	static __forceinline __m512i
+	               conn_cost_fixed (const __m512i &s, const __m256i *src1p, const __m256i *src1n, int x, int u, const __m512i &kac, int kb);
+	static __forceinline void
+	               path_cost (float *pT, int8_t *piT, const float *ppT, const float *tT, int x, int width, int mdis, float gamma16);
+	static __forceinline void
+	               path_cost_fixed (int32_t *pT, int8_t *piT, const int32_t *ppT, const int32_t *tT, int x, int width, int mdis, int kg);
+	static __forceinline __m256i
+	               interp_cubic16 (const __m256i &src1p, const __m256i &src1n, const __m256i &src3p, const __m256i &src3n, const __m512i &rnd);
+
+
+
+/*\\\ FORBIDDEN MEMBER FUNCTIONS \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+private:
+
+	               Eedi3Avx512 ();
+	               Eedi3Avx512 (const Eedi3Avx512 &other);
+	Eedi3Avx512 &  operator = (const Eedi3Avx512 &other);
+	bool           operator == (const Eedi3Avx512 &other) const;
+	bool           operator != (const Eedi3Avx512 &other) const;
+
+};	// class Eedi3Avx512
+
+
+
+#endif	// Eedi3Avx512_HEADER_INCLUDED
+
+
+
+/*\\\ EOF \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
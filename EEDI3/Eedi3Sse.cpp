@@ -7,21 +7,19 @@ Optimizations for SSE/SSE2:
 Process 8 lines at once.
 First make a buffer of a capacity of 8*N lines, where N is the number of source
 lines actually needed for processing a single output line (here: 4).
-The PlanarFrame thing could be bypassed here when vcheck is 0.
+The planar source frames are read in place, without PlanarFrame copy.
 Fill the buffer in the following way:
   For each source line offset o (-3, -1, +1, +3)
     For each column x (in 0..width-1, with a margin if necessary)
       For each line k in (0..7)
         Put the pixel src (x, y + o + k) in location (x * 8 + k, o)
-        We could do the hpel interpolation here too.
 Then do the exact C++ processing, but use vectors instead of scalars,
 and multiply each horizontal coordinate by 8.
 For AA purpose, we could interpolate columns with no additional transpose
 cost (but what about the vcheck?)
 
-With 8-bit input, the connection cost could be computed in 16-bit integer.
-We could use multipliers like 32 or even 16 to get alpha and beta as integer
-(they probably don't need a high accuracy).
+With fixed=true, the connection costs are computed in integers, with alpha
+and beta quantized by quantize_costs().
 
 Question: The C++ code uses double precision in the path cost section.
 Is it really needed? The results are stored as float anyway...
@@ -32,26 +30,13 @@ of positive values, so the loss of precision could be an issue.
 Test to conduct: check what is the maximum pcost value for a 8K picture
 full of very contrasted hard edges and important background noise.
 
-The inner loop in the path cost calculation could benefit from unrolling
-(index clipped by u-1 and u+1).
-
 The backtrack can be done only in C++ because of the indexing.
 
 The "block" part of the algorithm would benefit from AVX2 (everything done
-in one pass).
-
-Other notes:
-
-With the C++ version, 16-bit data interpolation could be done almost for free,
-just templatize the function to use uint8_t/short as input and output
-data type and saturate the result to the correct values.
+in one pass). This is implemented in Eedi3Avx2.cpp.
 
 TO DO:
 
-- Understand and modify the vcheck code in order to remove the intermediate
-  copies if possible.
-- 16-bit input/output
-- hpel interpolation
 - Check the amount of horizontal margins really required. Why 12?
   It seems that the margin doesn't need to be greater than nrad (max 3).
 - Optimize the core code of prepare/copy_result_lines*() with SSE2 code
@@ -107,6 +92,36 @@ static __forceinline __m128i	difabs16(__m128i a, __m128i b)
 
 
 
+// a and b are 8-bit pixels scaled to 16 bits. Returns (a + b + 1) >> 1,
+// computed and scaled the same way.
+static __forceinline __m128i	avg16_8bits(__m128i a, __m128i b)
+{
+  const __m128i  avg = _mm_avg_epu16(a, b);
+
+  return (_mm_and_si128(
+    _mm_add_epi16(avg, _mm_set1_epi16(0x80)),
+    _mm_set1_epi16(-0x100)
+  ));
+}
+
+
+
+// Same as avg16_8bits(), returns
+// clip((9 * (a + b) - (c + d) + 8) >> 4, 0, 255)
+static __forceinline __m128i	cubic16_8bits(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+  const __m128i  ab = _mm_add_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+  const __m128i  cd = _mm_add_epi16(_mm_srli_epi16(c, 8), _mm_srli_epi16(d, 8));
+  __m128i        s = _mm_mullo_epi16(ab, _mm_set1_epi16(9));
+  s = _mm_sub_epi16(s, cd);
+  s = _mm_srai_epi16(_mm_add_epi16(s, _mm_set1_epi16(8)), 4);
+  s = _mm_min_epi16(_mm_max_epi16(s, _mm_setzero_si128()), _mm_set1_epi16(255));
+
+  return (_mm_slli_epi16(s, 8));
+}
+
+
+
 /*\\\ PUBLIC \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
 
 
@@ -116,18 +131,20 @@ static __forceinline __m128i	difabs16(__m128i a, __m128i b)
 Name: prepare_lines_8bits
 Description:
   Reorders data before processing a set of lines.
-  At most COL_H (8) lines will be processed per call.
+  At most col_h lines will be processed per call.
 Input parameters:
-  - dst_pitch: In columns. One column = 8 pixels from 8 interpolated lines
-    on the same abscissa.
+  - dst_pitch: In columns. One column = col_h pixels from col_h interpolated
+    lines on the same abscissa.
   - src_ptr: Points on the top first *existing* reference line.
   - src_pitch: In bytes. Strides from one reference line to the next one.
   - bpp: Bytes per pixel (source). 1 for planar, or the horizontal step for
     interleaved formats.
   - width: Source width, in pixels
   - height: Number of existing reference lines
-  - src_y: third reference line of the group of 4*8 to prepare.
+  - src_y: third reference line of the group of 4*col_h to prepare.
     The interpolated line is located between the second and the third.
+  - col_h: Number of lines packed in a column. COL_H (8) for the SSE2 and
+    AVX2 kernels, Eedi3Avx512::COL_H (16) for the AVX-512 kernel.
 Output parameters:
   - dst_ptr: contains 4 reference lines (existing or mirrored) made of
     width + MARGIN_H * 2 columns. Points on the left margin.
@@ -135,63 +152,171 @@ Throws: Nothing
 ==============================================================================
 */
 
-void	Eedi3Sse::prepare_lines_8bits(uint16_t *dst_ptr, int dst_pitch, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y)
+void	Eedi3Sse::prepare_lines_8bits(uint16_t *dst_ptr, int dst_pitch, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y, int col_h)
 {
-  assert(dst_ptr != 0);
-  assert(dst_pitch > 0);
-  assert(src_ptr != 0);
-  assert(src_pitch > 0);
-  assert(bpp > 0);
-  assert(width > 0);
-  assert(width * bpp <= src_pitch);
-  assert(width + MARGIN_H * 2 <= dst_pitch);
-  assert(height > 0);
-  assert(src_y >= 0);
-  assert(src_y <= height);
+  prepare_lines_tpl(
+    dst_ptr, dst_pitch, src_ptr, src_pitch, bpp, ScaleInt(8),
+    width, height, src_y, col_h
+  );
+}
 
-  for (int y = src_y - 2; y < src_y + 2; ++y)
-  {
-    uint16_t *     dst2_ptr = dst_ptr;
 
-    for (int y2 = y; y2 < y + COL_H; ++y2)
-    {
-      int            real_y = (y2 < 0) ? -1 - y2 : y2;
-      if (real_y >= height)
-      {
-        real_y = height * 2 - 1 - real_y;
-      }
-      real_y = std::max(real_y, 0);
 
-      const uint8_t* line_ptr = src_ptr + real_y * src_pitch;
+/*
+==============================================================================
+Name: prepare_lines_16bits
+Description:
+  Same as prepare_lines_8bits(), for planar data with 9 to 16 bits per
+  pixel. The pixels are scaled to 16 bits too, so the interpolation kernels
+  work the same way whatever the bit depth.
+Input parameters:
+  - dst_pitch: In columns.
+  - src_ptr: Points on the top first *existing* reference line.
+  - src_pitch: In bytes.
+  - bits: Bit depth of the source, 9 to 16.
+  - width: Source width, in pixels
+  - height: Number of existing reference lines
+  - src_y: third reference line of the group of 4*col_h to prepare.
+  - col_h: Number of lines packed in a column.
+Output parameters:
+  - dst_ptr: contains 4 reference lines made of width + MARGIN_H * 2
+    columns. Points on the left margin.
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Sse::prepare_lines_16bits(uint16_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bits, int width, int height, int src_y, int col_h)
+{
+  assert(bits > 8);
+  assert(bits <= 16);
+
+  prepare_lines_tpl(
+    dst_ptr, dst_pitch, src_ptr, src_pitch, 1, ScaleInt(16 - bits),
+    width, height, src_y, col_h
+  );
+}
 
-      for (int x = 0; x < MARGIN_H; ++x)
-      {
-        const int      src_x = std::min(MARGIN_H - 1 - x, width - 1);
-        const uint16_t pix = line_ptr[src_x * bpp] << 8;
-        dst2_ptr[x * COL_H] = pix;
-      }
-      for (int x = 0; x < width; ++x)
-      {
-        const uint16_t pix = line_ptr[x * bpp] << 8;
-        dst2_ptr[(MARGIN_H + x) * COL_H] = pix;
-      }
-      for (int x = 0; x < MARGIN_H; ++x)
-      {
-        const int      src_x = std::max(width - 1 - x, 0);
-        const uint16_t pix = line_ptr[src_x * bpp] << 8;
-        dst2_ptr[(MARGIN_H + width + x) * COL_H] = pix;
-      }
 
-      ++dst2_ptr;
-    }
 
-    dst_ptr += dst_pitch * COL_H;
+/*
+==============================================================================
+Name: prepare_lines_mirror_8bits
+Description:
+  Same as prepare_lines_8bits(), but the borders are mirrored the way
+  eedi3::copyPad() pads the field, so the data are exactly the same as in
+  the C++ version: the mirror is made on the frame rows and columns, without
+  repeating the edge pixel. The source doesn't need any padding.
+  Lines located more than PADDED_V lines beyond the field are clamped, they
+  are only used by interpolated lines outside the picture.
+Input parameters:
+  - dst_pitch: In columns.
+  - src_ptr: Points on the top first *existing* reference line.
+  - src_pitch: In bytes. Strides from one reference line to the next one.
+  - bpp: Bytes per pixel (source).
+  - width: Source width, in pixels
+  - height: Number of existing reference lines
+  - src_y: third reference line of the group of 4*col_h to prepare.
+  - col_h: Number of lines packed in a column.
+  - src_par: Parity of the reference lines in the frame, 0 or 1.
+  - frame_h: Height of the frame, reference and interpolated lines.
+Output parameters:
+  - dst_ptr: contains 4 reference lines made of width + MARGIN_H * 2
+    columns. Points on the left margin.
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Sse::prepare_lines_mirror_8bits(uint16_t *dst_ptr, int dst_pitch, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y, int col_h, int src_par, int frame_h)
+{
+  prepare_lines_mirror_tpl(
+    dst_ptr, dst_pitch, src_ptr, src_pitch, bpp, ScaleInt(8),
+    width, height, src_y, col_h, src_par, frame_h
+  );
+}
+
+
+
+// Same as prepare_lines_mirror_8bits(), for planar data with 9 to 16 bits
+// per pixel. See prepare_lines_16bits().
+void	Eedi3Sse::prepare_lines_mirror_16bits(uint16_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bits, int width, int height, int src_y, int col_h, int src_par, int frame_h)
+{
+  assert(bits > 8);
+  assert(bits <= 16);
+
+  prepare_lines_mirror_tpl(
+    dst_ptr, dst_pitch, src_ptr, src_pitch, 1, ScaleInt(16 - bits),
+    width, height, src_y, col_h, src_par, frame_h
+  );
+}
+
+
+
+/*
+==============================================================================
+Name: prepare_lines_float
+Description:
+  Same as prepare_lines_8bits(), for planar float data. The pixels are
+  quantized to the 16-bit scale of the interpolation kernels: 1.0 is 255
+  on the 8-bit scale, so beta, gamma and the other parameters keep their
+  meaning. The values out of the 16-bit range are clipped, this only
+  affects the search of the directions.
+Input parameters:
+  - dst_pitch: In columns.
+  - src_ptr: Points on the top first *existing* reference line.
+  - src_pitch: In bytes.
+  - ofs: Offset added to the pixels on the 16-bit scale before the
+    quantization, 32768 for the chroma planes centered on 0.
+  - width: Source width, in pixels
+  - height: Number of existing reference lines
+  - src_y: third reference line of the group of 4*col_h to prepare.
+  - col_h: Number of lines packed in a column.
+Output parameters:
+  - dst_ptr: contains 4 reference lines made of width + MARGIN_H * 2
+    columns. Points on the left margin.
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Sse::prepare_lines_float(uint16_t *dst_ptr, int dst_pitch, const float *src_ptr, int src_pitch, float ofs, int width, int height, int src_y, int col_h)
+{
+  prepare_lines_tpl(
+    dst_ptr, dst_pitch, src_ptr, src_pitch, 1, ScaleFlt(ofs),
+    width, height, src_y, col_h
+  );
+}
+
+
+
+// Same as prepare_lines_mirror_8bits(), for planar float data. See
+// prepare_lines_float().
+void	Eedi3Sse::prepare_lines_mirror_float(uint16_t *dst_ptr, int dst_pitch, const float *src_ptr, int src_pitch, float ofs, int width, int height, int src_y, int col_h, int src_par, int frame_h)
+{
+  prepare_lines_mirror_tpl(
+    dst_ptr, dst_pitch, src_ptr, src_pitch, 1, ScaleFlt(ofs),
+    width, height, src_y, col_h, src_par, frame_h
+  );
+}
+
+
+
+// Quantizes a line of float data like prepare_lines_float(), for the C++
+// version. width is in pixels.
+void	Eedi3Sse::quantize_float(uint16_t *dst_ptr, const float *src_ptr, int width, float ofs)
+{
+  assert(dst_ptr != 0);
+  assert(src_ptr != 0);
+  assert(width > 0);
+
+  const ScaleFlt cnv(ofs);
+  for (int x = 0; x < width; ++x)
+  {
+    dst_ptr [x] = cnv(src_ptr [x]);
   }
 }
 
 
 
-void	Eedi3Sse::prepare_mask_8bits(uint8_t *dst_ptr, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y)
+void	Eedi3Sse::prepare_mask_8bits(uint8_t *dst_ptr, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y, int col_h)
 {
   assert(dst_ptr != 0);
   assert(src_ptr != 0);
@@ -200,10 +325,11 @@ void	Eedi3Sse::prepare_mask_8bits(uint8_t *dst_ptr, const uint8_t *src_ptr, int
   assert(width > 0);
   assert(width * bpp <= src_pitch);
   assert(height > 0);
+  assert(col_h > 0);
   assert(src_y >= 0);
   assert(src_y <= height);
 
-  for (int y = src_y; y < src_y + COL_H; ++y)
+  for (int y = src_y; y < src_y + col_h; ++y)
   {
     int            real_y = y;
     if (real_y >= height)
@@ -216,7 +342,7 @@ void	Eedi3Sse::prepare_mask_8bits(uint8_t *dst_ptr, const uint8_t *src_ptr, int
 
     for (int x = 0; x < width; ++x)
     {
-      dst_ptr[x * COL_H] = line_ptr[x * bpp];
+      dst_ptr[x * col_h] = line_ptr[x * bpp];
     }
 
     ++dst_ptr;
@@ -230,48 +356,76 @@ void	Eedi3Sse::prepare_mask_8bits(uint8_t *dst_ptr, const uint8_t *src_ptr, int
 Name: copy_result_lines_8bits
 Description:
   Unpack the result lines to the destination frame.
-  At most COL_H (8) lines are processed per call.
+  At most col_h lines are processed per call.
   16-bit data is rounded to 8 bits for implementation simplicity.
 Input parameters:
   - dst_pitch: In bytes. Strides from one line of the destination frame to
     the next one.
   - src_ptr: Pointer on the interpolation result data.
-  - src_pitch: In columns. One column = 8 pixels from 8 interpolated lines
-    on the same abscissa.
+  - src_pitch: In columns. One column = col_h pixels from col_h interpolated
+    lines on the same abscissa.
   - bpp: Bytes per pixel (destination). 1 for planar, or the horizontal step
     for interleaved formats.
   - width: Destination frame width, in pixels
   - height: Destination frame height, in pixels
   - dst_y: Position of the first line to unpack.
+  - col_h: Number of lines packed in a column.
 Output parameters:
   - dst_ptr: Pointer on the top left of the destination frame (no margin).
 Throws: Nothing
 ==============================================================================
 */
 
-void	Eedi3Sse::copy_result_lines_8bits(uint8_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bpp, int width, int height, int dst_y)
+void	Eedi3Sse::copy_result_lines_8bits(uint8_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bpp, int width, int height, int dst_y, int col_h)
+{
+  copy_result_lines_int(
+    dst_ptr, dst_pitch, src_ptr, src_pitch, bpp, 8,
+    width, height, dst_y, col_h
+  );
+}
+
+
+
+// Same as copy_result_lines_8bits(), for planar data with 9 to 16 bits per
+// pixel. The data is rounded to the bit depth of the destination and
+// clipped to its range.
+void	Eedi3Sse::copy_result_lines_16bits(uint16_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bits, int width, int height, int dst_y, int col_h)
+{
+  assert(bits > 8);
+  assert(bits <= 16);
+
+  copy_result_lines_int(
+    dst_ptr, dst_pitch, src_ptr, src_pitch, 1, 16 - bits,
+    width, height, dst_y, col_h
+  );
+}
+
+
+
+// Unpacks the direction map. The directions are within [-mdis*2 ; mdis*2]
+// so they are narrowed to bytes.
+void	Eedi3Sse::copy_result_dmap(int8_t *dst_ptr, int dst_pitch, const int16_t *src_ptr, int src_pitch, int width, int height, int dst_y, int col_h)
 {
   assert(dst_ptr != 0);
   assert(dst_pitch > 0);
   assert(src_ptr != 0);
   assert(src_pitch > 0);
-  assert(bpp > 0);
   assert(width > 0);
-  assert(width * bpp <= dst_pitch);
+  assert(width <= dst_pitch);
   assert(width <= src_pitch);
   assert(height > 0);
+  assert(col_h > 0);
   assert(dst_y >= 0);
   assert(dst_y < height);
 
-  const int      y_end = std::min(dst_y + COL_H, height);
+  const int      y_end = std::min(dst_y + col_h, height);
   for (int y2 = dst_y; y2 < y_end; ++y2)
   {
-    uint8_t *      line_ptr = dst_ptr + y2 * dst_pitch;
+    int8_t *       line_ptr = dst_ptr + y2 * dst_pitch;
 
     for (int x = 0; x < width; ++x)
     {
-      const uint16_t pix = src_ptr[x * COL_H];
-      line_ptr[x * bpp] = std::min(std::max((pix + 0x80) >> 8, 0), 255);
+      line_ptr[x] = int8_t(src_ptr[x * col_h]);
     }
 
     ++src_ptr;
@@ -280,35 +434,112 @@ void	Eedi3Sse::copy_result_lines_8bits(uint8_t *dst_ptr, int dst_pitch, const ui
 
 
 
-void	Eedi3Sse::copy_result_dmap(int16_t *dst_ptr, int dst_pitch, const int16_t *src_ptr, int src_pitch, int width, int height, int dst_y)
+/*
+==============================================================================
+Name: expand_mask
+Description:
+  Builds the boolean mask of the columns requiring edge-directed
+  interpolation, from the packed mask data. A column is processed if any
+  of its col_h lines has a non-zero mask within a distance of mdis pixels.
+  Also used by the other instruction set variants.
+Input parameters:
+  - msk_ptr: Packed mask data, as produced by prepare_mask_8bits().
+  - width: Number of columns.
+  - mdis: See user documentation.
+  - col_h: Number of lines packed in a column, multiple of 8.
+Output parameters:
+  - dst_ptr: width booleans.
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Sse::expand_mask(bool dst_ptr[], const uint8_t msk_ptr[], int width, int mdis, int col_h)
 {
   assert(dst_ptr != 0);
-  assert(dst_pitch > 0);
-  assert(src_ptr != 0);
-  assert(src_pitch > 0);
+  assert(msk_ptr != 0);
   assert(width > 0);
-  assert(width <= dst_pitch);
-  assert(width <= src_pitch);
-  assert(height > 0);
-  assert(dst_y >= 0);
-  assert(dst_y < height);
+  assert(mdis > 0);
+  assert(col_h > 0);
+  assert((col_h & 7) == 0);
 
-  const int      y_end = std::min(dst_y + COL_H, height);
-  for (int y2 = dst_y; y2 < y_end; ++y2)
+  const int64_t *   msk8_ptr = reinterpret_cast <const int64_t *> (msk_ptr);
+  const int         col_h8 = col_h >> 3;
+
+  const int	minmdis = (width < mdis) ? width : mdis;
+
+  int			last = -666999;
+
+  for (int x = 0; x < minmdis; ++x)
   {
-    int16_t *      line_ptr = dst_ptr + y2 * dst_pitch;
+    if (is_col_set(msk8_ptr + x * col_h8, col_h8))
+    {
+      last = x + mdis;
+    }
+  }
 
-    for (int x = 0; x < width; ++x)
+  for (int x = 0; x < width - minmdis; ++x)
+  {
+    if (is_col_set(msk8_ptr + (x + mdis) * col_h8, col_h8))
     {
-      line_ptr[x] = src_ptr[x * COL_H];
+      last = x + mdis * 2;
     }
+    dst_ptr[x] = (x <= last);
+  }
 
-    ++src_ptr;
+  for (int x = width - minmdis; x < width; ++x)
+  {
+    dst_ptr[x] = (x <= last);
   }
 }
 
 
 
+/*
+==============================================================================
+Name: quantize_costs
+Description:
+  Converts the cost parameters to fixed-point, for fixed=true. The
+  connection cost of a pixel for the direction u is then:
+    ka * s + kb * |u| + kc * v2
+  s being the SAD over the window (s0 + s1 + s2 with cost3) and v2 the
+  difference between the center pixels and their interpolation along u,
+  computed without rounding, on the 8-bit scale:
+    v2 = |2 * p - (a + b)| + |2 * n - (a + b)|
+  The cost of a step between two directions u and v is kg * |u - v|.
+  All the costs are in 1 / (1 << FIXED_BITS) units and fit in 32 bits.
+  The C++ version and all the instruction set variants use this function,
+  so they get exactly the same results.
+Input parameters:
+  - alpha: See user documentation.
+  - beta: See user documentation.
+  - gamma: See user documentation.
+  - cost3: See user documentation.
+Output parameters:
+  - ka: s factor, fits in 16 bits.
+  - kb: |u| factor.
+  - kc: v2 factor, fits in 16 bits.
+  - kg: |u - v| factor, <= FIXED_GMAX.
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Sse::quantize_costs(int &ka, int &kb, int &kc, int &kg, float alpha, float beta, float gamma, bool cost3)
+{
+  assert(alpha >= 0);
+  assert(beta >= 0);
+  assert(alpha + beta <= 1.0f);
+  assert(gamma >= 0);
+
+  const float    scale = float(1 << FIXED_BITS);
+  const float    ab = std::max(1.0f - alpha - beta, 0.0f);
+  ka = int(((cost3) ? alpha / 3 : alpha) * scale + 0.5f);
+  kb = int(beta * scale + 0.5f);
+  kc = int(ab * scale * 0.5f + 0.5f);   // v2 is twice the C++ v
+  kg = int(std::min(gamma * scale, float(FIXED_GMAX)) + 0.5f);
+}
+
+
+
 /*
 ==============================================================================
 Name: interp_lines_full_pel
@@ -339,6 +570,12 @@ Input parameters:
   - mdis: See user documentation.
   - ucubic: See user documentation.
   - cost3: See user documentation.
+  - fixed: Uses the fixed-point costs. See quantize_costs() and the
+    interpLineFP() function in eedi3.cpp.
+  - bits: Bit depth of the source. The interpolated pixels are rounded
+    again by copy_result_lines*(), so they are truncated here, unless the
+    source has 16 bits. Rounding twice would give off-by-one results for
+    the 13- to 15-bit sources.
 Output parameters:
   - dst_ptr: Pointer on a buffer receiving the interpolated line.
     8 packed unsigned 16-bit pixels per vector.
@@ -350,12 +587,13 @@ Output parameters:
     Only unmasked pixels are valid.
 Input/output parameters:
   - tmp_ptr: A temporary buffer. Its size in bytes is at least:
-    ((4 * (mdis * 2 + 1) + 1) * VECTSIZE * 4 + 1) * width
+    ((mdis * 2 + 1) * 2 * VECTSIZE + VECTSIZE + 2) * width
+    + (mdis * 2 + 5) * (mdis * 2 + 1) * 2 * sizeof (__m128i)
 Throws: Nothing
 ==============================================================================
 */
 
-void	Eedi3Sse::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m128i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3)
+void	Eedi3Sse::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m128i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3, bool fixed, int bits)
 {
   assert(src_ptr != 0);
   assert(dst_ptr != 0);
@@ -406,203 +644,257 @@ void	Eedi3Sse::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, c
 	T  *          N = reinterpret_cast <T *> (tmp_ptr + tmpofs); \
 	tmpofs += S * sizeof (T);
 
-  // ccosts is grouped in 2 separate chunks of 4 packed lines,
-  // pcosts, pbackt and fpath are chunks of 4 packed lines,
-  // bmask contains a single boolean for each 8-line column
-  Eedi3Sse_DECL(float, ccosts, 2 * width * tpitch * VECTSIZE); // Array of mdis*2+1 costs for each pixel of the line
-  Eedi3Sse_DECL(float, pcosts, width * tpitch * VECTSIZE);
-  Eedi3Sse_DECL(int32_t, pbackt, width * tpitch * VECTSIZE);
-  Eedi3Sse_DECL(int32_t, fpath, width          * VECTSIZE);
+  // The connection costs of a column are fed to the path cost recursion as
+  // soon as they are computed, so only the backtrack indexes are stored for
+  // the whole line.
+  // ccosts (current column), pcosts (previous and current columns) and
+  // pbackt are grouped in 2 separate chunks of 4 packed lines,
+  // fpath is a chunk of 4 packed lines,
+  // s0tab contains the s0 sums of the last tpitch centers (cost3),
+  // bmask contains a single boolean for each 8-line column.
+  // The directions are within [-mdis ; mdis] so pbackt and fpath store them
+  // as bytes. They are placed after the vector data to keep it aligned.
+  Eedi3Sse_DECL(float, ccosts, 2 * tpitch * VECTSIZE); // Array of mdis*2+1 costs for the current column
+  Eedi3Sse_DECL(float, pcosts, 2 * 2 * tpitch * VECTSIZE);
+  Eedi3Sse_DECL(__m128i, rsums, tpitch * 2);     // Running sums of the nrad window, for each u
+  Eedi3Sse_DECL(__m128i, s0tab, tpitch * tpitch * 2);
+  Eedi3Sse_DECL(int8_t, pbackt, 2 * width * tpitch * VECTSIZE);
+  Eedi3Sse_DECL(int8_t, fpath, width          * VECTSIZE);
   Eedi3Sse_DECL(bool, bmask, width);
+  Eedi3Sse_DECL(bool, tmask, width);            // Centers needed in the s0 table (cost3)
 
 #undef Eedi3Sse_DECL
 
   if (msk_ptr != 0)
   {
-    memset(ccosts, 0, 2 * tpitch * width * VECTSIZE * sizeof(float));
-    expand_mask(bmask, msk_ptr, width, mdis);
+    expand_mask(bmask, msk_ptr, width, mdis, COL_H);
+    if (cost3)
+    {
+      expand_mask(tmask, msk_ptr, width, mdis * 2, COL_H);
+    }
   }
 
   const __m128i  zero = _mm_setzero_si128();
   const __m128   alpha_4 = _mm_set1_ps((cost3) ? alpha / 3.f : alpha);
   const __m128   ab_4 = _mm_set1_ps(1.0f - alpha - beta);
+  const __m128   fltmax9 = _mm_set1_ps(FLT_MAX * 0.9f);
 
   const int      tpitch_v = tpitch * VECTSIZE;
-  const int      ofs_p4 = width * tpitch_v;
-
-  // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
-  // Calculate all connection costs
 
   // beta is calibrated for 8-bit content. We have to scale it because it is
   // not multiplied by a pixel value in the formula, contrary to the global
   // result which depends on the data scale.
   const float    beta16 = beta * 256;
 
-  if (!cost3)
+  // Same reason as beta16
+  const float    gamma16 = gamma * 256;
+
+  // Fixed-point mode. ccosts and pcosts contain int32 data.
+  int            ka;
+  int            kb;
+  int            kc;
+  int            kg;
+  quantize_costs(ka, kb, kc, kg, alpha, beta, gamma, cost3);
+  const __m128i  kac = _mm_set1_epi32((kc << 16) + ka);
+  const __m128i  fixmax = _mm_set1_epi32(FIXED_MAX);
+
+  // Path costs outside the u range of a column are set to the maximum
+  // value, because a masked column copies all of them and the next one may
+  // read them.
+  for (int k = 0; k < 2 * 2 * tpitch; ++k)
   {
-    for (int x = 0; x < width; ++x)
+    if (fixed)
     {
-      if (msk_ptr == 0 || bmask[x] != 0)
-      {
-        const int      umax = std::min(std::min(x, width - 1 - x), mdis);
-        for (int u = -umax; u <= umax; ++u)
-        {
-          __m128i        s_0;
-          __m128i			s_1;
-          sum_nrad(
-            s_0, s_1, zero, nrad, x - u, x + u,
-            src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
-          );
-
-          // should use cubic if ucubic=true
-          const __m128i  x1pr = _mm_load_si128(src1p_ptr + x + u);
-          const __m128i  x1nl = _mm_load_si128(src1n_ptr + x - u);
-          const __m128i  ip = _mm_avg_epu16(x1pr, x1nl);
-
-          const __m128i  x1p = _mm_load_si128(src1p_ptr + x);
-          const __m128i  x1n = _mm_load_si128(src1n_ptr + x);
-          const __m128i  vdp = difabs16(x1p, ip);
-          const __m128i  vdn = difabs16(x1n, ip);
-          const __m128i  v0 = _mm_add_epi32(
-            _mm_unpacklo_epi16(vdp, zero),
-            _mm_unpacklo_epi16(vdn, zero)
-          );
-          const __m128i  v1 = _mm_add_epi32(
-            _mm_unpackhi_epi16(vdp, zero),
-            _mm_unpackhi_epi16(vdn, zero)
-          );
+      _mm_store_si128(reinterpret_cast <__m128i *> (pcosts) + k, fixmax);
+    }
+    else
+    {
+      _mm_store_ps(pcosts + k * VECTSIZE, fltmax9);
+    }
+  }
 
-          const __m128   cc_a0 = _mm_mul_ps(_mm_cvtepi32_ps(s_0), alpha_4);
-          const __m128   cc_a1 = _mm_mul_ps(_mm_cvtepi32_ps(s_1), alpha_4);
+  // The nrad window sums are slid along x for each u. umaxp is the u range
+  // of the sums valid for x - 1, or -1 after a masked column.
+  int            umaxp = -1;
 
-          const __m128   cc_b = _mm_set1_ps(beta16 * std::abs(u));
+  // With cost3, s1 and s2 are read from a table of the s0 sums, filled mdis
+  // columns ahead. See interpLineFP() in eedi3.cpp.
+  int            cnext = 0;
+  int            unegp = -1;
+  int            uposp = -1;
 
-          const __m128   cc_c0 = _mm_mul_ps(_mm_cvtepi32_ps(v0), ab_4);
-          const __m128   cc_c1 = _mm_mul_ps(_mm_cvtepi32_ps(v1), ab_4);
+  for (int x = 0; x < width; ++x)
+  {
+    // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+    // Calculate the connection costs
 
-          const __m128   cc0 = _mm_add_ps(_mm_add_ps(cc_a0, cc_b), cc_c0);
-          const __m128   cc1 = _mm_add_ps(_mm_add_ps(cc_a1, cc_b), cc_c1);
-          const int      dpos = (x * tpitch + mdis + u) * VECTSIZE;
-          _mm_store_ps(ccosts + dpos, cc0);
-          _mm_store_ps(ccosts + dpos + ofs_p4, cc1);
+    if (cost3)
+    {
+      for (const int cend = std::min(x + mdis, width - 1); cnext <= cend; ++cnext)
+      {
+        const int      c = cnext;
+        if (msk_ptr == 0 || tmask[c] != 0)
+        {
+          const int      uneg = std::min(std::min(c, width - 1 - c), mdis);
+          const int      upos = std::min(c, mdis);
+          __m128i *      sT =
+            s0tab + ((c % tpitch) * tpitch + mdis) * 2;
+          const __m128i* psT =
+            s0tab + (((c + tpitch - 1) % tpitch) * tpitch + mdis) * 2;
+          for (int u = -uneg; u <= upos; ++u)
+          {
+            __m128i &      s_0 = sT[u * 2    ];
+            __m128i &      s_1 = sT[u * 2 + 1];
+            if (-u > unegp || u > uposp)
+            {
+              sum_nrad(
+                s_0, s_1, zero, nrad, c - u, c + u,
+                src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+              );
+            }
+            else
+            {
+              s_0 = psT[u * 2    ];
+              s_1 = psT[u * 2 + 1];
+              slide_sum_nrad(
+                s_0, s_1, zero, nrad, c - u, c + u,
+                src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+              );
+            }
+          }
+          unegp = uneg;
+          uposp = upos;
+        }
+        else
+        {
+          unegp = -1;
+          uposp = -1;
         }
       }
     }
-  }
-  else	// cost3
-  {
-    for (int x = 0; x < width; ++x)
+
+    if (msk_ptr == 0 || bmask[x] != 0)
     {
-      if (msk_ptr == 0 || bmask[x] != 0)
+      const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+      for (int u = -umax; u <= umax; ++u)
       {
-        const int      umax = std::min(std::min(x, width - 1 - x), mdis);
-        for (int u = -umax; u <= umax; ++u)
+        __m128i        s_0;
+        __m128i        s_1;
+        if (! cost3)
         {
-          const bool     s1_flag = ((u >= 0 && x >= u * 2)
-            || (u <= 0 && x < width + u * 2));
-          const bool     s2_flag = ((u <= 0 && x >= u * -2)
-            || (u >= 0 && x < width + u * 2));
-
-          __m128i        s0_0;
-          __m128i        s0_1;
-          sum_nrad(
-            s0_0, s0_1, zero, nrad, x - u, x + u,
-            src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
-          );
-
-          __m128i        s1_0;
-          __m128i        s1_1;
-          if (s1_flag)
+          __m128i &      rs_0 = rsums[(mdis + u) * 2    ];
+          __m128i &      rs_1 = rsums[(mdis + u) * 2 + 1];
+          if (std::abs(u) > umaxp)
           {
             sum_nrad(
-              s1_0, s1_1, zero, nrad, x - 2 * u, x,
+              rs_0, rs_1, zero, nrad, x - u, x + u,
               src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
             );
           }
-
-          __m128i        s2_0;
-          __m128i        s2_1;
-          if (s2_flag)
+          else
           {
-            sum_nrad(
-              s2_0, s2_1, zero, nrad, x, x + 2 * u,
+            slide_sum_nrad(
+              rs_0, rs_1, zero, nrad, x - u, x + u,
               src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
             );
           }
-
-          s1_0 = (s1_flag) ? s1_0 : ((s2_flag) ? s2_0 : s0_0);
-          s1_1 = (s1_flag) ? s1_1 : ((s2_flag) ? s2_1 : s0_1);
-          s2_0 = (s2_flag) ? s2_0 : ((s1_flag) ? s1_0 : s0_0);
-          s2_1 = (s2_flag) ? s2_1 : ((s1_flag) ? s1_1 : s0_1);
-
-          const __m128i  s_0 = _mm_add_epi32(_mm_add_epi32(s0_0, s1_0), s2_0);
-          const __m128i  s_1 = _mm_add_epi32(_mm_add_epi32(s0_1, s1_1), s2_1);
-
-          // should use cubic if ucubic=true
-          const __m128i  x1pr = _mm_load_si128(src1p_ptr + x + u);
-          const __m128i  x1nl = _mm_load_si128(src1n_ptr + x - u);
-          const __m128i  ip = _mm_avg_epu16(x1pr, x1nl);
-
-          const __m128i  x1p = _mm_load_si128(src1p_ptr + x);
-          const __m128i  x1n = _mm_load_si128(src1n_ptr + x);
-          const __m128i  vdp = difabs16(x1p, ip);
-          const __m128i  vdn = difabs16(x1n, ip);
-          const __m128i  v0 = _mm_add_epi32(
-            _mm_unpacklo_epi16(vdp, zero),
-            _mm_unpacklo_epi16(vdn, zero)
+          s_0 = rs_0;
+          s_1 = rs_1;
+        }
+        else
+        {
+          const bool     s1_flag = ((u >= 0 && x >= u * 2)
+            || (u <= 0 && x < width + u * 2));
+          const bool     s2_flag = ((u <= 0 && x >= u * -2)
+            || (u >= 0 && x < width + u * 2));
+
+          const int      mu = mdis + u;
+          const __m128i *s0_ptr = s0tab + ((x % tpitch) * tpitch + mu) * 2;
+          const __m128i *sl_ptr =           // Center x - u
+            s0tab + (((x - u) % tpitch) * tpitch + mu) * 2;
+          const __m128i *sr_ptr =           // Center x + u
+            s0tab + (((x + u) % tpitch) * tpitch + mu) * 2;
+          const __m128i *s1_ptr =
+            (s1_flag) ? sl_ptr : ((s2_flag) ? sr_ptr : s0_ptr);
+          const __m128i *s2_ptr =
+            (s2_flag) ? sr_ptr : ((s1_flag) ? sl_ptr : s0_ptr);
+
+          s_0 = _mm_add_epi32(
+            _mm_add_epi32(s0_ptr [0], s1_ptr [0]), s2_ptr [0]
           );
-          const __m128i  v1 = _mm_add_epi32(
-            _mm_unpackhi_epi16(vdp, zero),
-            _mm_unpackhi_epi16(vdn, zero)
+          s_1 = _mm_add_epi32(
+            _mm_add_epi32(s0_ptr [1], s1_ptr [1]), s2_ptr [1]
           );
+        }
 
-          const __m128   cc_a0 = _mm_mul_ps(_mm_cvtepi32_ps(s_0), alpha_4);
-          const __m128   cc_a1 = _mm_mul_ps(_mm_cvtepi32_ps(s_1), alpha_4);
+        // should use cubic if ucubic=true
+        const __m128i  x1pr = _mm_load_si128(src1p_ptr + x + u);
+        const __m128i  x1nl = _mm_load_si128(src1n_ptr + x - u);
+        const __m128i  ip = _mm_avg_epu16(x1pr, x1nl);
+
+        const __m128i  x1p = _mm_load_si128(src1p_ptr + x);
+        const __m128i  x1n = _mm_load_si128(src1n_ptr + x);
+        const __m128i  vdp = difabs16(x1p, ip);
+        const __m128i  vdn = difabs16(x1n, ip);
+        const __m128i  v0 = _mm_add_epi32(
+          _mm_unpacklo_epi16(vdp, zero),
+          _mm_unpacklo_epi16(vdn, zero)
+        );
+        const __m128i  v1 = _mm_add_epi32(
+          _mm_unpackhi_epi16(vdp, zero),
+          _mm_unpackhi_epi16(vdn, zero)
+        );
+
+        const int      dpos = (mdis + u) * VECTSIZE;
+        if (fixed)
+        {
+          const __m128i  cc_b = _mm_set1_epi32(kb * std::abs(u));
+          __m128i *      cc_ptr = reinterpret_cast <__m128i *> (ccosts + dpos);
+          _mm_store_si128(cc_ptr, conn_cost_fixed(s_0, v0, kac, cc_b));
+          _mm_store_si128(cc_ptr + tpitch, conn_cost_fixed(s_1, v1, kac, cc_b));
+          continue;
+        }
 
-          const __m128   cc_b = _mm_set1_ps(beta16 * std::abs(u));
+        const __m128   cc_a0 = _mm_mul_ps(_mm_cvtepi32_ps(s_0), alpha_4);
+        const __m128   cc_a1 = _mm_mul_ps(_mm_cvtepi32_ps(s_1), alpha_4);
 
-          const __m128   cc_c0 = _mm_mul_ps(_mm_cvtepi32_ps(v0), ab_4);
-          const __m128   cc_c1 = _mm_mul_ps(_mm_cvtepi32_ps(v1), ab_4);
+        const __m128   cc_b = _mm_set1_ps(beta16 * std::abs(u));
 
-          const __m128   cc0 = _mm_add_ps(_mm_add_ps(cc_a0, cc_b), cc_c0);
-          const __m128   cc1 = _mm_add_ps(_mm_add_ps(cc_a1, cc_b), cc_c1);
-          const int      dpos = (x * tpitch + mdis + u) * VECTSIZE;
-          _mm_store_ps(ccosts + dpos, cc0);
-          _mm_store_ps(ccosts + dpos + ofs_p4, cc1);
-        }
+        const __m128   cc_c0 = _mm_mul_ps(_mm_cvtepi32_ps(v0), ab_4);
+        const __m128   cc_c1 = _mm_mul_ps(_mm_cvtepi32_ps(v1), ab_4);
+
+        const __m128   cc0 = _mm_add_ps(_mm_add_ps(cc_a0, cc_b), cc_c0);
+        const __m128   cc1 = _mm_add_ps(_mm_add_ps(cc_a1, cc_b), cc_c1);
+        _mm_store_ps(ccosts + dpos, cc0);
+        _mm_store_ps(ccosts + dpos + tpitch_v, cc1);
       }
+      umaxp = umax;
+    }
+    else
+    {
+      memset(ccosts, 0, 2 * tpitch_v * sizeof(*ccosts));
+      umaxp = -1;
     }
-  }
-
-  const __m128   fltmax = _mm_set1_ps(FLT_MAX);
-  const __m128   fltmax9 = _mm_set1_ps(FLT_MAX * 0.9f);
-  const __m128i	nine16 = _mm_set1_epi16(9);
-  const __m128i	sign16 = _mm_set1_epi16(-0x8000);
-  const __m128i	cubic_cst = _mm_set1_epi32(-0x8000 * 8 + 4); // Rounding and sign change
-
-  // Same reason as beta16
-  const float    gamma16 = gamma * 256;
 
-  // The following operations are done in 2 passes (the "blocks"), because
-  // we can process only VECTSIZE pixels at once (FP32 data).
-  // Note: ccosts pointer is shifted at the end of the block
-  for (int block = 0; block < 2; ++block)
-  {
     // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
-    // Calculate path costs
+    // Calculate the path costs
 
-    for (int k = 0; k < VECTSIZE; ++k)
+    // We can process only VECTSIZE pixels at once (FP32 data), so the
+    // column is done in 2 passes (the "blocks").
+    for (int block = 0; block < 2; ++block)
     {
-      const int      p = mdis * VECTSIZE + k;
-      pcosts[p] = ccosts[p];
-    }
+      const float *  tT = ccosts + block * tpitch_v;
+      float *        ppT = pcosts + (((x + 1) & 1) * 2 + block) * tpitch_v;
+      float *        pT = pcosts + ((x & 1) * 2 + block) * tpitch_v;
 
-    for (int x = 1; x < width; ++x)
-    {
-      float *        tT = ccosts + x * tpitch_v;
-      float *        ppT = pcosts + (x - 1) * tpitch_v;
-      float *        pT = pcosts + x * tpitch_v;
-      __m128i *      piT = reinterpret_cast <__m128i *> (pbackt + (x - 1) * tpitch_v);
+      if (x == 0)
+      {
+        const int      p = mdis * VECTSIZE;
+        _mm_store_ps(pT + p, _mm_load_ps(tT + p));
+        continue;
+      }
+
+      int8_t *       piT = pbackt + (block * width + x - 1) * tpitch_v;
 
       if (msk_ptr != 0 && bmask[x] == 0)
       {
@@ -611,57 +903,52 @@ void	Eedi3Sse::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, c
           const int      umax = std::min(std::min(x, width - 1 - x), mdis);
           const int      p = (mdis - umax) * VECTSIZE;
           memcpy(pT + p, tT + p, (umax * 2 + 1) * VECTSIZE * sizeof(*pT));
-          memset(piT, 0, tpitch * sizeof(*piT));
+          memset(piT, 0, tpitch_v * sizeof(*piT));
         }
         else
         {
           memcpy(pT, ppT, tpitch_v * sizeof(*pT));
-          memcpy(piT, piT - tpitch, tpitch * sizeof(*piT));
+          memcpy(piT, piT - tpitch_v, tpitch_v * sizeof(*piT));
           const int      pumax = std::min(x - 1, width - x);
           if (pumax < mdis)
           {
-            const __m128i  a = _mm_set1_epi32(1 - pumax);
-            const __m128i  b = _mm_set1_epi32(pumax - 1);
-            _mm_store_si128(piT + mdis - pumax, a);
-            _mm_store_si128(piT + mdis + pumax, b);
+            memset(piT + (mdis - pumax) * VECTSIZE, 1 - pumax, VECTSIZE);
+            memset(piT + (mdis + pumax) * VECTSIZE, pumax - 1, VECTSIZE);
           }
         }
       }
 
+      else if (fixed)
+      {
+        path_cost_fixed(
+          reinterpret_cast <int32_t *> (pT), piT,
+          reinterpret_cast <const int32_t *> (ppT),
+          reinterpret_cast <const int32_t *> (tT),
+          x, width, mdis, kg
+        );
+      }
+
       else
       {
-        const int      umax = std::min(std::min(x, width - 1 - x), mdis);
-        for (int u = -umax; u <= umax; ++u)
-        {
-          __m128i        idx = _mm_setzero_si128(); // 32-bit signed int
-          __m128         bval = fltmax;
-          const int      umax2 = std::min(std::min(x - 1, width - x), mdis);
-          const int      vmax = std::min(umax2, u + 1);
-          for (int v = std::max(-umax2, u - 1); v <= vmax; ++v)
-          {
-            __m128         y = _mm_load_ps(ppT + (mdis + v) * VECTSIZE);
-            const __m128   a = _mm_set1_ps(gamma16 * std::abs(u - v));
-            y = _mm_add_ps(y, a);
-            const __m128   ccost = _mm_min_ps(y, fltmax9);
-            const __m128i  v4 = _mm_set1_epi32(v);
-            const __m128i  tst =  // if (ccost < bval)
-              _mm_castps_si128(_mm_cmplt_ps(ccost, bval));
-            idx = select(tst, v4, idx);
-            bval = _mm_min_ps(ccost, bval);
-          }
-          const int      mu = (mdis + u) * VECTSIZE;
-          __m128         y = _mm_add_ps(bval, _mm_load_ps(tT + mu));
-          y = _mm_min_ps(y, fltmax9);
-          _mm_store_ps(pT + mu, y);
-          _mm_store_si128(piT + mdis + u, idx);
-        }
+        path_cost(pT, piT, ppT, tT, x, width, mdis, gamma16);
       }
-    }
+    }  // for block
+  }  // for x
+
+  // Rounding of the cubic interpolation, see the bits parameter
+  const int      cubic_rnd = (bits < 16) ? 0 : 8;
+  const __m128i	nine16 = _mm_set1_epi16(9);
+  const __m128i	sign16 = _mm_set1_epi16(-0x8000);
+  const __m128i	cubic_cst = _mm_set1_epi32(-0x8000 * 8 + (cubic_rnd >> 1)); // Rounding and sign change
+
+  for (int block = 0; block < 2; ++block)
+  {
+    const int8_t * pbackt_b = pbackt + block * width * tpitch_v;
 
     // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
     // Backtrack
 
-    _mm_store_si128(reinterpret_cast <__m128i *> (fpath) + width - 1, zero);
+    memset(fpath + (width - 1) * VECTSIZE, 0, VECTSIZE * sizeof(*fpath));
     for (int x = width - 2; x >= 0; --x)
     {
       const int      idx_n = (x + 1)             * VECTSIZE;
@@ -670,7 +957,7 @@ void	Eedi3Sse::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, c
       for (int k = 0; k < VECTSIZE; ++k)
       {
         const int      n = fpath[idx_n + k];
-        fpath[idx_c + k] = pbackt[idx_p + n * VECTSIZE + k];
+        fpath[idx_c + k] = pbackt_b[idx_p + n * VECTSIZE + k];
       }
     }
 
@@ -715,10 +1002,7 @@ void	Eedi3Sse::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, c
           reinterpret_cast <uint16_t *> (dst_ptr + x) + bv;
 
         assert(sizeof(*dmap_ptr) == sizeof(int16_t) * VECTSIZE * 2);
-        assert(sizeof(*fpath) == sizeof(int32_t));
-        __m128i        dir4 =
-          _mm_load_si128(reinterpret_cast <const __m128i *> (fpath) + x);
-        dir4 = _mm_packs_epi32(dir4, zero);   // Contains 16-bit data
+        __m128i        dir4 = load_dir4(fpath + x * VECTSIZE); // 16-bit data
         _mm_storel_epi64(reinterpret_cast <__m128i *> (
           reinterpret_cast <int64_t *> (dmap_ptr + x) + block
           ), dir4);
@@ -746,7 +1030,7 @@ void	Eedi3Sse::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, c
               reinterpret_cast <const uint16_t *> (src3n_ptr + x - dir * 3) + bv;
             const int      sum_3 = src3p16_ptr[k] + src3n16_ptr[k];
 
-            const int      interp = (9 * sum_1 - sum_3 + 8) >> 4;
+            const int      interp = (9 * sum_1 - sum_3 + cubic_rnd) >> 4;
             dst16_ptr[k] =
               uint16_t(std::min(std::max(interp, 0), 65535));
           }
@@ -759,9 +1043,6 @@ void	Eedi3Sse::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, c
         }
       }
     }  // for x
-
-    ccosts += ofs_p4;
-
   }  // for block
 /****************************************************************************/
 #endif // EDI bypass
@@ -770,146 +1051,1554 @@ void	Eedi3Sse::interp_lines_full_pel(const __m128i *src_ptr, __m128i *dst_ptr, c
 
 
 
-/*\\\ PROTECTED \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
-
-
-
-/*\\\ PRIVATE \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
-
-
+/*
+==============================================================================
+Name: interp_lines_half_pel
+Description:
+  Interpolates COL_H lines at once, half-pixel precision.
+  This is the counterpart of interpLineHP(), the results are bit-exact with
+  it, provided the data have been packed with prepare_lines_mirror_8bits().
+  The half-pel lines are computed here from the packed reference lines.
+  Data are kept in the 16-bit packed format, but all the roundings are done
+  on the 8-bit grid and the costs are exactly 256 times the C++ ones, so
+  the chosen paths are the same.
+  Contrary to the full-pel versions, the mask is also handled per line:
+  a line of the column may be masked while its neighbours are not.
+Input parameters:
+  - Same as interp_lines_full_pel().
+Output parameters:
+  - dst_ptr: Same as interp_lines_full_pel().
+  - dmap_ptr: Same as interp_lines_full_pel(), but the directions are
+    in half pixels.
+Input/output parameters:
+  - tmp_ptr: A temporary buffer, 16-byte aligned. Its size in bytes is at
+    least:
+    ((3 * (mdis * 4 + 1) * 4 + (mdis * 4 + 1) + 1) * VECTSIZE + 1 + COL_H) * width
+    + (width + HPEL_MARGIN * 2) * 4 * sizeof (__m128i)
+    + (mdis * 4 + 1) * 2 * sizeof (__m128i)
+Throws: Nothing
+==============================================================================
+*/
 
-void	Eedi3Sse::expand_mask(bool dst_ptr[], const uint8_t msk_ptr[], int width, int mdis)
+void	Eedi3Sse::interp_lines_half_pel(const __m128i *src_ptr, __m128i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m128i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3)
 {
+  assert(src_ptr != 0);
   assert(dst_ptr != 0);
-  assert(msk_ptr != 0);
+  assert(tmp_ptr != 0);
+  assert((reinterpret_cast <intptr_t> (tmp_ptr) & 15) == 0);
+  assert(dmap_ptr != 0);
   assert(width > 0);
+  assert(pitch > 0);
+  assert(alpha >= 0);
+  assert(beta >= 0);
+  assert(alpha + beta <= 1.0f);
+  assert(gamma >= 0);
+  assert(nrad >= 0);
+  assert(nrad < HPEL_MARGIN);
   assert(mdis > 0);
 
-  const int64_t *   msk8_ptr = reinterpret_cast <const int64_t *> (msk_ptr);
+  // First, shifts everything so we point on actual data.
+  src_ptr += MARGIN_H;
 
-  const int	minmdis = (width < mdis) ? width : mdis;
+  const __m128i* src3p_ptr = src_ptr;
+  const __m128i* src1p_ptr = src_ptr + 1 * pitch;
+  const __m128i* src1n_ptr = src_ptr + 2 * pitch;
+  const __m128i* src3n_ptr = src_ptr + 3 * pitch;
 
-  int			last = -666999;
+  const int      tpitch = mdis * 4 + 1;
+  const int      hpitch = width + HPEL_MARGIN * 2;
+  int            tmpofs = 0;
 
-  for (int x = 0; x < minmdis; ++x)
-  {
-    if (msk8_ptr[x] != 0)
-    {
-      last = x + mdis;
-    }
-  }
+#define Eedi3Sse_DECL( T, N, S) \
+	T  *          N = reinterpret_cast <T *> (tmp_ptr + tmpofs); \
+	tmpofs += S * sizeof (T);
 
-  for (int x = 0; x < width - minmdis; ++x)
+  // hpel contains the 4 half-pel lines, with margins,
+  // lmask contains the expanded mask for each line of a column (0 or 0xFF),
+  // the other buffers are organised like in interp_lines_full_pel().
+  Eedi3Sse_DECL(__m128i, hpel, hpitch * 4);
+  Eedi3Sse_DECL(float, ccosts, 2 * width * tpitch * VECTSIZE);
+  Eedi3Sse_DECL(float, pcosts, width * tpitch * VECTSIZE);
+  Eedi3Sse_DECL(__m128i, rsums, tpitch * 2);     // Running sums of the nrad window, for each u
+  Eedi3Sse_DECL(int8_t, pbackt, width * tpitch * VECTSIZE);
+  Eedi3Sse_DECL(int8_t, fpath, width          * VECTSIZE);
+  Eedi3Sse_DECL(uint8_t, lmask, width * COL_H);
+  Eedi3Sse_DECL(bool, bmask, width);
+
+#undef Eedi3Sse_DECL
+
+  __m128i *      hp3p_ptr = hpel + HPEL_MARGIN;
+  __m128i *      hp1p_ptr = hp3p_ptr + hpitch;
+  __m128i *      hp1n_ptr = hp1p_ptr + hpitch;
+  __m128i *      hp3n_ptr = hp1n_ptr + hpitch;
+
+  // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+  // Calculate half-pel values
+
+  for (int x = -HPEL_MARGIN; x < width - 1 + HPEL_MARGIN; ++x)
   {
-    if (msk8_ptr[x + mdis] != 0)
+    const __m128i* s_ptr [4] = { src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr };
+    __m128i *      h_ptr [4] = { hp3p_ptr, hp1p_ptr, hp1n_ptr, hp3n_ptr };
+    for (int r = 0; r < 4; ++r)
     {
-      last = x + mdis * 2;
+      const __m128i  a = _mm_load_si128(s_ptr [r] + x    );
+      const __m128i  b = _mm_load_si128(s_ptr [r] + x + 1);
+      __m128i        h;
+      if (!ucubic || (x <= 0 || x >= width - 2))
+      {
+        h = avg16_8bits(a, b);
+      }
+      else
+      {
+        h = cubic16_8bits(
+          a, b,
+          _mm_load_si128(s_ptr [r] + x - 1),
+          _mm_load_si128(s_ptr [r] + x + 2)
+        );
+      }
+      _mm_store_si128(h_ptr [r] + x, h);
     }
-    dst_ptr[x] = (x <= last);
   }
 
-  for (int x = width - minmdis; x < width; ++x)
+  if (msk_ptr != 0)
   {
-    dst_ptr[x] = (x <= last);
+    memset(ccosts, 0, 2 * tpitch * width * VECTSIZE * sizeof(float));
+    expand_mask(bmask, msk_ptr, width, mdis, COL_H);
+    expand_mask_lanes(lmask, msk_ptr, width, mdis, COL_H);
   }
-}
 
+  const __m128i  zero = _mm_setzero_si128();
+  const __m128   alpha_4 = _mm_set1_ps(alpha);
+  const __m128   third_4 = _mm_set1_ps(0.333333f);
+  const __m128   ab_4 = _mm_set1_ps(1.0f - alpha - beta);
 
+  const int      tpitch_v = tpitch * VECTSIZE;
+  const int      ofs_p4 = width * tpitch_v;
 
-void	Eedi3Sse::sum_nrad(__m128i &s_0, __m128i &s_1, const __m128i &zero, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n)
-{
-  assert(nrad >= 0);
-  assert(src3p != 0);
-  assert(src1p != 0);
-  assert(src1n != 0);
-  assert(src3n != 0);
+  // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+  // Calculate all connection costs
 
-  s_0 = zero;
-  s_1 = zero;
-  for (int k = -nrad; k <= nrad; ++k)
+  // The terms which are not multiplied by a pixel value are scaled after
+  // being computed exactly like the C++ code, so the scaling is exact.
+  // The nrad window sums are slid along x, as in interp_lines_full_pel().
+  int            umaxp = -1;
+  for (int x = 0; x < width; ++x)
   {
-    const int      xrk = xr + k;
-    const int      xlk = xl + k;
-    const __m128i  x3pr = _mm_load_si128(src3p + xrk);
-    const __m128i  x1pl = _mm_load_si128(src1p + xlk);
-    const __m128i  x1pr = _mm_load_si128(src1p + xrk);
-    const __m128i  x1nl = _mm_load_si128(src1n + xlk);
-    const __m128i  x1nr = _mm_load_si128(src1n + xrk);
-    const __m128i  x3nl = _mm_load_si128(src3n + xlk);
+    if (msk_ptr == 0 || bmask[x] != 0)
+    {
+      const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+      for (int u = -umax * 2; u <= umax * 2; ++u)
+      {
+        const int      u2 = u >> 1;
+        const __m128i* r3p_ptr = src3p_ptr;
+        const __m128i* r1p_ptr = src1p_ptr;
+        const __m128i* r1n_ptr = src1n_ptr;
+        const __m128i* r3n_ptr = src3n_ptr;
+        int            xl = x - u2;
+        if ((u & 1) != 0)
+        {
+          r3p_ptr = hp3p_ptr;
+          r1p_ptr = hp1p_ptr;
+          r1n_ptr = hp1n_ptr;
+          r3n_ptr = hp3n_ptr;
+          --xl;
+        }
+        const int      xr = x + u2;
 
-    const __m128i  d3p1p = difabs16(x3pr, x1pl);
-    const __m128i  d1p1n = difabs16(x1pr, x1nl);
-    const __m128i  d1n3n = difabs16(x1nr, x3nl);
+        __m128i &      rs_0 = rsums[(mdis * 2 + u) * 2    ];
+        __m128i &      rs_1 = rsums[(mdis * 2 + u) * 2 + 1];
+        if (std::abs(u) > umaxp * 2)
+        {
+          sum_nrad(
+            rs_0, rs_1, zero, nrad, xl, xr,
+            r3p_ptr, r1p_ptr, r1n_ptr, r3n_ptr
+          );
+        }
+        else
+        {
+          slide_sum_nrad(
+            rs_0, rs_1, zero, nrad, xl, xr,
+            r3p_ptr, r1p_ptr, r1n_ptr, r3n_ptr
+          );
+        }
+        __m128i        s_0 = rs_0;
+        __m128i        s_1 = rs_1;
 
-    s_0 = _mm_add_epi32(s_0, _mm_unpacklo_epi16(d3p1p, zero));
-    s_1 = _mm_add_epi32(s_1, _mm_unpackhi_epi16(d3p1p, zero));
-    s_0 = _mm_add_epi32(s_0, _mm_unpacklo_epi16(d1p1n, zero));
-    s_1 = _mm_add_epi32(s_1, _mm_unpackhi_epi16(d1p1n, zero));
-    s_0 = _mm_add_epi32(s_0, _mm_unpacklo_epi16(d1n3n, zero));
-    s_1 = _mm_add_epi32(s_1, _mm_unpackhi_epi16(d1n3n, zero));
-  }
-}
+        if (cost3)
+        {
+          const bool     s1_flag = ((u >= 0 && x >= u)
+            || (u <= 0 && x < width + u));
+          const bool     s2_flag = ((u <= 0 && x >= -u)
+            || (u >= 0 && x < width - u));
 
+          __m128i        s1_0 = zero;
+          __m128i        s1_1 = zero;
+          if (s1_flag)
+          {
+            sum_nrad(
+              s1_0, s1_1, zero, nrad, x - u, x,
+              src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+            );
+          }
 
+          __m128i        s2_0 = zero;
+          __m128i        s2_1 = zero;
+          if (s2_flag)
+          {
+            sum_nrad(
+              s2_0, s2_1, zero, nrad, x, x + u,
+              src3p_ptr, src1p_ptr, src1n_ptr, src3n_ptr
+            );
+          }
 
-__m128i	Eedi3Sse::interp_cubic8(const __m128i &src1p, const __m128i &src1n, const __m128i &src3p, const __m128i &src3n, const __m128i &nine16, const __m128i &sign16, const __m128i &cubic_cst, const __m128i &zero)
-{
-  assert(&src1p != 0);
-  assert(&src1n != 0);
-  assert(&src3p != 0);
-  assert(&src3n != 0);
-  assert(&nine16 != 0);
-  assert(&sign16 != 0);
-  assert(&cubic_cst != 0);
-  assert(&zero != 0);
+          s1_0 = (s1_flag) ? s1_0 : ((s2_flag) ? s2_0 : s_0);
+          s1_1 = (s1_flag) ? s1_1 : ((s2_flag) ? s2_1 : s_1);
+          s2_0 = (s2_flag) ? s2_0 : s1_0;
+          s2_1 = (s2_flag) ? s2_1 : s1_1;
 
-  const __m128i  avg1 = _mm_avg_epu16(src1p, src1n);
-  const __m128i  avg3 = _mm_avg_epu16(src3p, src3n);
-  const __m128i  a3_0 = _mm_unpacklo_epi16(avg3, zero);
-  const __m128i  a3_1 = _mm_unpackhi_epi16(avg3, zero);
-  const __m128i  hi = _mm_mulhi_epu16(avg1, nine16);
-  const __m128i  lo = _mm_mullo_epi16(avg1, nine16);
-  __m128i        s0 = _mm_unpacklo_epi16(lo, hi);
-  __m128i        s1 = _mm_unpackhi_epi16(lo, hi);
-  s0 = _mm_sub_epi32(s0, a3_0);
-  s1 = _mm_sub_epi32(s1, a3_1);
-  s0 = _mm_add_epi32(s0, cubic_cst);
-  s1 = _mm_add_epi32(s1, cubic_cst);
-  s0 = _mm_srai_epi32(s0, 3);
-  s1 = _mm_srai_epi32(s1, 3);
-  __m128i        res = _mm_packs_epi32(s0, s1);
-  res = _mm_xor_si128(res, sign16);
+          s_0 = _mm_add_epi32(_mm_add_epi32(s_0, s1_0), s2_0);
+          s_1 = _mm_add_epi32(_mm_add_epi32(s_1, s1_1), s2_1);
+        }
 
-  return (res);
-}
+        // should use cubic if ucubic=true
+        const __m128i  ip = avg16_8bits(
+          _mm_load_si128(r1p_ptr + xr),
+          _mm_load_si128(r1n_ptr + xl)
+        );
+
+        const __m128i  x1p = _mm_load_si128(src1p_ptr + x);
+        const __m128i  x1n = _mm_load_si128(src1n_ptr + x);
+        const __m128i  vdp = difabs16(x1p, ip);
+        const __m128i  vdn = difabs16(x1n, ip);
+        const __m128i  v0 = _mm_add_epi32(
+          _mm_unpacklo_epi16(vdp, zero),
+          _mm_unpacklo_epi16(vdn, zero)
+        );
+        const __m128i  v1 = _mm_add_epi32(
+          _mm_unpackhi_epi16(vdp, zero),
+          _mm_unpackhi_epi16(vdn, zero)
+        );
+
+        __m128         cc_a0 = _mm_mul_ps(_mm_cvtepi32_ps(s_0), alpha_4);
+        __m128         cc_a1 = _mm_mul_ps(_mm_cvtepi32_ps(s_1), alpha_4);
+        if (cost3)
+        {
+          cc_a0 = _mm_mul_ps(cc_a0, third_4);
+          cc_a1 = _mm_mul_ps(cc_a1, third_4);
+        }
 
+        const __m128   cc_b = _mm_set1_ps(beta * std::abs(u) * 0.5f * 256);
 
+        const __m128   cc_c0 = _mm_mul_ps(_mm_cvtepi32_ps(v0), ab_4);
+        const __m128   cc_c1 = _mm_mul_ps(_mm_cvtepi32_ps(v1), ab_4);
 
-// src13p and src13n are made of:
-// - 4 int16 from 1p/1n in the lowest 64 bits, and
-// - 4 int16 from 3p/3n in the highest 64 bits.
-// Result is packed in the lowest 64 bits, highest 64 bits are garbage.
-__m128i	Eedi3Sse::interp_cubic4(const __m128i &src13p, const __m128i &src13n, const __m128i &nine16, const __m128i &sign16, const __m128i &cubic_cst, const __m128i &zero)
-{
-  assert(&src13p != 0);
-  assert(&src13n != 0);
-  assert(&nine16 != 0);
-  assert(&sign16 != 0);
-  assert(&cubic_cst != 0);
-  assert(&zero != 0);
+        __m128         cc0 = _mm_add_ps(_mm_add_ps(cc_a0, cc_b), cc_c0);
+        __m128         cc1 = _mm_add_ps(_mm_add_ps(cc_a1, cc_b), cc_c1);
+        if (msk_ptr != 0)
+        {
+          // Masked lines keep a null cost
+          cc0 = _mm_and_ps(cc0, _mm_castsi128_ps(lane_mask(lmask, x, 0)));
+          cc1 = _mm_and_ps(cc1, _mm_castsi128_ps(lane_mask(lmask, x, 1)));
+        }
+        const int      dpos = (x * tpitch + mdis * 2 + u) * VECTSIZE;
+        _mm_store_ps(ccosts + dpos, cc0);
+        _mm_store_ps(ccosts + dpos + ofs_p4, cc1);
+      }
+      umaxp = umax;
+    }
+    else
+    {
+      umaxp = -1;
+    }
+  }
 
-  const __m128i  avg = _mm_avg_epu16(src13p, src13n);
-  const __m128i  a3 = _mm_unpackhi_epi16(avg, zero);
-  const __m128i  hi = _mm_mulhi_epu16(avg, nine16);
-  const __m128i  lo = _mm_mullo_epi16(avg, nine16);
-  __m128i        s = _mm_unpacklo_epi16(lo, hi);
-  s = _mm_sub_epi32(s, a3);
-  s = _mm_add_epi32(s, cubic_cst);
-  s = _mm_srai_epi32(s, 3);
-  __m128i        res = _mm_packs_epi32(s, zero);
-  res = _mm_xor_si128(res, sign16);
+  // The C++ code clips to FLT_MAX * 0.9 in double precision
+  const __m128   fltmax = _mm_set1_ps(FLT_MAX);
+  const __m128   fltmax9 = _mm_set1_ps(float(FLT_MAX * 0.9));
 
-  return (res);
+  for (int block = 0; block < 2; ++block)
+  {
+    // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+    // Calculate path costs
+
+    if (msk_ptr != 0)
+    {
+      // Same as interpLineHP(): the parts which are not computed may be read
+      // after masked pixels.
+      for (int i = 0; i < width * tpitch; ++i)
+      {
+        _mm_store_ps(pcosts + i * VECTSIZE, fltmax9);
+      }
+      memset(pbackt, 0, width * tpitch_v * sizeof(*pbackt));
+    }
+
+    for (int k = 0; k < VECTSIZE; ++k)
+    {
+      const int      p = mdis * 2 * VECTSIZE + k;
+      pcosts[p] = ccosts[p];
+    }
+
+    for (int x = 1; x < width; ++x)
+    {
+      float *        tT = ccosts + x * tpitch_v;
+      float *        ppT = pcosts + (x - 1) * tpitch_v;
+      float *        pT = pcosts + x * tpitch_v;
+      // Each element contains the directions of the 4 lines of the block
+      uint32_t *     piT = reinterpret_cast <uint32_t *> (pbackt + (x - 1) * tpitch_v);
+
+      // Lines of the block requiring the edge-directed interpolation
+      __m128i        lm = _mm_set1_epi32(-1);
+      int            lm_bits = 15;
+      if (msk_ptr != 0)
+      {
+        lm = lane_mask(lmask, x, block);
+        lm_bits = _mm_movemask_ps(_mm_castsi128_ps(lm));
+      }
+
+      const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+      if (lm_bits != 0)
+      {
+        const int      umax2 = std::min(std::min(x - 1, width - x), mdis);
+        for (int u = -umax * 2; u <= umax * 2; ++u)
+        {
+          __m128i        idx = _mm_setzero_si128(); // 32-bit signed int
+          __m128         bval = fltmax;
+          const int      vmax = std::min(umax2 * 2, u + 2);
+          for (int v = std::max(-umax2 * 2, u - 2); v <= vmax; ++v)
+          {
+            __m128         y = _mm_load_ps(ppT + (mdis * 2 + v) * VECTSIZE);
+            const __m128   a = _mm_set1_ps(gamma * std::abs(u - v) * 0.5f * 256);
+            y = _mm_add_ps(y, a);
+            const __m128   ccost = _mm_min_ps(y, fltmax9);
+            const __m128i  v4 = _mm_set1_epi32(v);
+            const __m128i  tst =  // if (ccost < bval)
+              _mm_castps_si128(_mm_cmplt_ps(ccost, bval));
+            idx = select(tst, v4, idx);
+            bval = _mm_min_ps(ccost, bval);
+          }
+          const int      mu = (mdis * 2 + u) * VECTSIZE;
+          __m128         y = _mm_add_ps(bval, _mm_load_ps(tT + mu));
+          y = _mm_min_ps(y, fltmax9);
+          _mm_store_ps(pT + mu, y);
+          store_dir4(pbackt + (x - 1) * tpitch_v + mu, idx);
+        }
+      }
+
+      // Masked lines. The lines processed above are kept.
+      if (lm_bits != 15)
+      {
+        const __m128   lm_f = _mm_castsi128_ps(lm);
+        const __m128i  lm_16 = _mm_packs_epi32(lm, lm);
+        const uint32_t lm_8 = uint32_t(_mm_cvtsi128_si32(_mm_packs_epi16(lm_16, lm_16)));
+        if (x == 1)
+        {
+          for (int u = -umax * 2; u <= umax * 2; ++u)
+          {
+            const int      mu = (mdis * 2 + u) * VECTSIZE;
+            const __m128   y = _mm_or_ps(
+              _mm_and_ps(lm_f, _mm_load_ps(pT + mu)),
+              _mm_andnot_ps(lm_f, _mm_load_ps(tT + mu))
+            );
+            _mm_store_ps(pT + mu, y);
+          }
+          for (int u = 0; u < tpitch; ++u)
+          {
+            piT [u] &= lm_8;
+          }
+        }
+        else
+        {
+          for (int u = 0; u < tpitch; ++u)
+          {
+            const int      mu = u * VECTSIZE;
+            const __m128   y = _mm_or_ps(
+              _mm_and_ps(lm_f, _mm_load_ps(pT + mu)),
+              _mm_andnot_ps(lm_f, _mm_load_ps(ppT + mu))
+            );
+            _mm_store_ps(pT + mu, y);
+            piT [u] = (piT [u] & lm_8) | (piT [u - tpitch] & ~lm_8);
+          }
+          const int      pumax = std::min(x - 1, width - x);
+          if (pumax < mdis)
+          {
+            // Same offsets as interpLineHP(), which are not centered on
+            // mdis * 2.
+            const uint32_t a = uint8_t((1 - pumax) * 2) * 0x01010101U & ~lm_8;
+            const uint32_t b = uint8_t((pumax - 1) * 2) * 0x01010101U & ~lm_8;
+            uint32_t *     q_ptr = piT + mdis;
+            q_ptr [-pumax * 2    ] = (q_ptr [-pumax * 2    ] & lm_8) | a;
+            q_ptr [-pumax * 2 + 1] = (q_ptr [-pumax * 2 + 1] & lm_8) | a;
+            q_ptr [ pumax * 2 - 1] = (q_ptr [ pumax * 2 - 1] & lm_8) | b;
+            q_ptr [ pumax * 2    ] = (q_ptr [ pumax * 2    ] & lm_8) | b;
+          }
+        }
+      }
+    }
+
+    // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+    // Backtrack
+
+    memset(fpath + (width - 1) * VECTSIZE, 0, VECTSIZE * sizeof(*fpath));
+    for (int x = width - 2; x >= 0; --x)
+    {
+      const int      idx_n = (x + 1)                 * VECTSIZE;
+      const int      idx_c = x * VECTSIZE;
+      const int      idx_p = (x * tpitch + mdis * 2) * VECTSIZE;
+      for (int k = 0; k < VECTSIZE; ++k)
+      {
+        const int      n = fpath[idx_n + k];
+        fpath[idx_c + k] = pbackt[idx_p + n * VECTSIZE + k];
+      }
+    }
+
+    // -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -  -
+    // Interpolate
+
+    const int      bv = block * VECTSIZE;
+    for (int x = 0; x < width; ++x)
+    {
+      if (msk_ptr != 0 && bmask[x] == 0)
+      {
+        // Does both blocks at once. All the lines are masked.
+        if (block == 0)
+        {
+          _mm_store_si128(dmap_ptr + x, zero);
+
+          const __m128i  x1p = _mm_load_si128(src1p_ptr + x);
+          const __m128i  x1n = _mm_load_si128(src1n_ptr + x);
+          __m128i        res;
+          if (ucubic)
+          {
+            res = cubic16_8bits(
+              x1p, x1n,
+              _mm_load_si128(src3p_ptr + x),
+              _mm_load_si128(src3n_ptr + x)
+            );
+          }
+          else
+          {
+            res = avg16_8bits(x1p, x1n);
+          }
+          _mm_store_si128(dst_ptr + x, res);
+        }
+      }
+
+      else
+      {
+        uint16_t * const       dst16_ptr =
+          reinterpret_cast <uint16_t *> (dst_ptr + x) + bv;
+
+        const __m128i  dir4 = load_dir4(fpath + x * VECTSIZE); // 16-bit data
+        _mm_storel_epi64(reinterpret_cast <__m128i *> (
+          reinterpret_cast <int64_t *> (dmap_ptr + x) + block
+          ), dir4);
+
+        for (int k = 0; k < VECTSIZE; ++k)
+        {
+          const int      dir = fpath[x * VECTSIZE + k];
+          const int      lane = bv + k;
+          int            interp;
+          if (msk_ptr != 0 && lmask[x * COL_H + lane] == 0)
+          {
+            reinterpret_cast <int16_t *> (dmap_ptr + x) [lane] = 0;
+            const int      sum_1 =
+                pix8(src1p_ptr, x, lane)
+              + pix8(src1n_ptr, x, lane);
+            if (ucubic)
+            {
+              const int      sum_3 =
+                  pix8(src3p_ptr, x, lane)
+                + pix8(src3n_ptr, x, lane);
+              interp = std::min(std::max((9 * sum_1 - sum_3 + 8) >> 4, 0), 255);
+            }
+            else
+            {
+              interp = (sum_1 + 1) >> 1;
+            }
+          }
+          else if ((dir & 1) == 0)
+          {
+            const int      d2 = dir >> 1;
+            const int      ad = std::abs(d2);
+            const int      sum_1 =
+                pix8(src1p_ptr, x + d2, lane)
+              + pix8(src1n_ptr, x - d2, lane);
+            if (ucubic && x >= ad * 3 && x <= width - 1 - ad * 3)
+            {
+              const int      sum_3 =
+                  pix8(src3p_ptr, x + d2 * 3, lane)
+                + pix8(src3n_ptr, x - d2 * 3, lane);
+              interp = std::min(std::max((9 * sum_1 - sum_3 + 8) >> 4, 0), 255);
+            }
+            else
+            {
+              interp = (sum_1 + 1) >> 1;
+            }
+          }
+          else
+          {
+            const int      d20 = dir >> 1;
+            const int      d21 = (dir + 1) >> 1;
+            const int      d30 = (dir * 3) >> 1;
+            const int      d31 = (dir * 3 + 1) >> 1;
+            const int      ad = std::max(std::abs(d30), std::abs(d31));
+            const int      c1 =
+                pix8(src1p_ptr, x + d20, lane)
+              + pix8(src1p_ptr, x + d21, lane);
+            const int      c2 =
+                pix8(src1n_ptr, x - d20, lane)
+              + pix8(src1n_ptr, x - d21, lane);
+            if (ucubic && x >= ad && x <= width - 1 - ad)
+            {
+              const int      c0 =
+                  pix8(src3p_ptr, x + d30, lane)
+                + pix8(src3p_ptr, x + d31, lane);
+              const int      c3 =
+                  pix8(src3n_ptr, x - d30, lane)
+                + pix8(src3n_ptr, x - d31, lane);
+              interp = std::min(std::max((9 * (c1 + c2) - (c0 + c3) + 16) >> 5, 0), 255);
+            }
+            else
+            {
+              interp = (c1 + c2 + 2) >> 2;
+            }
+          }
+          dst16_ptr[k] = uint16_t(interp << 8);
+        }
+      }
+    }  // for x
+
+    ccosts += ofs_p4;
+
+  }  // for block
+}
+
+
+
+/*
+==============================================================================
+Name: vcheck_line
+Description:
+  Vertical consistency check of an interpolated line, 4 pixels at once.
+  Gives the same results as the C++ version in eedi3.cpp. The half-pel and
+  full-pel cases share the same formula: the interpolations along the
+  direction are computed from pairs of pixels at the offsets (dir >> 1,
+  (dir + 1) >> 1) for hp=true, and (dir, dir) for hp=false. The pixels at
+  these offsets are loaded lane by lane.
+  The caller must make sure there are at least 3 readable bytes after
+  x_end on all the lines, as well as on the direction map.
+Input parameters:
+  - dst2p_ptr: The checked interpolated line 2 lines above, after its own
+    check.
+  - cur_ptr: The interpolated line to check, in the destination frame.
+    The source lines are located 1 line above and below, and the next
+    interpolated line 2 lines below, all with the same pitch.
+  - cur_pitch: Pitch of the destination frame, in bytes.
+  - src3p_ptr: The source line 3 lines above the interpolated line.
+  - src3n_ptr: The source line 3 lines below the interpolated line.
+  - scp_ptr: The corresponding line of sclip, or 0 to use a cubic
+    interpolation instead.
+  - dmap_ptr: Directions of the interpolated line. The directions of the
+    previous and next interpolated lines are located at -dmap_pitch and
+    +dmap_pitch.
+  - dmap_pitch: Pitch of the direction map, in bytes.
+  - x_beg: First pixel to process.
+  - x_end: Last pixel to process + 1.
+  - vcheck: See user documentation, > 0.
+  - vthresh0: See user documentation.
+  - vthresh1: See user documentation.
+  - vthresh2: See user documentation.
+  - hp: Directions are in half-pel units.
+Output parameters:
+  - dst_ptr: The checked line. Up to 3 bytes after x_end may be overwritten.
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Sse::vcheck_line(uint8_t *dst_ptr, const uint8_t *dst2p_ptr, const uint8_t *cur_ptr, int cur_pitch, const uint8_t *src3p_ptr, const uint8_t *src3n_ptr, const uint8_t *scp_ptr, const int8_t *dmap_ptr, int dmap_pitch, int x_beg, int x_end, int vcheck, float vthresh0, float vthresh1, float vthresh2, bool hp)
+{
+  assert(dst_ptr != 0);
+  assert(dst2p_ptr != 0);
+  assert(cur_ptr != 0);
+  assert(cur_pitch > 0);
+  assert(src3p_ptr != 0);
+  assert(src3n_ptr != 0);
+  assert(dmap_ptr != 0);
+  assert(dmap_pitch > 0);
+  assert(x_beg >= 0);
+  assert(x_beg <= x_end);
+  assert(vcheck >= 1 && vcheck <= 3);
+  assert(vthresh0 > 0);
+  assert(vthresh1 > 0);
+  assert(vthresh2 > 0);
+
+  const uint8_t* dst1p_ptr = cur_ptr - cur_pitch;
+  const uint8_t* dst1n_ptr = cur_ptr + cur_pitch;
+  const uint8_t* dst2n_ptr = cur_ptr + cur_pitch * 2;
+  const int8_t * dmapt_ptr = dmap_ptr - dmap_pitch;
+  const int8_t * dmapb_ptr = dmap_ptr + dmap_pitch;
+
+  const __m128i  zero = _mm_setzero_si128();
+  const __m128i  one = _mm_set1_epi32(1);
+  const __m128i  eight = _mm_set1_epi32(8);
+  const __m128i  c255 = _mm_set1_epi32(255);
+  const __m128i  lane = _mm_setr_epi32(0, 1, 2, 3);
+  const __m128   vt0 = _mm_set1_ps(vthresh0);
+  const __m128   vt1 = _mm_set1_ps(vthresh1);
+  const __m128   vt2 = _mm_set1_ps(vthresh2);
+  const __m128   onef = _mm_set1_ps(1.0f);
+  const __m128d  oned = _mm_set1_pd(1.0);
+
+  for (int x = x_beg; x < x_end; x += 4)
+  {
+    const __m128i  d1p = load_pix4(dst1p_ptr + x);
+    const __m128i  d1n = load_pix4(dst1n_ptr + x);
+    const __m128i  cur = load_pix4(cur_ptr + x);
+    __m128i        cint;
+    if (scp_ptr != 0)
+    {
+      cint = load_pix4(scp_ptr + x);
+    }
+    else
+    {
+      // (9 * (d1p + d1n) - (d3p + d3n) + 8) >> 4, clipped to [0 ; 255]
+      const __m128i  s1 = _mm_add_epi32(d1p, d1n);
+      const __m128i  s3 = _mm_add_epi32(load_pix4(src3p_ptr + x), load_pix4(src3n_ptr + x));
+      cint = _mm_add_epi32(_mm_slli_epi32(s1, 3), s1);
+      cint = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(cint, s3), eight), 4);
+      cint = _mm_min_epi16(_mm_max_epi16(cint, zero), c255);
+    }
+
+    // Pixels keeping the cubic interpolation: no direction, directions
+    // above and below both zero, or both opposite to the current one.
+    // Lanes after x_end get a zero direction too.
+    const __m128i  valid = _mm_cmpgt_epi32(_mm_set1_epi32(x_end - x), lane);
+    const __m128i  dirc = _mm_and_si128(load_dir4_32(dmap_ptr + x), valid);
+    const __m128i  dirt = load_dir4_32(dmapt_ptr + x);
+    const __m128i  dirb = load_dir4_32(dmapb_ptr + x);
+    const __m128i  opp_t = _mm_andnot_si128(
+      _mm_cmpeq_epi32(dirt, zero), _mm_srai_epi32(_mm_xor_si128(dirc, dirt), 31)
+    );
+    const __m128i  opp_b = _mm_andnot_si128(
+      _mm_cmpeq_epi32(dirb, zero), _mm_srai_epi32(_mm_xor_si128(dirc, dirb), 31)
+    );
+    const __m128i  keep = _mm_or_si128(
+      _mm_or_si128(
+        _mm_cmpeq_epi32(dirc, zero),
+        _mm_and_si128(_mm_cmpeq_epi32(dirt, zero), _mm_cmpeq_epi32(dirb, zero))
+      ),
+      _mm_and_si128(opp_t, opp_b)
+    );
+
+    __m128i        res = cint;
+    if (_mm_movemask_epi8(keep) != 0xFFFF)
+    {
+      // Offsets of the pixel pairs
+      const __m128i  dirk = _mm_andnot_si128(keep, dirc);
+      __m128i        o0 = dirk;
+      __m128i        o1 = dirk;
+      __m128i        dircv = _mm_max_epi16(dirk, _mm_sub_epi32(zero, dirk));
+      if (hp)
+      {
+        o0 = _mm_srai_epi32(dirk, 1);
+        o1 = _mm_srai_epi32(_mm_add_epi32(dirk, one), 1);
+        dircv = _mm_srai_epi32(dircv, 1);
+      }
+      int32_t        o0_arr [4];
+      int32_t        o1_arr [4];
+      _mm_storeu_si128(reinterpret_cast <__m128i *> (o0_arr), o0);
+      _mm_storeu_si128(reinterpret_cast <__m128i *> (o1_arr), o1);
+
+      // Pair sums + 1
+      int32_t        pa2p_arr [4];
+      int32_t        pa1p_arr [4];
+      int32_t        pa0_arr [4];
+      int32_t        ps0_arr [4];
+      int32_t        ps1n_arr [4];
+      int32_t        ps2n_arr [4];
+      for (int k = 0; k < 4; ++k)
+      {
+        const int      xp0 = x + k + o0_arr [k];
+        const int      xp1 = x + k + o1_arr [k];
+        const int      xn0 = x + k - o0_arr [k];
+        const int      xn1 = x + k - o1_arr [k];
+        pa2p_arr [k] = dst2p_ptr [xp0] + dst2p_ptr [xp1] + 1;
+        pa1p_arr [k] = dst1p_ptr [xp0] + dst1p_ptr [xp1] + 1;
+        pa0_arr [k]  = cur_ptr [xp0]   + cur_ptr [xp1]   + 1;
+        ps0_arr [k]  = cur_ptr [xn0]   + cur_ptr [xn1]   + 1;
+        ps1n_arr [k] = dst1n_ptr [xn0] + dst1n_ptr [xn1] + 1;
+        ps2n_arr [k] = dst2n_ptr [xn0] + dst2n_ptr [xn1] + 1;
+      }
+      const __m128i  pa2p = _mm_loadu_si128(reinterpret_cast <const __m128i *> (pa2p_arr));
+      const __m128i  pa1p = _mm_loadu_si128(reinterpret_cast <const __m128i *> (pa1p_arr));
+      const __m128i  pa0  = _mm_loadu_si128(reinterpret_cast <const __m128i *> (pa0_arr));
+      const __m128i  ps0  = _mm_loadu_si128(reinterpret_cast <const __m128i *> (ps0_arr));
+      const __m128i  ps1n = _mm_loadu_si128(reinterpret_cast <const __m128i *> (ps1n_arr));
+      const __m128i  ps2n = _mm_loadu_si128(reinterpret_cast <const __m128i *> (ps2n_arr));
+
+      // The values are small and positive, so the 16-bit min/max operate
+      // correctly on the 32-bit lanes.
+      const __m128i  it = _mm_srai_epi32(_mm_add_epi32(pa2p, ps0), 2);
+      const __m128i  ib = _mm_srai_epi32(_mm_add_epi32(pa0, ps2n), 2);
+      const __m128i  vt = _mm_srai_epi32(
+        _mm_add_epi32(difabs32s(pa2p, pa1p), difabs32s(pa0, pa1p)), 1
+      );
+      const __m128i  vb = _mm_srai_epi32(
+        _mm_add_epi32(difabs32s(ps2n, ps1n), difabs32s(ps0, ps1n)), 1
+      );
+      const __m128i  vc = _mm_add_epi32(difabs32s(cur, d1p), difabs32s(cur, d1n));
+      const __m128i  d0 = difabs32s(it, d1p);
+      const __m128i  d1 = difabs32s(ib, d1n);
+      const __m128i  d2 = difabs32s(vt, vc);
+      const __m128i  d3 = difabs32s(vb, vc);
+      __m128i        mdiff0;
+      __m128i        mdiff1;
+      if (vcheck == 1)
+      {
+        mdiff0 = _mm_min_epi16(d0, d1);
+        mdiff1 = _mm_min_epi16(d2, d3);
+      }
+      else if (vcheck == 2)
+      {
+        mdiff0 = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(d0, d1), one), 1);
+        mdiff1 = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(d2, d3), one), 1);
+      }
+      else
+      {
+        mdiff0 = _mm_max_epi16(d0, d1);
+        mdiff1 = _mm_max_epi16(d2, d3);
+      }
+
+      const __m128   a0 = _mm_div_ps(_mm_cvtepi32_ps(mdiff0), vt0);
+      const __m128   a1 = _mm_div_ps(_mm_cvtepi32_ps(mdiff1), vt1);
+      const __m128   a2 = _mm_max_ps(
+        _mm_div_ps(_mm_sub_ps(vt2, _mm_cvtepi32_ps(dircv)), vt2),
+        _mm_setzero_ps()
+      );
+      const __m128   a = _mm_min_ps(_mm_max_ps(_mm_max_ps(a0, a1), a2), onef);
+
+      // (1 - a) * cur + a * cint, with the same mix of double and float
+      // operations as the C++ version
+      const __m128   curf = _mm_cvtepi32_ps(cur);
+      const __m128   acf = _mm_mul_ps(a, _mm_cvtepi32_ps(cint));
+      const __m128d  a_lo = _mm_cvtps_pd(a);
+      const __m128d  a_hi = _mm_cvtps_pd(_mm_movehl_ps(a, a));
+      const __m128d  r_lo = _mm_add_pd(
+        _mm_mul_pd(_mm_sub_pd(oned, a_lo), _mm_cvtps_pd(curf)),
+        _mm_cvtps_pd(acf)
+      );
+      const __m128d  r_hi = _mm_add_pd(
+        _mm_mul_pd(_mm_sub_pd(oned, a_hi), _mm_cvtps_pd(_mm_movehl_ps(curf, curf))),
+        _mm_cvtps_pd(_mm_movehl_ps(acf, acf))
+      );
+      const __m128i  blend = _mm_unpacklo_epi64(
+        _mm_cvttpd_epi32(r_lo), _mm_cvttpd_epi32(r_hi)
+      );
+      res = select(keep, cint, blend);
+    }
+
+    const __m128i  res16 = _mm_packs_epi32(res, res);
+    *reinterpret_cast <int32_t *> (dst_ptr + x) =
+      _mm_cvtsi128_si32(_mm_packus_epi16(res16, res16));
+  }
+}
+
+
+
+/*
+==============================================================================
+Name: count_combed_8bits
+Description:
+  Counts the combed pixels of a line, 16 at once. Gives the same results as
+  countCombed() in eedi3.cpp: a pixel is combed when it is above or below
+  both its vertical neighbours by more than cthresh, and when
+  |src2p + 4 * cur + src2n - 3 * (src1p + src1n)| > cthresh * 6.
+Input parameters:
+  - cnt_ptr: Counters, one for each group of 16 pixels.
+  - src2p_ptr: The line 2 lines above.
+  - src1p_ptr: The line above.
+  - cur_ptr: The line to check.
+  - src1n_ptr: The line below.
+  - src2n_ptr: The line 2 lines below.
+  - width: Number of pixels to check, multiple of 16.
+  - cthresh: Combing threshold, in [1 ; 255].
+Output parameters:
+  - cnt_ptr: Counters incremented with the combed pixels of each group.
+Throws: Nothing
+==============================================================================
+*/
+
+void	Eedi3Sse::count_combed_8bits(int cnt_ptr [], const uint8_t *src2p_ptr, const uint8_t *src1p_ptr, const uint8_t *cur_ptr, const uint8_t *src1n_ptr, const uint8_t *src2n_ptr, int width, int cthresh)
+{
+  assert(cnt_ptr != 0);
+  assert(src2p_ptr != 0);
+  assert(src1p_ptr != 0);
+  assert(cur_ptr != 0);
+  assert(src1n_ptr != 0);
+  assert(src2n_ptr != 0);
+  assert(width >= 0);
+  assert((width & 15) == 0);
+  assert(cthresh > 0);
+  assert(cthresh <= 255);
+
+  const __m128i  zero = _mm_setzero_si128();
+  const __m128i  one8 = _mm_set1_epi8(1);
+  const __m128i  thr = _mm_set1_epi8(char(cthresh));
+  const __m128i  thr6 = _mm_set1_epi16(int16_t(cthresh * 6));
+
+  for (int x = 0; x < width; x += 16)
+  {
+    const __m128i  s2p = _mm_loadu_si128(reinterpret_cast <const __m128i *> (src2p_ptr + x));
+    const __m128i  s1p = _mm_loadu_si128(reinterpret_cast <const __m128i *> (src1p_ptr + x));
+    const __m128i  cur = _mm_loadu_si128(reinterpret_cast <const __m128i *> (cur_ptr + x));
+    const __m128i  s1n = _mm_loadu_si128(reinterpret_cast <const __m128i *> (src1n_ptr + x));
+    const __m128i  s2n = _mm_loadu_si128(reinterpret_cast <const __m128i *> (src2n_ptr + x));
+
+    // Distance to the closest neighbour when both are below, or both above.
+    // At most one of them is not 0.
+    const __m128i  above = _mm_min_epu8(
+      _mm_subs_epu8(cur, s1p), _mm_subs_epu8(cur, s1n)
+    );
+    const __m128i  below = _mm_min_epu8(
+      _mm_subs_epu8(s1p, cur), _mm_subs_epu8(s1n, cur)
+    );
+    const __m128i  flat = _mm_cmpeq_epi8(
+      _mm_subs_epu8(_mm_max_epu8(above, below), thr), zero
+    );
+
+    // [1 -3 4 -3 1] filter on 16 bits, in [-1530 ; 1530]
+    const __m128i  s_lo = _mm_sub_epi16(
+      _mm_add_epi16(
+        _mm_add_epi16(_mm_unpacklo_epi8(s2p, zero), _mm_unpacklo_epi8(s2n, zero)),
+        _mm_slli_epi16(_mm_unpacklo_epi8(cur, zero), 2)
+      ),
+      _mm_mullo_epi16(
+        _mm_add_epi16(_mm_unpacklo_epi8(s1p, zero), _mm_unpacklo_epi8(s1n, zero)),
+        _mm_set1_epi16(3)
+      )
+    );
+    const __m128i  s_hi = _mm_sub_epi16(
+      _mm_add_epi16(
+        _mm_add_epi16(_mm_unpackhi_epi8(s2p, zero), _mm_unpackhi_epi8(s2n, zero)),
+        _mm_slli_epi16(_mm_unpackhi_epi8(cur, zero), 2)
+      ),
+      _mm_mullo_epi16(
+        _mm_add_epi16(_mm_unpackhi_epi8(s1p, zero), _mm_unpackhi_epi8(s1n, zero)),
+        _mm_set1_epi16(3)
+      )
+    );
+    const __m128i  a_lo = _mm_max_epi16(s_lo, _mm_sub_epi16(zero, s_lo));
+    const __m128i  a_hi = _mm_max_epi16(s_hi, _mm_sub_epi16(zero, s_hi));
+    const __m128i  big = _mm_packs_epi16(
+      _mm_cmpgt_epi16(a_lo, thr6), _mm_cmpgt_epi16(a_hi, thr6)
+    );
+
+    // Adds the 16 flags
+    const __m128i  comb = _mm_and_si128(_mm_andnot_si128(flat, big), one8);
+    const __m128i  sum = _mm_sad_epu8(comb, zero);
+    cnt_ptr [x >> 4] +=
+        _mm_cvtsi128_si32(sum)
+      + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+  }
+}
+
+
+
+/*\\\ PROTECTED \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+
+
+/*\\\ PRIVATE \\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\\*/
+
+
+
+Eedi3Sse::ScaleInt::ScaleInt(int shift)
+:	_shift(shift)
+{
+  assert(shift >= 0);
+  assert(shift <= 8);
+}
+
+
+
+uint16_t	Eedi3Sse::ScaleInt::operator () (int pix) const
+{
+  return (uint16_t(pix << _shift));
+}
+
+
+
+Eedi3Sse::ScaleFlt::ScaleFlt(float ofs)
+:	_ofs(ofs + 0.5f)
+{
+  // Nothing
+}
+
+
+
+// 1.0 is 255 on the 8-bit scale
+uint16_t	Eedi3Sse::ScaleFlt::operator () (float pix) const
+{
+  return (uint16_t(std::min(std::max(pix * 65280.f + _ofs, 0.f), 65535.f)));
+}
+
+
+
+// Pixels are scaled to 16 bits by cnv, a ScaleInt or ScaleFlt object.
+template <class T, class C>
+void	Eedi3Sse::prepare_lines_tpl(uint16_t *dst_ptr, int dst_pitch, const T *src_ptr, int src_pitch, int bpp, const C &cnv, int width, int height, int src_y, int col_h)
+{
+  assert(dst_ptr != 0);
+  assert(dst_pitch > 0);
+  assert(src_ptr != 0);
+  assert(src_pitch > 0);
+  assert(bpp > 0);
+  assert(width > 0);
+  assert(width * bpp * int(sizeof(T)) <= src_pitch);
+  assert(width + MARGIN_H * 2 <= dst_pitch);
+  assert(height > 0);
+  assert(col_h > 0);
+  assert(src_y >= 0);
+  assert(src_y <= height);
+
+  for (int y = src_y - 2; y < src_y + 2; ++y)
+  {
+    uint16_t *     dst2_ptr = dst_ptr;
+
+    for (int y2 = y; y2 < y + col_h; ++y2)
+    {
+      int            real_y = (y2 < 0) ? -1 - y2 : y2;
+      if (real_y >= height)
+      {
+        real_y = height * 2 - 1 - real_y;
+      }
+      real_y = std::max(real_y, 0);
+
+      const T *      line_ptr = reinterpret_cast <const T *> (
+        reinterpret_cast <const uint8_t *> (src_ptr) + real_y * src_pitch
+      );
+
+      for (int x = 0; x < MARGIN_H; ++x)
+      {
+        const int      src_x = std::min(MARGIN_H - 1 - x, width - 1);
+        const uint16_t pix = cnv(line_ptr[src_x * bpp]);
+        dst2_ptr[x * col_h] = pix;
+      }
+      for (int x = 0; x < width; ++x)
+      {
+        const uint16_t pix = cnv(line_ptr[x * bpp]);
+        dst2_ptr[(MARGIN_H + x) * col_h] = pix;
+      }
+      for (int x = 0; x < MARGIN_H; ++x)
+      {
+        const int      src_x = std::max(width - 1 - x, 0);
+        const uint16_t pix = cnv(line_ptr[src_x * bpp]);
+        dst2_ptr[(MARGIN_H + width + x) * col_h] = pix;
+      }
+
+      ++dst2_ptr;
+    }
+
+    dst_ptr += dst_pitch * col_h;
+  }
+}
+
+
+
+// Same as prepare_lines_tpl(), see prepare_lines_mirror_8bits()
+template <class T, class C>
+void	Eedi3Sse::prepare_lines_mirror_tpl(uint16_t *dst_ptr, int dst_pitch, const T *src_ptr, int src_pitch, int bpp, const C &cnv, int width, int height, int src_y, int col_h, int src_par, int frame_h)
+{
+  assert(dst_ptr != 0);
+  assert(dst_pitch > 0);
+  assert(src_ptr != 0);
+  assert(src_pitch > 0);
+  assert(bpp > 0);
+  assert(width > 0);
+  assert(width * bpp * int(sizeof(T)) <= src_pitch);
+  assert(width + MARGIN_H * 2 <= dst_pitch);
+  assert(height > 0);
+  assert(col_h > 0);
+  assert(src_y >= 0);
+  assert(src_y <= height);
+  assert(src_par == 0 || src_par == 1);
+  assert(frame_h >= height);
+
+  int            col_ofs [MARGIN_H * 2];
+  for (int x = 0; x < MARGIN_H; ++x)
+  {
+    col_ofs [x] = std::min(MARGIN_H - x, width - 1) * bpp;
+    col_ofs [MARGIN_H + x] = std::max(width - 2 - x, 0) * bpp;
+  }
+
+  for (int y = src_y - 2; y < src_y + 2; ++y)
+  {
+    uint16_t *     dst2_ptr = dst_ptr;
+
+    for (int y2 = y; y2 < y + col_h; ++y2)
+    {
+      const int      pad_y =
+        std::min(std::max(y2, int(-PADDED_V)), height - 1 + PADDED_V);
+      int            frame_y = src_par + pad_y * 2;
+      if (frame_y < 0)
+      {
+        frame_y = -frame_y;
+      }
+      else if (frame_y >= frame_h)
+      {
+        frame_y = frame_h * 2 - 2 - frame_y;
+      }
+      const int      real_y =
+        std::min(std::max((frame_y - src_par) >> 1, 0), height - 1);
+      const T *      line_ptr = reinterpret_cast <const T *> (
+        reinterpret_cast <const uint8_t *> (src_ptr) + real_y * src_pitch
+      );
+
+      for (int x = 0; x < MARGIN_H; ++x)
+      {
+        const uint16_t pix = cnv(line_ptr[col_ofs [x]]);
+        dst2_ptr[x * col_h] = pix;
+      }
+      for (int x = 0; x < width; ++x)
+      {
+        const uint16_t pix = cnv(line_ptr[x * bpp]);
+        dst2_ptr[(MARGIN_H + x) * col_h] = pix;
+      }
+      for (int x = 0; x < MARGIN_H; ++x)
+      {
+        const uint16_t pix = cnv(line_ptr[col_ofs [MARGIN_H + x]]);
+        dst2_ptr[(MARGIN_H + width + x) * col_h] = pix;
+      }
+
+      ++dst2_ptr;
+    }
+
+    dst_ptr += dst_pitch * col_h;
+  }
+}
+
+
+
+// Rounds the results to the bit depth of the destination, 8 bits for a
+// shift of 8.
+template <class T>
+void	Eedi3Sse::copy_result_lines_int(T *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bpp, int shift, int width, int height, int dst_y, int col_h)
+{
+  assert(dst_ptr != 0);
+  assert(dst_pitch > 0);
+  assert(src_ptr != 0);
+  assert(src_pitch > 0);
+  assert(bpp > 0);
+  assert(width > 0);
+  assert(shift >= 0);
+  assert(shift <= 8);
+  assert(width * bpp * int(sizeof(T)) <= dst_pitch);
+  assert(width <= src_pitch);
+  assert(height > 0);
+  assert(col_h > 0);
+  assert(dst_y >= 0);
+  assert(dst_y < height);
+
+  const int      rnd = (1 << shift) >> 1;
+  const int      pix_max = 0xFFFF >> shift;
+  const int      y_end = std::min(dst_y + col_h, height);
+  for (int y2 = dst_y; y2 < y_end; ++y2)
+  {
+    T *            line_ptr = reinterpret_cast <T *> (
+      reinterpret_cast <uint8_t *> (dst_ptr) + y2 * dst_pitch
+    );
+
+    for (int x = 0; x < width; ++x)
+    {
+      const uint16_t pix = src_ptr[x * col_h];
+      line_ptr[x * bpp] = T(std::min((pix + rnd) >> shift, pix_max));
+    }
+
+    ++src_ptr;
+  }
+}
+
+
+
+bool	Eedi3Sse::is_col_set(const int64_t msk8_ptr [], int col_h8)
+{
+  int64_t        acc = 0;
+  for (int k = 0; k < col_h8; ++k)
+  {
+    acc |= msk8_ptr[k];
+  }
+
+  return (acc != 0);
+}
+
+
+
+// The lines are packed so that the next row of a lane is the same source
+// line as the current row of the next lane. Therefore the middle row pair
+// (1p, 1n) of lane i is the top row pair (3p, 1p) of lane i + 1, and the
+// last lane takes it from the bottom row pair (1n, 3n) of the lane before.
+// Only the top and bottom row pairs are computed and summed over the
+// window, combine_row_pairs() rebuilds the middle one from them.
+void	Eedi3Sse::sum_nrad(__m128i &s_0, __m128i &s_1, const __m128i &zero, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n)
+{
+  assert(nrad >= 0);
+  assert(src3p != 0);
+  assert(src1p != 0);
+  assert(src1n != 0);
+  assert(src3n != 0);
+
+  __m128i        a_0;
+  __m128i        a_1;
+  __m128i        b_0;
+  __m128i        b_1;
+  sum_row_pairs(
+    a_0, a_1, b_0, b_1, zero, nrad, xl, xr,
+    src3p, src1p, src1n, src3n
+  );
+  combine_row_pairs(s_0, s_1, a_0, a_1, b_0, b_1);
+}
+
+
+
+// Slides the nrad window sums s_0 and s_1 from x - 1 to x: adds the tap
+// entering the window and removes the one leaving it. xl and xr are the
+// window centers for x, as in sum_nrad().
+void	Eedi3Sse::slide_sum_nrad(__m128i &s_0, __m128i &s_1, const __m128i &zero, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n)
+{
+  assert(nrad >= 0);
+  assert(src3p != 0);
+  assert(src1p != 0);
+  assert(src1n != 0);
+  assert(src3n != 0);
+
+  __m128i        aa_0;
+  __m128i        aa_1;
+  __m128i        ab_0;
+  __m128i        ab_1;
+  sum_row_pairs(
+    aa_0, aa_1, ab_0, ab_1, zero, 0, xl + nrad, xr + nrad,
+    src3p, src1p, src1n, src3n
+  );
+  __m128i        ra_0;
+  __m128i        ra_1;
+  __m128i        rb_0;
+  __m128i        rb_1;
+  sum_row_pairs(
+    ra_0, ra_1, rb_0, rb_1, zero, 0, xl - 1 - nrad, xr - 1 - nrad,
+    src3p, src1p, src1n, src3n
+  );
+
+  // The combination is linear, we can apply it to the difference.
+  __m128i        d_0;
+  __m128i        d_1;
+  combine_row_pairs(
+    d_0, d_1,
+    _mm_sub_epi32(aa_0, ra_0), _mm_sub_epi32(aa_1, ra_1),
+    _mm_sub_epi32(ab_0, rb_0), _mm_sub_epi32(ab_1, rb_1)
+  );
+
+  s_0 = _mm_add_epi32(s_0, d_0);
+  s_1 = _mm_add_epi32(s_1, d_1);
+}
+
+
+
+// Sums the absolute differences of the top (a: 3p-1p) and bottom (b: 1n-3n)
+// row pairs over the window.
+void	Eedi3Sse::sum_row_pairs(__m128i &a_0, __m128i &a_1, __m128i &b_0, __m128i &b_1, const __m128i &zero, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n)
+{
+  assert(nrad >= 0);
+  assert(src3p != 0);
+  assert(src1p != 0);
+  assert(src1n != 0);
+  assert(src3n != 0);
+
+  a_0 = zero;
+  a_1 = zero;
+  b_0 = zero;
+  b_1 = zero;
+  for (int k = -nrad; k <= nrad; ++k)
+  {
+    const int      xrk = xr + k;
+    const int      xlk = xl + k;
+    const __m128i  x3pr = _mm_load_si128(src3p + xrk);
+    const __m128i  x1pl = _mm_load_si128(src1p + xlk);
+    const __m128i  x1nr = _mm_load_si128(src1n + xrk);
+    const __m128i  x3nl = _mm_load_si128(src3n + xlk);
+
+    const __m128i  d3p1p = difabs16(x3pr, x1pl);
+    const __m128i  d1n3n = difabs16(x1nr, x3nl);
+
+    a_0 = _mm_add_epi32(a_0, _mm_unpacklo_epi16(d3p1p, zero));
+    a_1 = _mm_add_epi32(a_1, _mm_unpackhi_epi16(d3p1p, zero));
+    b_0 = _mm_add_epi32(b_0, _mm_unpacklo_epi16(d1n3n, zero));
+    b_1 = _mm_add_epi32(b_1, _mm_unpackhi_epi16(d1n3n, zero));
+  }
+}
+
+
+
+// s = a + b + m, m being made of the lanes 1 to 7 of a followed by the
+// lane 6 of b.
+void	Eedi3Sse::combine_row_pairs(__m128i &s_0, __m128i &s_1, const __m128i &a_0, const __m128i &a_1, const __m128i &b_0, const __m128i &b_1)
+{
+  const __m128i  m_0 = _mm_or_si128(
+    _mm_srli_si128(a_0, 4),
+    _mm_slli_si128(a_1, 12)
+  );
+  const __m128i  m_1 = _mm_or_si128(
+    _mm_srli_si128(a_1, 4),
+    _mm_slli_si128(_mm_srli_si128(b_1, 8), 12)
+  );
+
+  s_0 = _mm_add_epi32(_mm_add_epi32(a_0, b_0), m_0);
+  s_1 = _mm_add_epi32(_mm_add_epi32(a_1, b_1), m_1);
+}
+
+
+
+// Fixed-point connection cost for 4 lines, see quantize_costs().
+// s is the window SAD on the 16-bit scale (256 times the 8-bit one), v is
+// the sum of the differences with the interpolated pixel, as computed
+// from the packed data: 128 times v2. Both fit in 16 bits once scaled
+// back, so a single multiply-add does ka * s + kc * v2. With more than 8
+// bits per sample, the low bits of v are not 0 and must not reach the s
+// half of the lane.
+// kac contains kc in the upper 16 bits and ka in the lower ones, cc_b is
+// kb * |u|.
+__m128i	Eedi3Sse::conn_cost_fixed(const __m128i &s, const __m128i &v, const __m128i &kac, const __m128i &cc_b)
+{
+  const __m128i  sv = _mm_or_si128(_mm_srli_epi32(s, 8), _mm_slli_epi32(_mm_srli_epi32(v, 7), 16));
+
+  return (_mm_add_epi32(_mm_madd_epi16(sv, kac), cc_b));
+}
+
+
+
+// Path cost recursion for a column of 4 lines.
+// The candidates of a state u are the states u-1, u and u+1 of the
+// previous pixel, the side ones with the gamma penalty. They are read at
+// fixed offsets and their directions are stepped along u in vectors,
+// so there is no inner loop or scalar broadcast per state. The side
+// candidates are skipped only at the ends of the u range, where they fall
+// outside the range of the previous pixel. The candidates are evaluated
+// in the same order as the C++ version to get the same ties.
+void	Eedi3Sse::path_cost(float *pT, int8_t *piT, const float *ppT, const float *tT, int x, int width, int mdis, float gamma16)
+{
+  assert(pT != 0);
+  assert(piT != 0);
+  assert(ppT != 0);
+  assert(tT != 0);
+  assert(x > 0);
+  assert(x < width);
+  assert(mdis > 0);
+  assert(gamma16 >= 0);
+
+  const __m128   fltmax = _mm_set1_ps(FLT_MAX);
+  const __m128   fltmax9 = _mm_set1_ps(FLT_MAX * 0.9f);
+  const __m128   pen = _mm_set1_ps(gamma16);
+  const __m128i  one = _mm_set1_epi32(1);
+  const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+  const int      umax2 = std::min(std::min(x - 1, width - x), mdis);
+  __m128i        dir_l = _mm_set1_epi32(-umax - 1);
+  for (int u = -umax; u <= umax; ++u)
+  {
+    const int      mu = (mdis + u) * VECTSIZE;
+    const float *  ppT_u = ppT + mu;
+    const __m128i  dir_c = _mm_add_epi32(dir_l, one);
+    __m128         bval = fltmax;
+    __m128i        idx = _mm_setzero_si128();
+    if (u > -umax2)
+    {
+      // Always taken: bval is above any clipped cost
+      bval = _mm_min_ps(_mm_add_ps(_mm_load_ps(ppT_u - VECTSIZE), pen), fltmax9);
+      idx = dir_l;
+    }
+    if (std::abs(u) <= umax2)
+    {
+      const __m128   ccost = _mm_min_ps(_mm_load_ps(ppT_u), fltmax9);
+      idx = select(_mm_castps_si128(_mm_cmplt_ps(ccost, bval)), dir_c, idx);
+      bval = _mm_min_ps(ccost, bval);
+    }
+    if (u < umax2)
+    {
+      const __m128   ccost = _mm_min_ps(_mm_add_ps(_mm_load_ps(ppT_u + VECTSIZE), pen), fltmax9);
+      idx = select(_mm_castps_si128(_mm_cmplt_ps(ccost, bval)), _mm_add_epi32(dir_c, one), idx);
+      bval = _mm_min_ps(ccost, bval);
+    }
+    dir_l = dir_c;
+
+    __m128         y = _mm_add_ps(bval, _mm_load_ps(tT + mu));
+    y = _mm_min_ps(y, fltmax9);
+    _mm_store_ps(pT + mu, y);
+    store_dir4(piT + mu, idx);
+  }
+
+  for (int u = umax + 1; u <= mdis; ++u)
+  {
+    _mm_store_ps(pT + (mdis - u) * VECTSIZE, fltmax9);
+    _mm_store_ps(pT + (mdis + u) * VECTSIZE, fltmax9);
+  }
+}
+
+
+
+// Fixed-point path cost recursion for a column of 4 lines, see
+// path_cost(). The path costs are kept relative to the best one, see
+// interpLineFP() in eedi3.cpp.
+void	Eedi3Sse::path_cost_fixed(int32_t *pT, int8_t *piT, const int32_t *ppT, const int32_t *tT, int x, int width, int mdis, int kg)
+{
+  assert(pT != 0);
+  assert(piT != 0);
+  assert(ppT != 0);
+  assert(tT != 0);
+  assert(x > 0);
+  assert(x < width);
+  assert(mdis > 0);
+  assert(kg >= 0);
+
+  __m128i *      pT_v = reinterpret_cast <__m128i *> (pT);
+  const __m128i* ppT_v = reinterpret_cast <const __m128i *> (ppT);
+  const __m128i* tT_v = reinterpret_cast <const __m128i *> (tT);
+
+  const __m128i  fixmax = _mm_set1_epi32(FIXED_MAX);
+  const __m128i  pen = _mm_set1_epi32(kg);
+  const __m128i  one = _mm_set1_epi32(1);
+  const int      umax = std::min(std::min(x, width - 1 - x), mdis);
+  const int      umax2 = std::min(std::min(x - 1, width - x), mdis);
+  __m128i        pmin = fixmax;
+  __m128i        dir_l = _mm_set1_epi32(-umax - 1);
+  for (int u = -umax; u <= umax; ++u)
+  {
+    const __m128i* ppT_u = ppT_v + mdis + u;
+    const __m128i  dir_c = _mm_add_epi32(dir_l, one);
+    __m128i        bval = _mm_set1_epi32(INT32_MAX);
+    __m128i        idx = _mm_setzero_si128();
+    if (u > -umax2)
+    {
+      // Always taken: bval is above any clipped cost
+      bval = select(_mm_cmplt_epi32(_mm_add_epi32(_mm_load_si128(ppT_u - 1), pen), fixmax), _mm_add_epi32(_mm_load_si128(ppT_u - 1), pen), fixmax);
+      idx = dir_l;
+    }
+    if (std::abs(u) <= umax2)
+    {
+      const __m128i  ccost = select(_mm_cmplt_epi32(_mm_load_si128(ppT_u), fixmax), _mm_load_si128(ppT_u), fixmax);
+      const __m128i  tst = _mm_cmplt_epi32(ccost, bval);
+      idx = select(tst, dir_c, idx);
+      bval = select(tst, ccost, bval);
+    }
+    if (u < umax2)
+    {
+      const __m128i  ccost = select(_mm_cmplt_epi32(_mm_add_epi32(_mm_load_si128(ppT_u + 1), pen), fixmax), _mm_add_epi32(_mm_load_si128(ppT_u + 1), pen), fixmax);
+      const __m128i  tst = _mm_cmplt_epi32(ccost, bval);
+      idx = select(tst, _mm_add_epi32(dir_c, one), idx);
+      bval = select(tst, ccost, bval);
+    }
+    dir_l = dir_c;
+
+    __m128i        y = _mm_add_epi32(bval, _mm_load_si128(tT_v + mdis + u));
+    y = select(_mm_cmplt_epi32(y, fixmax), y, fixmax);
+    _mm_store_si128(pT_v + mdis + u, y);
+    pmin = select(_mm_cmplt_epi32(y, pmin), y, pmin);
+    store_dir4(piT + (mdis + u) * VECTSIZE, idx);
+  }
+
+  for (int u = -umax; u <= umax; ++u)
+  {
+    _mm_store_si128(pT_v + mdis + u, _mm_sub_epi32(pT_v [mdis + u], pmin));
+  }
+  for (int u = umax + 1; u <= mdis; ++u)
+  {
+    _mm_store_si128(pT_v + mdis - u, fixmax);
+    _mm_store_si128(pT_v + mdis + u, fixmax);
+  }
+}
+
+
+
+__m128i	Eedi3Sse::interp_cubic8(const __m128i &src1p, const __m128i &src1n, const __m128i &src3p, const __m128i &src3n, const __m128i &nine16, const __m128i &sign16, const __m128i &cubic_cst, const __m128i &zero)
+{
+  assert(&src1p != 0);
+  assert(&src1n != 0);
+  assert(&src3p != 0);
+  assert(&src3n != 0);
+  assert(&nine16 != 0);
+  assert(&sign16 != 0);
+  assert(&cubic_cst != 0);
+  assert(&zero != 0);
+
+  const __m128i  avg1 = _mm_avg_epu16(src1p, src1n);
+  const __m128i  avg3 = _mm_avg_epu16(src3p, src3n);
+  const __m128i  a3_0 = _mm_unpacklo_epi16(avg3, zero);
+  const __m128i  a3_1 = _mm_unpackhi_epi16(avg3, zero);
+  const __m128i  hi = _mm_mulhi_epu16(avg1, nine16);
+  const __m128i  lo = _mm_mullo_epi16(avg1, nine16);
+  __m128i        s0 = _mm_unpacklo_epi16(lo, hi);
+  __m128i        s1 = _mm_unpackhi_epi16(lo, hi);
+  s0 = _mm_sub_epi32(s0, a3_0);
+  s1 = _mm_sub_epi32(s1, a3_1);
+  s0 = _mm_add_epi32(s0, cubic_cst);
+  s1 = _mm_add_epi32(s1, cubic_cst);
+  s0 = _mm_srai_epi32(s0, 3);
+  s1 = _mm_srai_epi32(s1, 3);
+  __m128i        res = _mm_packs_epi32(s0, s1);
+  res = _mm_xor_si128(res, sign16);
+
+  return (res);
+}
+
+
+
+// src13p and src13n are made of:
+// - 4 int16 from 1p/1n in the lowest 64 bits, and
+// - 4 int16 from 3p/3n in the highest 64 bits.
+// Result is packed in the lowest 64 bits, highest 64 bits are garbage.
+__m128i	Eedi3Sse::interp_cubic4(const __m128i &src13p, const __m128i &src13n, const __m128i &nine16, const __m128i &sign16, const __m128i &cubic_cst, const __m128i &zero)
+{
+  assert(&src13p != 0);
+  assert(&src13n != 0);
+  assert(&nine16 != 0);
+  assert(&sign16 != 0);
+  assert(&cubic_cst != 0);
+  assert(&zero != 0);
+
+  const __m128i  avg = _mm_avg_epu16(src13p, src13n);
+  const __m128i  a3 = _mm_unpackhi_epi16(avg, zero);
+  const __m128i  hi = _mm_mulhi_epu16(avg, nine16);
+  const __m128i  lo = _mm_mullo_epi16(avg, nine16);
+  __m128i        s = _mm_unpacklo_epi16(lo, hi);
+  s = _mm_sub_epi32(s, a3);
+  s = _mm_add_epi32(s, cubic_cst);
+  s = _mm_srai_epi32(s, 3);
+  __m128i        res = _mm_packs_epi32(s, zero);
+  res = _mm_xor_si128(res, sign16);
+
+  return (res);
+}
+
+
+
+// Same as expand_mask(), but each line of the columns is expanded separately,
+// like the C++ code does. Results are 0 or 0xFF, in the packed mask layout.
+void	Eedi3Sse::expand_mask_lanes(uint8_t dst_ptr[], const uint8_t msk_ptr[], int width, int mdis, int col_h)
+{
+  assert(dst_ptr != 0);
+  assert(msk_ptr != 0);
+  assert(width > 0);
+  assert(mdis > 0);
+  assert(col_h > 0);
+
+  const int      minmdis = (width < mdis) ? width : mdis;
+
+  for (int lane = 0; lane < col_h; ++lane)
+  {
+    int            last = -666999;
+
+    for (int x = 0; x < minmdis; ++x)
+    {
+      if (msk_ptr[x * col_h + lane] != 0)
+      {
+        last = x + mdis;
+      }
+    }
+
+    for (int x = 0; x < width - minmdis; ++x)
+    {
+      if (msk_ptr[(x + mdis) * col_h + lane] != 0)
+      {
+        last = x + mdis * 2;
+      }
+      dst_ptr[x * col_h + lane] = (x <= last) ? 0xFF : 0;
+    }
+
+    for (int x = width - minmdis; x < width; ++x)
+    {
+      dst_ptr[x * col_h + lane] = (x <= last) ? 0xFF : 0;
+    }
+  }
+}
+
+
+
+// Expands the line mask of a block of 4 lines (as produced by
+// expand_mask_lanes()) to 32-bit lanes.
+__m128i	Eedi3Sse::lane_mask(const uint8_t lmask_ptr[], int x, int block)
+{
+  int32_t        m;
+  memcpy(&m, lmask_ptr + x * COL_H + block * VECTSIZE, sizeof(m));
+  __m128i        v = _mm_cvtsi32_si128(m);
+  v = _mm_unpacklo_epi8(v, v);
+  v = _mm_unpacklo_epi16(v, v);
+
+  return (v);
+}
+
+
+
+// Returns the 8-bit value of a pixel from a packed line.
+int	Eedi3Sse::pix8(const __m128i *row_ptr, int x, int lane)
+{
+  return (reinterpret_cast <const uint16_t *> (row_ptr + x) [lane] >> 8);
+}
+
+
+
+// Stores 4 directions (32-bit signed int) as bytes.
+void	Eedi3Sse::store_dir4(int8_t *dst_ptr, const __m128i &dir)
+{
+  assert(dst_ptr != 0);
+
+  __m128i        d = _mm_packs_epi32(dir, dir);
+  d = _mm_packs_epi16(d, d);
+  *reinterpret_cast <int32_t *> (dst_ptr) = _mm_cvtsi128_si32(d);
+}
+
+
+
+// Loads 4 directions stored as bytes and returns them as 16-bit signed int
+// in the lower half of the vector. The upper half is cleared.
+__m128i	Eedi3Sse::load_dir4(const int8_t *src_ptr)
+{
+  assert(src_ptr != 0);
+
+  const __m128i  d =
+    _mm_cvtsi32_si128(*reinterpret_cast <const int32_t *> (src_ptr));
+
+  return (_mm_srai_epi16(_mm_unpacklo_epi8(d, d), 8));
+}
+
+
+
+// Loads 4 consecutive 8-bit pixels and returns them as 32-bit int.
+__m128i	Eedi3Sse::load_pix4(const uint8_t *src_ptr)
+{
+  assert(src_ptr != 0);
+
+  const __m128i  zero = _mm_setzero_si128();
+  const __m128i  p =
+    _mm_cvtsi32_si128(*reinterpret_cast <const int32_t *> (src_ptr));
+
+  return (_mm_unpacklo_epi16(_mm_unpacklo_epi8(p, zero), zero));
+}
+
+
+
+// Loads 4 directions stored as bytes and returns them as 32-bit signed int.
+__m128i	Eedi3Sse::load_dir4_32(const int8_t *src_ptr)
+{
+  assert(src_ptr != 0);
+
+  const __m128i  d = load_dir4(src_ptr);
+
+  return (_mm_srai_epi32(_mm_unpacklo_epi16(d, d), 16));
+}
+
+
+
+// |a - b| on 32-bit lanes, for a and b in [0 ; 32767]
+__m128i	Eedi3Sse::difabs32s(const __m128i &a, const __m128i &b)
+{
+  return (_mm_max_epi16(_mm_sub_epi32(a, b), _mm_sub_epi32(b, a)));
 }
 
 
@@ -48,14 +48,31 @@ public:
 	enum {         VECTSIZE =  4 };  // Vector size for internal processing (32-bit data)
 	enum {         COL_H    = VECTSIZE * 2 }; // Number of simultaneously processed lines (vector size at the API level).
 	enum {         MARGIN_H = 12 };  // Left and right margins for the virtual source frame
+	enum {         PADDED_V =  2 };  // Number of padding lines above and below the field, for prepare_lines_mirror_8bits()
+	enum {         HPEL_MARGIN = 4 }; // Left and right margins for the half-pel lines, > nrad
+	enum {         FIXED_BITS = 8 }; // Fractional bits of the fixed-point cost parameters
+	enum {         FIXED_MAX = 1 << 30 }; // Fixed-point cost saturation, counterpart of FLT_MAX * 0.9
+	enum {         FIXED_GMAX = 1 << 24 }; // Maximum fixed-point gamma
 
 	virtual        ~Eedi3Sse () {}
 
-	static void    prepare_lines_8bits (uint16_t *dst_ptr, int dst_pitch, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y);
-	static void    prepare_mask_8bits (uint8_t *dst_ptr, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y);
-	static void    copy_result_lines_8bits (uint8_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bpp, int width, int height, int dst_y);
-	static void    copy_result_dmap (int16_t *dst_ptr, int dst_pitch, const int16_t *src_ptr, int src_pitch, int width, int height, int dst_y);
-	static void    interp_lines_full_pel (const __m128i *src_ptr, __m128i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m128i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3);
+	static void    prepare_lines_8bits (uint16_t *dst_ptr, int dst_pitch, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y, int col_h);
+	static void    prepare_lines_mirror_8bits (uint16_t *dst_ptr, int dst_pitch, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y, int col_h, int src_par, int frame_h);
+	static void    prepare_lines_16bits (uint16_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bits, int width, int height, int src_y, int col_h);
+	static void    prepare_lines_mirror_16bits (uint16_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bits, int width, int height, int src_y, int col_h, int src_par, int frame_h);
+	static void    prepare_lines_float (uint16_t *dst_ptr, int dst_pitch, const float *src_ptr, int src_pitch, float ofs, int width, int height, int src_y, int col_h);
+	static void    prepare_lines_mirror_float (uint16_t *dst_ptr, int dst_pitch, const float *src_ptr, int src_pitch, float ofs, int width, int height, int src_y, int col_h, int src_par, int frame_h);
+	static void    quantize_float (uint16_t *dst_ptr, const float *src_ptr, int width, float ofs);
+	static void    prepare_mask_8bits (uint8_t *dst_ptr, const uint8_t *src_ptr, int src_pitch, int bpp, int width, int height, int src_y, int col_h);
+	static void    copy_result_lines_8bits (uint8_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bpp, int width, int height, int dst_y, int col_h);
+	static void    copy_result_lines_16bits (uint16_t *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bits, int width, int height, int dst_y, int col_h);
+	static void    copy_result_dmap (int8_t *dst_ptr, int dst_pitch, const int16_t *src_ptr, int src_pitch, int width, int height, int dst_y, int col_h);
+	static void    expand_mask (bool dst_ptr [], const uint8_t msk_ptr [], int width, int mdis, int col_h);
+	static void    quantize_costs (int &ka, int &kb, int &kc, int &kg, float alpha, float beta, float gamma, bool cost3);
+	static void    interp_lines_full_pel (const __m128i *src_ptr, __m128i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m128i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3, bool fixed, int bits);
+	static void    interp_lines_half_pel (const __m128i *src_ptr, __m128i *dst_ptr, const uint8_t *msk_ptr, uint8_t *tmp_ptr, __m128i *dmap_ptr, int width, int pitch, float alpha, float beta, float gamma, int nrad, int mdis, bool ucubic, bool cost3);
+	static void    vcheck_line (uint8_t *dst_ptr, const uint8_t *dst2p_ptr, const uint8_t *cur_ptr, int cur_pitch, const uint8_t *src3p_ptr, const uint8_t *src3n_ptr, const uint8_t *scp_ptr, const int8_t *dmap_ptr, int dmap_pitch, int x_beg, int x_end, int vcheck, float vthresh0, float vthresh1, float vthresh2, bool hp);
+	static void    count_combed_8bits (int cnt_ptr [], const uint8_t *src2p_ptr, const uint8_t *src1p_ptr, const uint8_t *cur_ptr, const uint8_t *src1n_ptr, const uint8_t *src2n_ptr, int width, int cthresh);
 
 
 
@@ -69,14 +86,71 @@ protected:
 
 private:
 
-	static void    expand_mask (bool dst_ptr [], const uint8_t msk_ptr [], int width, int mdis);
+	// Scaling of the pixels to 16 bits for prepare_lines_tpl()
+	class ScaleInt
+	{
+	public:
+		explicit       ScaleInt (int shift);
+		inline uint16_t
+		               operator () (int pix) const;
+	private:
+		int            _shift;
+	};
+	class ScaleFlt
+	{
+	public:
+		explicit       ScaleFlt (float ofs);
+		inline uint16_t
+		               operator () (float pix) const;
+	private:
+		float          _ofs;	// Includes the rounding
+	};
+
+	template <class T, class C>
+	static void    prepare_lines_tpl (uint16_t *dst_ptr, int dst_pitch, const T *src_ptr, int src_pitch, int bpp, const C &cnv, int width, int height, int src_y, int col_h);
+	template <class T, class C>
+	static void    prepare_lines_mirror_tpl (uint16_t *dst_ptr, int dst_pitch, const T *src_ptr, int src_pitch, int bpp, const C &cnv, int width, int height, int src_y, int col_h, int src_par, int frame_h);
+	template <class T>
+	static void    copy_result_lines_int (T *dst_ptr, int dst_pitch, const uint16_t *src_ptr, int src_pitch, int bpp, int shift, int width, int height, int dst_y, int col_h);
+
+	static __forceinline bool
+	               is_col_set (const int64_t msk8_ptr [], int col_h8);
 	static __forceinline void
 	               sum_nrad (__m128i &s_0, __m128i &s_1, const __m128i &zero, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n);
+	static __forceinline void
+	               slide_sum_nrad (__m128i &s_0, __m128i &s_1, const __m128i &zero, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n);
+	static __forceinline void
+	               sum_row_pairs (__m128i &a_0, __m128i &a_1, __m128i &b_0, __m128i &b_1, const __m128i &zero, int nrad, int xl, int xr, const __m128i *src3p, const __m128i *src1p, const __m128i *src1n, const __m128i *src3n);
+	static __forceinline void
+	               combine_row_pairs (__m128i &s_0, __m128i &s_1, const __m128i &a_0, const __m128i &a_1, const __m128i &b_0, const __m128i &b_1);
+	static __forceinline __m128i
+	               conn_cost_fixed (const __m128i &s, const __m128i &v, const __m128i &kac, const __m128i &cc_b);
+	static __forceinline void
+	               path_cost (float *pT, int8_t *piT, const float *ppT, const float *tT, int x, int width, int mdis, float gamma16);
+	static __forceinline void
+	               path_cost_fixed (int32_t *pT, int8_t *piT, const int32_t *ppT, const int32_t *tT, int x, int width, int mdis, int kg);
 	static __forceinline __m128i
 	               interp_cubic8 (const __m128i &src1p, const __m128i &src1n, const __m128i &src3p, const __m128i &src3n, const __m128i &nine16, const __m128i &sign16, const __m128i &cubic_cst, const __m128i &zero);
 	static __forceinline __m128i
 	               interp_cubic4 (const __m128i &src13p, const __m128i &src13n, const __m128i &nine16, const __m128i &sign16, const __m128i &cubic_cst, const __m128i &zero);
 
+	static void    expand_mask_lanes (uint8_t dst_ptr [], const uint8_t msk_ptr [], int width, int mdis, int col_h);
+	static __forceinline __m128i
+	               lane_mask (const uint8_t lmask_ptr [], int x, int block);
+	static __forceinline int
+	               pix8 (const __m128i *row_ptr, int x, int lane);
+
+	static __forceinline void
+	               store_dir4 (int8_t *dst_ptr, const __m128i &dir);
+	static __forceinline __m128i
+	               load_dir4 (const int8_t *src_ptr);
+	static __forceinline __m128i
+	               load_dir4_32 (const int8_t *src_ptr);
+	static __forceinline __m128i
+	               load_pix4 (const uint8_t *src_ptr);
+	static __forceinline __m128i
+	               difabs32s (const __m128i &a, const __m128i &b);
+
 	static __forceinline __m128i
 	               select (const __m128i &cond, const __m128i &v_t, const __m128i &v_f);
 
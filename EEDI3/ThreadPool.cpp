@@ -0,0 +1,206 @@
+/*
+**   Persistent pool of worker threads.
+**
+**   This program is free software; you can redistribute it and/or modify
+**   it under the terms of the GNU General Public License as published by
+**   the Free Software Foundation; either version 2 of the License, or
+**   (at your option) any later version.
+**
+**   This program is distributed in the hope that it will be useful,
+**   but WITHOUT ANY WARRANTY; without even the implied warranty of
+**   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**   GNU General Public License for more details.
+**
+**   You should have received a copy of the GNU General Public License
+**   along with this program; if not, write to the Free Software
+**   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "ThreadPool.h"
+#include <process.h>
+#include <limits.h>
+
+ThreadPool::ThreadPool(int nbr_threads)
+  : wake_sem(NULL), job_head(NULL), job_tail(NULL), quit(false)
+{
+  InitializeCriticalSection(&lock);
+  wake_sem = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+  if (wake_sem == NULL)
+    return;
+  args.resize(nbr_threads);
+  for (int i = 0; i < nbr_threads; ++i)
+  {
+    args[i].pool = this;
+    args[i].idx = i;
+    HANDLE th = (HANDLE)_beginthreadex(NULL, 0, &thread_proc, &args[i], 0, NULL);
+    if (th == NULL)
+      break;
+    threads.push_back(th);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  EnterCriticalSection(&lock);
+  quit = true;
+  LeaveCriticalSection(&lock);
+  if (!threads.empty())
+  {
+    ReleaseSemaphore(wake_sem, (LONG)threads.size(), NULL);
+    // One by one, WaitForMultipleObjects() is limited to
+    // MAXIMUM_WAIT_OBJECTS (64) handles.
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+      WaitForSingleObject(threads[i], INFINITE);
+      CloseHandle(threads[i]);
+    }
+  }
+  if (wake_sem != NULL)
+    CloseHandle(wake_sem);
+  DeleteCriticalSection(&lock);
+}
+
+bool ThreadPool::is_ok() const
+{
+  return (wake_sem != NULL && threads.size() == args.size());
+}
+
+int ThreadPool::get_nbr_threads() const
+{
+  return (int)threads.size();
+}
+
+// Queues the tasks [0 ; nbr_tasks) and waits until all of them are done.
+void ThreadPool::run(TaskFnc fnc, void *data, int nbr_tasks)
+{
+  Job job;
+  submit(job, fnc, data, nbr_tasks);
+  wait(job);
+}
+
+// Queues the tasks [0 ; nbr_tasks) and returns immediately. The tasks of the
+// jobs submitted before are started first.
+void ThreadPool::submit(Job &job, TaskFnc fnc, void *data, int nbr_tasks)
+{
+  job.fnc = fnc;
+  job.data = data;
+  job.nbr_tasks = nbr_tasks;
+  job.task_next = 0;
+  job.task_left = nbr_tasks;
+  job.done_evt = NULL;
+  job.job_next = NULL;
+  if (nbr_tasks <= 0)
+    return;
+  // Without event, wait() polls the job. The tasks are not run in the
+  // calling thread, the callers may index per-worker data with thread_idx.
+  job.done_evt = CreateEvent(NULL, FALSE, FALSE, NULL);
+  EnterCriticalSection(&lock);
+  if (job_tail == NULL)
+    job_head = &job;
+  else
+    job_tail->job_next = &job;
+  job_tail = &job;
+  LeaveCriticalSection(&lock);
+  ReleaseSemaphore(wake_sem, nbr_tasks, NULL);
+}
+
+// Removes the tasks of a submitted job which are not started yet. The
+// started tasks keep running, wait() is still required.
+void ThreadPool::cancel(Job &job)
+{
+  EnterCriticalSection(&lock);
+  const int nbr_skipped = job.nbr_tasks - job.task_next;
+  // The job is in the queue until its last task is started
+  if (nbr_skipped > 0)
+  {
+    Job *prev = NULL;
+    for (Job *cur = job_head; cur != &job; cur = cur->job_next)
+      prev = cur;
+    if (prev == NULL)
+      job_head = job.job_next;
+    else
+      prev->job_next = job.job_next;
+    if (job_tail == &job)
+      job_tail = prev;
+    job.task_next = job.nbr_tasks;
+    job.task_left -= nbr_skipped;
+    // Takes back the semaphore counts of the skipped tasks. The workers
+    // already woken up for some of them find no task and wait again.
+    int nbr_taken = 0;
+    while (nbr_taken < nbr_skipped
+      && WaitForSingleObject(wake_sem, 0) == WAIT_OBJECT_0)
+      ++nbr_taken;
+    if (job.task_left == 0 && job.done_evt != NULL)
+      SetEvent(job.done_evt);
+  }
+  LeaveCriticalSection(&lock);
+}
+
+// Waits until all the tasks of a submitted job are done.
+void ThreadPool::wait(Job &job)
+{
+  if (job.done_evt != NULL)
+  {
+    WaitForSingleObject(job.done_evt, INFINITE);
+    CloseHandle(job.done_evt);
+    job.done_evt = NULL;
+    return;
+  }
+  for (;;)
+  {
+    EnterCriticalSection(&lock);
+    const bool done_flag = (job.task_left == 0);
+    LeaveCriticalSection(&lock);
+    if (done_flag)
+      break;
+    Sleep(1);
+  }
+}
+
+unsigned __stdcall ThreadPool::thread_proc(void *arg)
+{
+  WorkerArg &wa = *reinterpret_cast <WorkerArg *> (arg);
+  wa.pool->work(wa.idx);
+  return 0;
+}
+
+// Each count of the semaphore is a task to start. The queue can only be
+// empty when a worker wakes up to quit, or for a task skipped by cancel().
+void ThreadPool::work(int idx)
+{
+  for (;;)
+  {
+    WaitForSingleObject(wake_sem, INFINITE);
+    EnterCriticalSection(&lock);
+    if (quit)
+    {
+      LeaveCriticalSection(&lock);
+      break;
+    }
+    Job *job = job_head;
+    if (job == NULL)
+    {
+      LeaveCriticalSection(&lock);
+      continue;
+    }
+    const int task = job->task_next;
+    ++job->task_next;
+    if (job->task_next == job->nbr_tasks)
+    {
+      job_head = job->job_next;
+      if (job_head == NULL)
+        job_tail = NULL;
+    }
+    LeaveCriticalSection(&lock);
+
+    job->fnc(job->data, task, idx);
+
+    EnterCriticalSection(&lock);
+    --job->task_left;
+    // A polled job can be gone once task_left is 0
+    const HANDLE done_evt = (job->task_left == 0) ? job->done_evt : NULL;
+    LeaveCriticalSection(&lock);
+    if (done_evt != NULL)
+      SetEvent(done_evt);
+  }
+}
@@ -0,0 +1,81 @@
+/*
+**   Persistent pool of worker threads. A job is a number of independent
+**   tasks, run by the workers in the order of submission. Several threads
+**   may submit jobs at the same time, their tasks are queued one after the
+**   other.
+**
+**   This program is free software; you can redistribute it and/or modify
+**   it under the terms of the GNU General Public License as published by
+**   the Free Software Foundation; either version 2 of the License, or
+**   (at your option) any later version.
+**
+**   This program is distributed in the hope that it will be useful,
+**   but WITHOUT ANY WARRANTY; without even the implied warranty of
+**   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+**   GNU General Public License for more details.
+**
+**   You should have received a copy of the GNU General Public License
+**   along with this program; if not, write to the Free Software
+**   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef __ThreadPool_H__
+#define __ThreadPool_H__
+
+#include <windows.h>
+#include <vector>
+
+class ThreadPool
+{
+public:
+  // Task function. thread_idx is the index of the worker running the task,
+  // in [0 ; number of threads).
+  typedef void (*TaskFnc)(void *data, int task, int thread_idx);
+
+  // Tasks of a job submitted without waiting. The object belongs to the
+  // caller and must stay alive until wait() returns.
+  class Job
+  {
+    friend class ThreadPool;
+  private:
+    TaskFnc fnc;
+    void *data;
+    int nbr_tasks;
+    int task_next;  // Next task to start
+    int task_left;  // Number of tasks not completed yet
+    HANDLE done_evt;
+    Job *job_next;
+  };
+
+  explicit ThreadPool(int nbr_threads);
+  ~ThreadPool();
+  bool is_ok() const;
+  int get_nbr_threads() const;
+  void run(TaskFnc fnc, void *data, int nbr_tasks);
+  void submit(Job &job, TaskFnc fnc, void *data, int nbr_tasks);
+  void cancel(Job &job);
+  void wait(Job &job);
+
+private:
+  class WorkerArg
+  {
+  public:
+    ThreadPool *pool;
+    int idx;
+  };
+
+  static unsigned __stdcall thread_proc(void *arg);
+  void work(int idx);
+
+  CRITICAL_SECTION lock;  // Protects the job queue and the Job contents
+  HANDLE wake_sem;        // Counts the tasks to start, plus the quit requests, or more after cancel()
+  Job *job_head, *job_tail; // Jobs with tasks to start
+  bool quit;
+  std::vector <HANDLE> threads;
+  std::vector <WorkerArg> args;
+
+  ThreadPool(const ThreadPool &other);
+  ThreadPool &operator =(const ThreadPool &other);
+};
+
+#endif
@@ -149,6 +149,7 @@ class SINGLE_INHERITANCE PClip;
 class SINGLE_INHERITANCE PVideoFrame;
 class IScriptEnvironment;
 class SINGLE_INHERITANCE AVSValue;
+typedef struct AVSMap AVSMap;
 
 
 /*
@@ -1246,6 +1247,23 @@ public:
   // noThrow version of GetVar
   virtual AVSValue __stdcall GetVarDef(const char* name, const AVSValue& def = AVSValue()) = 0;
 
+  // Interface V8 (AviSynth+ 3.6), first entries only. Check the host with
+  // CheckVersion(8) before calling them.
+  virtual PVideoFrame __stdcall SubframePlanarA(PVideoFrame src, int rel_offset, int new_pitch, int new_row_size,
+                                                int new_height, int rel_offsetU, int rel_offsetV, int new_pitchUV, int rel_offsetA) = 0;
+
+  virtual void __stdcall copyFrameProps(const PVideoFrame& src, PVideoFrame& dst) = 0;
+  virtual const AVSMap* __stdcall getFramePropsRO(const PVideoFrame& frame) = 0;
+  virtual AVSMap* __stdcall getFramePropsRW(PVideoFrame& frame) = 0;
+
+  virtual int __stdcall propNumKeys(const AVSMap* map) = 0;
+  virtual const char* __stdcall propGetKey(const AVSMap* map, int index) = 0;
+  virtual int __stdcall propNumElements(const AVSMap* map, const char* key) = 0;
+  virtual char __stdcall propGetType(const AVSMap* map, const char* key) = 0;
+
+  virtual __int64 __stdcall propGetInt(const AVSMap* map, const char* key, int index, int* error) = 0;
+  virtual double __stdcall propGetFloat(const AVSMap* map, const char* key, int index, int* error) = 0;
+
 }; // end class IScriptEnvironment
 
 
@@ -28,11 +28,15 @@
 eedi3::eedi3(PClip _child, int _field, bool _dh, bool _Y, bool _U, bool _V, float _alpha,
   float _beta, float _gamma, int _nrad, int _mdis, bool _hp, bool _ucubic, bool _cost3,
   int _vcheck, float _vthresh0, float _vthresh1, float _vthresh2, PClip _sclip, int _threads,
-  PClip _mclip, int opt, IScriptEnvironment *env)
+  PClip _mclip, int opt, bool _fixed, bool _tpool, int _prefetch, int _cthresh, int _mi,
+  const char *_cprop, int _rstages, IScriptEnvironment *env)
   : GenericVideoFilter(_child), field(_field), dh(_dh), Y(_Y), U(_U),
   V(_V), alpha(_alpha), beta(_beta), gamma(_gamma), nrad(_nrad), mdis(_mdis), hp(_hp),
-  ucubic(_ucubic), cost3(_cost3), vcheck(_vcheck), vthresh0(_vthresh0), vthresh1(_vthresh1),
-  vthresh2(_vthresh2), sclip(_sclip), mclip(_mclip), _sse2_flag(false)
+  ucubic(_ucubic), cost3(_cost3), fixed(_fixed), vcheck(_vcheck), vthresh0(_vthresh0), vthresh1(_vthresh1),
+  vthresh2(_vthresh2), cthresh(_cthresh), mi(_mi), cprop(_cprop), sclip(_sclip), mclip(_mclip), _sse2_flag(false),
+  _avx2_flag(false), _avx512_flag(false), _avx2_vcheck_flag(false),
+  direct_src(false), direct_dst(false), pool(0),
+  prefetch(_prefetch)
 {
   if (field < -2 || field > 3)
     env->ThrowError("eedi3:  field must be set to -2, -1, 0, 1, 2, or 3!");
@@ -54,6 +58,28 @@ eedi3::eedi3(PClip _child, int _field, bool _dh, bool _Y, bool _U, bool _V, floa
     env->ThrowError("eedi3:  0 <= vcheck <= 3!\n");
   if (vcheck > 0 && (vthresh0 <= 0.0f || vthresh1 <= 0.0f || vthresh2 <= 0.0f))
     env->ThrowError("eedi3:  0 < vthresh0 , 0 < vthresh1 , 0 < vthresh2!\n");
+  if (prefetch < 0 || prefetch > 16)
+    env->ThrowError("eedi3:  0 <= prefetch <= 16!\n");
+  if (cthresh < 0 || cthresh > 255)
+    env->ThrowError("eedi3:  0 <= cthresh <= 255!\n");
+  if (mi < 0)
+    env->ThrowError("eedi3:  0 <= mi!\n");
+  if (dh && cthresh > 0)
+    env->ThrowError("eedi3:  cthresh can't be used with dh=true!\n");
+  if (dh && cprop[0] != '\0')
+    env->ThrowError("eedi3:  cprop can't be used with dh=true!\n");
+  if (cprop[0] != '\0')
+  {
+    // The frame properties came with the interface V8
+    try
+    {
+      env->CheckVersion(8);
+    }
+    catch (const AvisynthError &)
+    {
+      env->ThrowError("eedi3:  cprop needs AviSynth+ 3.6 or later!\n");
+    }
+  }
   if (field == -2)
     field = child->GetParity(0) ? 3 : 2;
   else if (field == -1)
@@ -71,66 +97,99 @@ eedi3::eedi3(PClip _child, int _field, bool _dh, bool _Y, bool _U, bool _V, floa
     }
   }
 
-  if (opt == 2)
+  if (opt == 4)
+  {
+    _sse2_flag = true;
+    _avx2_flag = true;
+    _avx512_flag = true;
+  }
+  else if (opt == 3)
+  {
+    _sse2_flag = true;
+    _avx2_flag = true;
+  }
+  else if (opt == 2)
   {
     _sse2_flag = true;
   }
   else if (opt != 1)
   {
     _sse2_flag = ((env->GetCPUFlags() & CPUF_SSE2) != 0);
+    _avx2_flag = ((env->GetCPUFlags() & CPUF_AVX2) != 0);
+    _avx512_flag = (
+         (env->GetCPUFlags() & CPUF_AVX512F) != 0
+      && (env->GetCPUFlags() & CPUF_AVX512BW) != 0
+    );
   }
-  _sse2_flag = (_sse2_flag && !hp);	// Half-pel SSE2 not implemented yet
+  // With rstages, the intermediate planes are kept in 16 bits, so the
+  // interpolated pixels are rounded only once at the end. The 8-bit
+  // sources stay in 8 bits with hp=true, for the half-pel SIMD version.
+  bits_clip = vi.BitsPerComponent();
+  bits = (_rstages > 0 && bits_clip < 16 && !(hp && bits_clip == 8)) ? 16 : bits_clip;
+  _sse2_flag = (_sse2_flag && (bits == 8 || !hp));	// The half-pel SIMD version is 8-bit only
+  _avx2_vcheck_flag = (_avx2_flag && _sse2_flag);
+  _avx2_flag = (_avx2_flag && _sse2_flag && !hp);	// Half-pel is SSE2 only
+  _avx512_flag = (_avx512_flag && _avx2_flag);
+  // The planar formats need no conversion. The results are written to the
+  // output frames, and the SIMD versions read the source frames in place
+  // and mirror the borders themselves. Only the C++ version needs the
+  // padded copy.
+  // The passes of rstages are only used by eedi3_rpow2, without sclip,
+  // mclip or combing detection. The source is copied when its bit depth
+  // is changed, and the horizontal passes are output by copyTurned().
+  assert(_rstages == 0 || (dh && field >= 0 && field <= 1 && vi.IsPlanar()
+    && !sclip && !mclip && cthresh == 0 && cprop[0] == '\0'));
+  direct_dst = (vi.IsPlanar() && _rstages == 0);
+  direct_src = (_sse2_flag && vi.IsPlanar() && bits == bits_clip);
 
   if (field > 1)
   {
     vi.num_frames *= 2;
     vi.SetFPS(vi.fps_numerator * 2, vi.fps_denominator);
   }
-  if (dh)
-    vi.height *= 2;
-  vi.SetFieldBased(false);
-  child->SetCacheHints(CACHE_GET_RANGE, 3);
-  mcpPF = 0;
-
-  const int cpuFlags = env->GetCPUFlags();
-
-  if (mclip)
-  {
-    ::VideoInfo	vi2 = vi;
-    vi2.height /= 2;
-    mcpPF = new PlanarFrame(vi2, cpuFlags);
-  }
-  srcPF = new PlanarFrame(cpuFlags);
-  if(vi.IsY8())
-    srcPF->createPlanar(vi.height + MARGIN_V * 2, 0,
-      vi.width + MARGIN_H * 2, 0);
-  else
-    srcPF->createPlanar(vi.height + MARGIN_V * 2, (vi.IsYV12() ? (vi.height >> 1) : vi.height) + MARGIN_V * 2,
-      vi.width + MARGIN_H * 2, ((vi.IsYV24() || vi.IsRGB24()) ? vi.width : (vi.width >> 1)) + MARGIN_H * 2);
-
-  dstPF = new PlanarFrame(vi, cpuFlags);
-  scpPF = new PlanarFrame(vi, cpuFlags);
-  if (_threads > 0)
-    omp_set_num_threads(_threads);
-  const int nthreads = omp_get_max_threads();
-  workspace = (uint8_t**)calloc(nthreads, sizeof(*workspace));
-  dmapa = (int16_t*)_aligned_malloc(dstPF->GetPitch(0)*dstPF->GetHeight(0) * sizeof(*dmapa), 16);
-  if (!workspace || !dmapa)
-    env->ThrowError("eedi3:  malloc failure!\n");
-  const int tpitch = max(mdis * ((hp) ? 4 : 2) + 1, 16);
-  int workspace_size = vi.width * tpitch * 4 * sizeof(float);
-  if (_sse2_flag)
+  const int src_w = vi.width;
+  const int src_h = vi.height;
+  if (_rstages > 0)
   {
-    workspace_size = (vi.width + 2 * Eedi3Sse::MARGIN_H) * 4 * sizeof(uint16_t) * Eedi3Sse::COL_H; // src
-    workspace_size += vi.width * 2 * sizeof(int16_t) * Eedi3Sse::COL_H; // dst + dmap
-    workspace_size += (vi.width * sizeof(uint8_t) * Eedi3Sse::COL_H + 15) & -16; // mask
-    workspace_size += vi.width * tpitch * 5 * sizeof(float) * Eedi3Sse::VECTSIZE; // temp
+    vi.width <<= _rstages;
+    vi.height <<= _rstages;
   }
-  for (int i = 0; i < nthreads; ++i)
+  else if (dh)
+    vi.height *= 2;
+  vi.SetFieldBased(false);
+  // Planar RGB is processed like 4:4:4, G is the first plane
+  const int plane_yuv[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+  const int plane_rgb[3] = { PLANAR_G, PLANAR_B, PLANAR_R };
+  for (int b = 0; b < 3; ++b)
+    plane_id[b] = (vi.IsPlanarRGB()) ? plane_rgb[b] : plane_yuv[b];
+  passes.resize((_rstages > 0) ? _rstages * 2 : 1);
+  for (int p = 0; p < int(passes.size()); ++p)
   {
-    workspace[i] = (uint8_t*)_aligned_malloc(workspace_size, 16);
-    if (!workspace[i])
-      env->ThrowError("eedi3:  malloc failure!\n");
+    Pass &ps = passes[p];
+    // Output size of the pass. The first doubling keeps the field 1,
+    // then the vertical passes keep the field 0. The horizontal passes of
+    // the YUV formats always keep the field 1, to keep the chroma aligned
+    // with the luma.
+    int w = vi.width;
+    int h = vi.height;
+    ps.turn = false;
+    ps.field = field;
+    if (_rstages > 0)
+    {
+      const int stage = p >> 1;
+      ps.turn = ((p & 1) != 0);
+      w = src_w << (stage + ((ps.turn) ? 1 : 0));
+      h = src_h << (stage + 1);
+      ps.field = (stage == 0 || (ps.turn && !vi.IsPlanarRGB())) ? 1 : 0;
+    }
+    for (int b = 0; b < 3; ++b)
+    {
+      ps.plane_width[b] = (b == 0 || vi.Is444() || vi.IsRGB24() || vi.IsPlanarRGB()) ? w : (w >> 1);
+      ps.plane_height[b] = (b == 0 || !vi.Is420()) ? h : (h >> 1);
+      if (ps.turn)
+        std::swap(ps.plane_width[b], ps.plane_height[b]);
+      ps.dmap_pitch[b] = (ps.plane_width[b] + 10 + 15) & -16;
+    }
   }
   if (vcheck > 0 && sclip)
   {
@@ -141,19 +200,307 @@ eedi3::eedi3(PClip _child, int _field, bool _dh, bool _Y, bool _U, bool _V, floa
       !vi.IsSameColorspace(vi2))
       env->ThrowError("eedi3:  sclip doesn't match!\n");
   }
+  child->SetCacheHints(CACHE_GET_RANGE, 3);
+  cpuFlags = env->GetCPUFlags();
+  nthreads = (_threads > 0) ? _threads : omp_get_max_threads();
+  // The frames are processed ahead by the pool. The destructor is not
+  // called when the constructor throws, the pool is deleted before.
+  if (_tpool || prefetch > 0)
+  {
+    pool = new ThreadPool(nthreads);
+    if (!pool->is_ok())
+    {
+      delete pool;
+      pool = 0;
+      env->ThrowError("eedi3:  cannot create the thread pool!\n");
+    }
+  }
+  const int tpitch = max(mdis * ((hp) ? 4 : 2) + 1, 16);
+  int w = 0; // Widest plane
+  for (size_t p = 0; p < passes.size(); ++p)
+    w = max(w, passes[p].plane_width[0]);
+  workspace_size = w * tpitch * 4 * sizeof(float);
+  // Single pixel buffers and s0 table of interpLineFP(), fpath and masks.
+  // It also covers the margins of the half-pel lines of interpLineHP().
+  workspace_size += (tpitch * 4 + tpitch * tpitch) * sizeof(int) + 3 * w;
+  if (bits == 32)
+  {
+    // Quantized lines and dst line, see interpLineCpp<float>()
+    workspace_size += ((w + MARGIN_H * 2 + 1) * 5 * sizeof(uint16_t) + 63) & -64;
+  }
+  if (_sse2_flag)
+  {
+    const int col_h = (_avx512_flag) ? int(Eedi3Avx512::COL_H) : int(Eedi3Sse::COL_H);
+    workspace_size = (w + 2 * Eedi3Sse::MARGIN_H) * 4 * sizeof(uint16_t) * col_h; // src
+    workspace_size += w * 2 * sizeof(int16_t) * col_h; // dst + dmap
+    workspace_size += (w * sizeof(uint8_t) * col_h + 15) & -16; // mask
+    if (hp)
+    {
+      workspace_size += w * ((tpitch * 3 * sizeof(float) + tpitch + 1) * Eedi3Sse::VECTSIZE + 1 + Eedi3Sse::COL_H); // temp
+      workspace_size += (w + 2 * Eedi3Sse::HPEL_MARGIN) * 4 * sizeof(uint16_t) * Eedi3Sse::COL_H; // half-pel lines
+      workspace_size += tpitch * Eedi3Sse::COL_H * sizeof(int32_t); // nrad window sums
+    }
+    else
+    {
+      // temp, same for all the full-pel versions
+      workspace_size += w * ((tpitch + 1) * sizeof(int8_t) * col_h + 2); // backtrack + final path + masks
+      workspace_size += (tpitch + 4) * tpitch * sizeof(float) * col_h + 63; // single column buffers + s0 table
+    }
+  }
+  InitializeCriticalSection(&ctx_lock);
+  InitializeCriticalSection(&pf_lock);
+  // Each request needs a context, plus one for the companion frame in
+  // double rate mode. The prefetched frames have their own ones.
+  ctx_max = prefetch + MAX_REQUESTS * ((field > 1) ? 2 : 1);
+  ctx_evt = CreateEvent(NULL, FALSE, FALSE, NULL);
+  bool ok_flag = (ctx_evt != NULL);
+  if (pool)
+  {
+    worker_ws.assign(nthreads, 0);
+    for (int i = 0; i < nthreads && ok_flag; ++i)
+    {
+      worker_ws[i] = (uint8_t*)_aligned_malloc(workspace_size, 64);
+      ok_flag = (worker_ws[i] != 0);
+    }
+  }
+  // A first context, so the allocation failures are reported here
+  FrameContext *ctx = (ok_flag) ? createContext() : 0;
+  if (!ctx)
+  {
+    delete pool;
+    pool = 0;
+    for (size_t i = 0; i < worker_ws.size(); ++i)
+      _aligned_free(worker_ws[i]);
+    if (ctx_evt != NULL)
+      CloseHandle(ctx_evt);
+    DeleteCriticalSection(&ctx_lock);
+    DeleteCriticalSection(&pf_lock);
+    env->ThrowError("eedi3:  malloc failure!\n");
+  }
+  ctx_pool.push_back(ctx);
+  ctx_count = 1;
 }
 
 eedi3::~eedi3()
 {
-  delete srcPF;
-  delete dstPF;
-  delete scpPF;
-  delete mcpPF;
-  const int nthreads = omp_get_num_threads();
-  for (int i = 0; i < nthreads; ++i)
-    _aligned_free(workspace[i]);
-  free(workspace);
-  _aligned_free(dmapa);
+  for (size_t i = 0; i < pf_list.size(); ++i)
+    dropFrame(pf_list[i]);
+  delete pool;
+  for (size_t i = 0; i < ctx_pool.size(); ++i)
+    deleteContext(ctx_pool[i]);
+  for (size_t i = 0; i < worker_ws.size(); ++i)
+    _aligned_free(worker_ws[i]);
+  CloseHandle(ctx_evt);
+  DeleteCriticalSection(&ctx_lock);
+  DeleteCriticalSection(&pf_lock);
+}
+
+// Returns 0 on allocation failure
+eedi3::FrameContext *eedi3::createContext()
+{
+  FrameContext *ctx = new FrameContext;
+  // The padded source is in bytes, the masks have a byte per pixel
+  // whatever the bit depth. The planes of the passes are in the processed
+  // format, which can be wider than the clip with rstages.
+  const int csize = (bits + 7) >> 3;
+  ctx->mcpPF = 0;
+  if (mclip || cthresh > 0)
+  {
+    ctx->mcpPF = new PlanarFrame(cpuFlags);
+    if (vi.IsY())
+      ctx->mcpPF->createPlanar(vi.height >> 1, 0, vi.width, 0);
+    else
+      ctx->mcpPF->createPlanar(vi.height >> 1, passes[0].plane_height[1] >> 1,
+        vi.width, passes[0].plane_width[1]);
+  }
+  const int npasses = int(passes.size());
+  ctx->srcPF.assign(npasses, 0);
+  ctx->dstPF.assign(npasses, 0);
+  int dmap_size = 0;
+  int vcl_size = 0;
+  int vcd_size = 0;
+  for (int p = 0; p < npasses; ++p)
+  {
+    const Pass &ps = passes[p];
+    if (p > 0 || !direct_src)
+    {
+      ctx->srcPF[p] = new PlanarFrame(cpuFlags);
+      if (vi.IsY())
+        ctx->srcPF[p]->createPlanar(ps.plane_height[0] + MARGIN_V * 2, 0,
+          (ps.plane_width[0] + MARGIN_H * 2) * csize, 0);
+      else
+        ctx->srcPF[p]->createPlanar(ps.plane_height[0] + MARGIN_V * 2, ps.plane_height[1] + MARGIN_V * 2,
+          (ps.plane_width[0] + MARGIN_H * 2) * csize, (ps.plane_width[1] + MARGIN_H * 2) * csize);
+    }
+    if (npasses > 1)
+    {
+      ctx->dstPF[p] = new PlanarFrame(cpuFlags);
+      if (vi.IsY())
+        ctx->dstPF[p]->createPlanar(ps.plane_height[0], 0, ps.plane_width[0] * csize, 0);
+      else
+        ctx->dstPF[p]->createPlanar(ps.plane_height[0], ps.plane_height[1],
+          ps.plane_width[0] * csize, ps.plane_width[1] * csize);
+    }
+    else if (!direct_dst)
+      ctx->dstPF[p] = new PlanarFrame(vi, cpuFlags);
+    int dms = 0;
+    int vls = 0;
+    int vds = 0;
+    for (int b = 0; b < 3; ++b)
+    {
+      dms += ps.dmap_pitch[b] * ps.plane_height[b];
+      vls += ps.dmap_pitch[b];
+      vds += ps.plane_height[b];
+    }
+    dmap_size = max(dmap_size, dms);
+    vcl_size = max(vcl_size, vls);
+    vcd_size = max(vcd_size, vds);
+  }
+  // sclip is read in place for the planar formats
+  ctx->scpPF = 0;
+  if (!direct_dst && sclip)
+    ctx->scpPF = new PlanarFrame(vi, cpuFlags);
+
+  // With the pool, the work zones are the ones of the workers
+  const int nws = (pool) ? 0 : nthreads;
+  ctx->workspace = (uint8_t**)calloc(max(nws, 1), sizeof(*ctx->workspace));
+  ctx->dmapa = (int8_t*)_aligned_malloc(dmap_size * sizeof(*ctx->dmapa), 16);
+  // The SIMD vcheck reads and writes up to 9 bytes after the line, the
+  // pitch has this padding.
+  ctx->vcline = (uint8_t*)_aligned_malloc(vcl_size * csize, 16);
+  ctx->vcdone = (uint8_t*)malloc(vcd_size);
+  ctx->weave_flag = false;
+  ctx->pf_n = -1;
+  ctx->ready_evt = CreateEvent(NULL, TRUE, TRUE, NULL);
+  ctx->failed_flag = false;
+  ctx->cmap = 0;
+  ctx->ccnt = 0;
+  if (cthresh > 0)
+  {
+    // Blocks of 16x16 pixels, 16 bytes of a row are counted together
+    const int nbx = (vi.width + 15) >> 4;
+    const int nby = (vi.height + 15) >> 4;
+    ctx->cmap = (uint8_t*)malloc(nbx * nby * 2);
+    ctx->ccnt = (int*)malloc(nbx * 3 * nthreads * sizeof(*ctx->ccnt));
+  }
+  if (!ctx->workspace || !ctx->dmapa || !ctx->vcline || !ctx->vcdone || !ctx->ready_evt
+    || (cthresh > 0 && (!ctx->cmap || !ctx->ccnt)))
+  {
+    deleteContext(ctx);
+    return 0;
+  }
+  for (int i = 0; i < nws; ++i)
+  {
+    ctx->workspace[i] = (uint8_t*)_aligned_malloc(workspace_size, 64);
+    if (!ctx->workspace[i])
+    {
+      deleteContext(ctx);
+      return 0;
+    }
+  }
+  return ctx;
+}
+
+void eedi3::deleteContext(FrameContext *ctx)
+{
+  for (size_t p = 0; p < ctx->srcPF.size(); ++p)
+  {
+    delete ctx->srcPF[p];
+    delete ctx->dstPF[p];
+  }
+  delete ctx->scpPF;
+  delete ctx->mcpPF;
+  if (ctx->workspace && !pool)
+  {
+    for (int i = 0; i < nthreads; ++i)
+      _aligned_free(ctx->workspace[i]);
+  }
+  free(ctx->workspace);
+  _aligned_free(ctx->dmapa);
+  _aligned_free(ctx->vcline);
+  free(ctx->vcdone);
+  free(ctx->cmap);
+  free(ctx->ccnt);
+  if (ctx->ready_evt)
+    CloseHandle(ctx->ready_evt);
+  delete ctx;
+}
+
+// Takes a context from the pool, or creates a new one when all of them are
+// used by other GetFrame calls. With ctx_max contexts, the prefetched frame
+// farthest from n is dropped, or the call waits for a context. Only the
+// calls holding no context wait, so the contexts are always given back.
+eedi3::FrameContext *eedi3::acquireContext(const int n, IScriptEnvironment *env)
+{
+  for (;;)
+  {
+    FrameContext *ctx = tryAcquireContext(env);
+    if (ctx)
+      return ctx;
+    FrameContext *drop = 0;
+    EnterCriticalSection(&pf_lock);
+    int drop_idx = -1;
+    for (int i = 0; i < int(pf_list.size()); ++i)
+    {
+      if (drop_idx < 0 || abs(pf_list[i]->pf_n - n) > abs(pf_list[drop_idx]->pf_n - n))
+        drop_idx = i;
+    }
+    if (drop_idx >= 0)
+    {
+      drop = pf_list[drop_idx];
+      pf_list.erase(pf_list.begin() + drop_idx);
+    }
+    LeaveCriticalSection(&pf_lock);
+    if (drop)
+      dropFrame(drop);
+    else
+      WaitForSingleObject(ctx_evt, INFINITE);
+  }
+}
+
+// Takes a context from the pool, or creates a new one below ctx_max, or
+// returns 0. For the companion and prefetched frames, which are skipped
+// when the contexts are all used.
+eedi3::FrameContext *eedi3::tryAcquireContext(IScriptEnvironment *env)
+{
+  FrameContext *ctx = 0;
+  bool create_flag = false;
+  EnterCriticalSection(&ctx_lock);
+  if (!ctx_pool.empty())
+  {
+    ctx = ctx_pool.back();
+    ctx_pool.pop_back();
+    // A single wake-up is kept by ctx_evt, passes it on to the next call
+    // waiting for a context.
+    if (!ctx_pool.empty())
+      SetEvent(ctx_evt);
+  }
+  else if (ctx_count < ctx_max)
+  {
+    ++ctx_count;
+    create_flag = true;
+  }
+  LeaveCriticalSection(&ctx_lock);
+  if (create_flag)
+  {
+    ctx = createContext();
+    if (!ctx)
+    {
+      EnterCriticalSection(&ctx_lock);
+      --ctx_count;
+      LeaveCriticalSection(&ctx_lock);
+      env->ThrowError("eedi3:  malloc failure!\n");
+    }
+  }
+  return ctx;
+}
+
+void eedi3::releaseContext(FrameContext *ctx)
+{
+  EnterCriticalSection(&ctx_lock);
+  ctx_pool.push_back(ctx);
+  LeaveCriticalSection(&ctx_lock);
+  SetEvent(ctx_evt);
 }
 
 void expand_mask(bool bmask[], const uint8_t maskp[], int width, int mdis)
@@ -185,109 +532,264 @@ void expand_mask(bool bmask[], const uint8_t maskp[], int width, int mdis)
   }
 }
 
+// Pixel arithmetic shared by the integer and float versions. Acc is the
+// type of the intermediate values. The integer results are rounded and
+// clipped, the float ones are not: float data can exceed the nominal range.
+template <class T> struct PixAcc { typedef int Acc; };
+template <> struct PixAcc <float> { typedef float Acc; };
+static inline int divRound(const int s, const int shift) { return (s + ((1 << shift) >> 1)) >> shift; }
+static inline float divRound(const float s, const int shift) { return s * (1.0f / (1 << shift)); }
+static inline int divTrunc(const int s, const int shift) { return s >> shift; }
+static inline float divTrunc(const float s, const int shift) { return s * (1.0f / (1 << shift)); }
+static inline int clipPix(const int v, const int pix_max) { return min(max(v, 0), pix_max); }
+static inline float clipPix(const float v, const float pix_max) { return v; }
+
+// Scale of the thresholds calibrated for 8-bit content. 1.0 is 255 for float.
+static inline float pixScale(const int bits)
+{
+  return (bits == 32) ? 1.0f / 255 : float(1 << (bits - 8));
+}
+
+// Interpolates a line along the directions of dmap, in half pixels with
+// hp=true. The pixels outside the mask have a 0 direction.
+template <class T>
+static void interpDirs(T *dstp, const T *src3p, const T *src1p,
+  const T *src1n, const T *src3n, const int8_t *dmap, const int width,
+  const bool hp, const bool ucubic, const typename PixAcc<T>::Acc pix_max)
+{
+  typedef typename PixAcc<T>::Acc Acc;
+  for (int x = 0; x < width; ++x)
+  {
+    const int dir = dmap[x];
+    if (!hp || !(dir & 1))
+    {
+      const int d = (hp) ? dir >> 1 : dir;
+      const int ad = abs(d);
+      if (ucubic && x >= ad * 3 && x <= width - 1 - ad * 3)
+        dstp[x] = T(clipPix(divRound(9 * (Acc(src1p[x + d]) + src1n[x - d]) -
+          (Acc(src3p[x + d * 3]) + src3n[x - d * 3]), 4), pix_max));
+      else
+        dstp[x] = T(divRound(Acc(src1p[x + d]) + src1n[x - d], 1));
+    }
+    else
+    {
+      const int d20 = dir >> 1;
+      const int d21 = (dir + 1) >> 1;
+      const int d30 = (dir * 3) >> 1;
+      const int d31 = (dir * 3 + 1) >> 1;
+      const int ad = max(abs(d30), abs(d31));
+      const Acc c1 = Acc(src1p[x + d20]) + src1p[x + d21]; // should use cubic if ucubic=true
+      const Acc c2 = Acc(src1n[x - d20]) + src1n[x - d21]; // should use cubic if ucubic=true
+      if (ucubic && x >= ad && x <= width - 1 - ad)
+      {
+        const Acc c0 = Acc(src3p[x + d30]) + src3p[x + d31];
+        const Acc c3 = Acc(src3n[x - d30]) + src3n[x - d31];
+        dstp[x] = T(clipPix(divRound(9 * (c1 + c2) - (c0 + c3), 5), pix_max));
+      }
+      else
+        dstp[x] = T(divRound(c1 + c2, 2));
+    }
+  }
+}
+
+// Sum of the absolute differences between the lines along the u direction,
+// for the pixel c. This is a single tap of the nrad window.
+template <class T>
+static inline int diagSad(const T *src3p, const T *src1p,
+  const T *src1n, const T *src3n, const int c, const int u)
+{
+  return
+    abs(src3p[c + u] - src1p[c - u]) +
+    abs(src1p[c + u] - src1n[c - u]) +
+    abs(src1n[c + u] - src3n[c - u]);
+}
+
 // Full-pel steps
-void interpLineFP(const uint8_t *srcp, const int width, const int pitch,
+// The connection costs of a pixel are fed to the path cost recursion as soon
+// as they are computed, so only the backtrack indexes are stored for the
+// whole line.
+// With fixed=true, the costs are int32 instead of float, see
+// Eedi3Sse::quantize_costs(). The path costs of a pixel are made relative to
+// the best one, so they don't grow along the line and stay far from the
+// saturation value. The chosen paths don't depend on this offset and the
+// results are the same for all the instruction sets, as long as there is no
+// mask (the SIMD versions mask whole columns of lines).
+// T is uint8_t for 8-bit data, uint16_t for 9 to 16 bits. The pitch is in
+// pixels.
+template <class T>
+void interpLineFP(const T *srcp, const int width, const int pitch,
   const float alpha, const float beta, const float gamma, const int nrad,
-  const int mdis, float *temp, uint8_t *dstp, int16_t *dmap, const bool ucubic,
-  const bool cost3, const uint8_t *maskp)
+  const int mdis, float *temp, T *dstp, int8_t *dmap, const bool ucubic,
+  const bool cost3, const uint8_t *maskp, const bool fixed, const int bits)
 {
-  const uint8_t *src3p = srcp - 3 * pitch;
-  const uint8_t *src1p = srcp - 1 * pitch;
-  const uint8_t *src1n = srcp + 1 * pitch;
-  const uint8_t *src3n = srcp + 3 * pitch;
+  const T *src3p = srcp - 3 * pitch;
+  const T *src1p = srcp - 1 * pitch;
+  const T *src1n = srcp + 1 * pitch;
+  const T *src3n = srcp + 3 * pitch;
   const int tpitch = mdis * 2 + 1;
-  float *ccosts = temp;	// Array of mdis*2+1 costs for each pixel of the line
-  float *pcosts = ccosts + width * tpitch;
-  int *pbackt = (int*)(pcosts + width * tpitch);
-  int *fpath = pbackt + width * tpitch;
+  float *tT = temp;	// Array of mdis*2+1 connection costs for the current pixel
+  float *pcosts = tT + tpitch;	// Path costs, previous and current pixels
+  int *rsum = (int*)(pcosts + 2 * tpitch);	// Running sums of the nrad window, for each u
+  int *s0tab = rsum + tpitch;	// s0 sums of the last tpitch centers (cost3)
+  // Directions are within [-mdis ; mdis], so they fit in a byte.
+  int8_t *pbackt = (int8_t*)(s0tab + tpitch * tpitch);
+  int8_t *fpath = pbackt + width * tpitch;
   bool *bmask = (bool *)(fpath + width);
+  bool *tmask = bmask + width;
+  int *tTi = (int*)tT;	// Same arrays, fixed-point costs
+  int *pcostsi = (int*)pcosts;
+  int ka, kb, kc, kg;
+  Eedi3Sse::quantize_costs(ka, kb, kc, kg, alpha, beta, gamma, cost3);
+  // beta and gamma are calibrated for 8-bit content, they are scaled like
+  // the pixel differences. The fixed-point costs are computed on the 16-bit
+  // scale of the SIMD versions (sh is the shift of the pixels), with the
+  // same roundings.
+  const float beta_s = beta * (1 << (bits - 8));
+  const float gamma_s = gamma * (1 << (bits - 8));
+  const int sh = 16 - bits;
+  const int pix_max = (1 << bits) - 1;
   if (maskp != 0)
   {
-    memset(ccosts, 0, sizeof(ccosts[0]) * tpitch * width);
     expand_mask(bmask, maskp, width, mdis);
+    if (cost3)
+      expand_mask(tmask, maskp, width, mdis * 2);
   }
-  // calculate all connection costs
-  if (!cost3)
+  // Path costs outside the u range of a pixel are set to the maximum value,
+  // because a masked pixel copies all of them and the next one may read
+  // them.
+  for (int i = 0; i < 2 * tpitch; ++i)
   {
-    for (int x = 0; x < width; ++x)
+    if (fixed)
+      pcostsi[i] = Eedi3Sse::FIXED_MAX;
+    else
+      pcosts[i] = (float)(FLT_MAX*0.9);
+  }
+  // The nrad window sums are slid along x for each u: one tap enters, one
+  // leaves. umaxp is the u range of the sums valid for x - 1, or -1 after a
+  // masked pixel.
+  int umaxp = -1;
+  // With cost3, s1 and s2 are the s0 sums of the centers x - u and x + u,
+  // for the same u. The s0 sums are computed mdis pixels ahead and kept in
+  // a table indexed by center (modulo tpitch) and u. For u > 0, s2 may go
+  // beyond umax on the right border, so the table covers u up to
+  // min(c, mdis) on this side. When there is a mask, a center is needed if
+  // it is within mdis of a pixel processed in the mask, hence the doubled
+  // mask expansion.
+  int cnext = 0;
+  int unegp = -1, uposp = -1;
+  for (int x = 0; x < width; ++x)
+  {
+    // calculate the connection costs
+    if (cost3)
     {
-      if (maskp == 0 || bmask[x])
+      for (const int cend = min(x + mdis, width - 1); cnext <= cend; ++cnext)
       {
-        const int umax = min(min(x, width - 1 - x), mdis);
-        for (int u = -umax; u <= umax; ++u)
+        const int c = cnext;
+        if (maskp == 0 || tmask[c])
         {
-          int s = 0;
-          for (int k = -nrad; k <= nrad; ++k)
-            s +=
-            abs(src3p[x + u + k] - src1p[x - u + k]) +
-            abs(src1p[x + u + k] - src1n[x - u + k]) +
-            abs(src1n[x + u + k] - src3n[x - u + k]);
-          const int ip = (src1p[x + u] + src1n[x - u] + 1) >> 1; // should use cubic if ucubic=true
-          const int v = abs(src1p[x] - ip) + abs(src1n[x] - ip);
-          ccosts[x*tpitch + mdis + u] = alpha * s + beta * abs(u) + (1.0f - alpha - beta)*v;
+          const int uneg = min(min(c, width - 1 - c), mdis);
+          const int upos = min(c, mdis);
+          int *sT = s0tab + (c % tpitch) * tpitch + mdis;
+          const int *psT = s0tab + ((c + tpitch - 1) % tpitch) * tpitch + mdis;
+          for (int u = -uneg; u <= upos; ++u)
+          {
+            if (-u > unegp || u > uposp)
+            {
+              int s = 0;
+              for (int k = -nrad; k <= nrad; ++k)
+                s += diagSad(src3p, src1p, src1n, src3n, c + k, u);
+              sT[u] = s;
+            }
+            else
+              sT[u] = psT[u] +
+              diagSad(src3p, src1p, src1n, src3n, c + nrad, u) -
+              diagSad(src3p, src1p, src1n, src3n, c - 1 - nrad, u);
+          }
+          unegp = uneg;
+          uposp = upos;
+        }
+        else
+        {
+          unegp = -1;
+          uposp = -1;
         }
       }
     }
-  }
-  else
-  {
-    for (int x = 0; x < width; ++x)
+    if (maskp == 0 || bmask[x])
     {
-      if (maskp == 0 || bmask[x])
+      const int umax = min(min(x, width - 1 - x), mdis);
+      for (int u = -umax; u <= umax; ++u)
       {
-        const int umax = min(min(x, width - 1 - x), mdis);
-        for (int u = -umax; u <= umax; ++u)
+        int s;
+        if (!cost3)
         {
-          int s0 = 0, s1 = -1, s2 = -1;
-          for (int k = -nrad; k <= nrad; ++k)
-            s0 +=
-            abs(src3p[x + u + k] - src1p[x - u + k]) +
-            abs(src1p[x + u + k] - src1n[x - u + k]) +
-            abs(src1n[x + u + k] - src3n[x - u + k]);
-          if ((u >= 0 && x >= u * 2) || (u <= 0 && x < width + u * 2))
+          int &rs = rsum[mdis + u];
+          if (abs(u) > umaxp)
           {
-            s1 = 0;
+            rs = 0;
             for (int k = -nrad; k <= nrad; ++k)
-              s1 +=
-              abs(src3p[x + k] - src1p[x - u * 2 + k]) +
-              abs(src1p[x + k] - src1n[x - u * 2 + k]) +
-              abs(src1n[x + k] - src3n[x - u * 2 + k]);
+              rs += diagSad(src3p, src1p, src1n, src3n, x + k, u);
           }
+          else
+            rs +=
+            diagSad(src3p, src1p, src1n, src3n, x + nrad, u) -
+            diagSad(src3p, src1p, src1n, src3n, x - 1 - nrad, u);
+          s = rs;
+        }
+        else
+        {
+          const int s0 = s0tab[(x % tpitch) * tpitch + mdis + u];
+          int s1 = -1, s2 = -1;
+          if ((u >= 0 && x >= u * 2) || (u <= 0 && x < width + u * 2))
+            s1 = s0tab[((x - u) % tpitch) * tpitch + mdis + u];
           if ((u <= 0 && x >= -u * 2) || (u >= 0 && x < width + u * 2)) // LDS: fixed u -> -u
-          {
-            s2 = 0;
-            for (int k = -nrad; k <= nrad; ++k)
-              s2 +=
-              abs(src3p[x + u * 2 + k] - src1p[x + k]) +
-              abs(src1p[x + u * 2 + k] - src1n[x + k]) +
-              abs(src1n[x + u * 2 + k] - src3n[x + k]);
-          }
+            s2 = s0tab[((x + u) % tpitch) * tpitch + mdis + u];
           s1 = s1 >= 0 ? s1 : (s2 >= 0 ? s2 : s0);
           s2 = s2 >= 0 ? s2 : (s1 >= 0 ? s1 : s0);
+          s = s0 + s1 + s2;
+        }
+        if (fixed)
+        {
+          const int ip = (((src1p[x + u] + src1n[x - u]) << sh) + 1) >> 1;
+          const int v = abs((src1p[x] << sh) - ip) + abs((src1n[x] << sh) - ip);
+          tTi[mdis + u] = ka * ((s << sh) >> 8) + kb * abs(u) + kc * (v >> 7);
+        }
+        else
+        {
           const int ip = (src1p[x + u] + src1n[x - u] + 1) >> 1; // should use cubic if ucubic=true
           const int v = abs(src1p[x] - ip) + abs(src1n[x] - ip);
-          ccosts[x*tpitch + mdis + u] = alpha * (s0 + s1 + s2)*0.333333f + beta * abs(u) + (1.0f - alpha - beta)*v;
+          if (!cost3)
+            tT[mdis + u] = alpha * s + beta_s * abs(u) + (1.0f - alpha - beta)*v;
+          else
+            tT[mdis + u] = alpha * s*0.333333f + beta_s * abs(u) + (1.0f - alpha - beta)*v;
         }
       }
+      umaxp = umax;
     }
-  }
-  // calculate path costs
-  pcosts[mdis] = ccosts[mdis];
-  for (int x = 1; x < width; ++x)
-  {
-    float *tT = ccosts + x * tpitch;
-    float *ppT = pcosts + (x - 1)*tpitch;
-    float *pT = pcosts + x * tpitch;
-    int   *piT = pbackt + (x - 1)*tpitch;
+    else
+    {
+      memset(tT, 0, sizeof(*tT) * tpitch);
+      umaxp = -1;
+    }
+    // calculate path costs
+    // The candidates of a state u are the states u-1, u and u+1 of the
+    // previous pixel, read at fixed offsets. The side ones are skipped only
+    // at the ends of the u range, where they are out of the previous range.
+    float *ppT = pcosts + ((x + 1) & 1) * tpitch;
+    float *pT = pcosts + (x & 1) * tpitch;
+    // The costs are copied as raw data, they may be fixed-point.
+    if (x == 0)
+    {
+      memcpy(pT + mdis, tT + mdis, sizeof(*pT));
+      continue;
+    }
+    int8_t *piT = pbackt + (x - 1)*tpitch;
     if (maskp != 0 && !bmask[x])
     {
       if (x == 1)
       {
         const int umax = min(min(x, width - 1 - x), mdis);
-        for (int u = -umax; u <= umax; ++u)
-        {
-          pT[mdis + u] = tT[mdis + u];
-        }
+        memcpy(pT + mdis - umax, tT + mdis - umax, sizeof(*pT) * (umax * 2 + 1));
         memset(piT, 0, sizeof(*piT) * tpitch);
       }
       else
@@ -302,28 +804,89 @@ void interpLineFP(const uint8_t *srcp, const int width, const int pitch,
         }
       }
     }
+    else if (fixed)
+    {
+      const int *ppTi = (const int*)ppT;
+      int *pTi = (int*)pT;
+      const int umax = min(min(x, width - 1 - x), mdis);
+      const int umax2 = min(min(x - 1, width - x), mdis);
+      const int fixmax = Eedi3Sse::FIXED_MAX;
+      int pmin = fixmax;
+      for (int u = -umax; u <= umax; ++u)
+      {
+        const int *ppTu = ppTi + mdis + u;
+        int idx = 0;
+        int bval = INT32_MAX;
+        if (u > -umax2)
+        {
+          bval = min(ppTu[-1] + kg, fixmax);
+          idx = u - 1;
+        }
+        if (abs(u) <= umax2 && min(ppTu[0], fixmax) < bval)
+        {
+          bval = min(ppTu[0], fixmax);
+          idx = u;
+        }
+        if (u < umax2 && min(ppTu[1] + kg, fixmax) < bval)
+        {
+          bval = min(ppTu[1] + kg, fixmax);
+          idx = u + 1;
+        }
+        pTi[mdis + u] = min(bval + tTi[mdis + u], fixmax);
+        piT[mdis + u] = idx;
+        pmin = min(pmin, pTi[mdis + u]);
+      }
+      for (int u = -umax; u <= umax; ++u)
+        pTi[mdis + u] -= pmin;
+      for (int u = umax + 1; u <= mdis; ++u)
+      {
+        pTi[mdis - u] = fixmax;
+        pTi[mdis + u] = fixmax;
+      }
+    }
     else
     {
       const int umax = min(min(x, width - 1 - x), mdis);
+      const int umax2 = min(min(x - 1, width - x), mdis);
       for (int u = -umax; u <= umax; ++u)
       {
-        int idx;
+        const float *ppTu = ppT + mdis + u;
+        int idx = 0;
         float bval = FLT_MAX;
-        const int umax2 = min(min(x - 1, width - x), mdis);
-        for (int v = max(-umax2, u - 1); v <= min(umax2, u + 1); ++v)
+        if (u > -umax2)
+        {
+          const double y = ppTu[-1] + gamma_s;
+          bval = (float)min(y, FLT_MAX*0.9);
+          idx = u - 1;
+        }
+        if (abs(u) <= umax2)
+        {
+          const float ccost = (float)min(double(ppTu[0]), FLT_MAX*0.9);
+          if (ccost < bval)
+          {
+            bval = ccost;
+            idx = u;
+          }
+        }
+        if (u < umax2)
         {
-          const double y = ppT[mdis + v] + gamma * abs(u - v);
+          const double y = ppTu[1] + gamma_s;
           const float ccost = (float)min(y, FLT_MAX*0.9);
           if (ccost < bval)
           {
             bval = ccost;
-            idx = v;
+            idx = u + 1;
           }
         }
         const double y = bval + tT[mdis + u];
         pT[mdis + u] = (float)min(y, FLT_MAX*0.9);
         piT[mdis + u] = idx;
       }
+      for (int u = umax + 1; u <= mdis; ++u)
+      {
+        pT[mdis - u] = (float)(FLT_MAX*0.9);
+        pT[mdis + u] = (float)(FLT_MAX*0.9);
+      }
     }
   }
   // backtrack
@@ -332,58 +895,46 @@ void interpLineFP(const uint8_t *srcp, const int width, const int pitch,
     fpath[x] = pbackt[x*tpitch + mdis + fpath[x + 1]];
   // interpolate
   for (int x = 0; x < width; ++x)
-  {
-    if (maskp != 0 && !bmask[x])
-    {
-      dmap[x] = 0;
-      if (ucubic)
-      {
-        dstp[x] = min(max((9 * (src1p[x] + src1n[x]) -
-          (src3p[x] + src3n[x]) + 8) >> 4, 0), 255);
-      }
-      else
-      {
-        dstp[x] = (src1p[x] + src1n[x] + 1) >> 1;
-      }
-    }
-    else
-    {
-      const int dir = fpath[x];
-      dmap[x] = dir;
-      const int ad = abs(dir);
-      if (ucubic && x >= ad * 3 && x <= width - 1 - ad * 3)
-        dstp[x] = min(max((9 * (src1p[x + dir] + src1n[x - dir]) -
-        (src3p[x + dir * 3] + src3n[x - dir * 3]) + 8) >> 4, 0), 255);
-      else
-        dstp[x] = (src1p[x + dir] + src1n[x - dir] + 1) >> 1;
-    }
-  }
+    dmap[x] = (maskp != 0 && !bmask[x]) ? 0 : fpath[x];
+  interpDirs(dstp, src3p, src1p, src1n, src3n, dmap, width, false, ucubic, pix_max);
 }
 
+// Left and right margins of the half pel lines, must be greater than nrad
+static const int HPEL_MARGIN = 4;
+
 // Half-pel steps
-void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
+template <class T>
+void interpLineHP(const T *srcp, const int width, const int pitch,
   const float alpha, const float beta, const float gamma, const int nrad,
-  const int mdis, float *temp, uint8_t *dstp, int16_t *dmap, const bool ucubic,
-  const bool cost3, const uint8_t *maskp)
+  const int mdis, float *temp, T *dstp, int8_t *dmap, const bool ucubic,
+  const bool cost3, const uint8_t *maskp, const int bits)
 {
-  const uint8_t *src3p = srcp - 3 * pitch;
-  const uint8_t *src1p = srcp - 1 * pitch;
-  const uint8_t *src1n = srcp + 1 * pitch;
-  const uint8_t *src3n = srcp + 3 * pitch;
+  const T *src3p = srcp - 3 * pitch;
+  const T *src1p = srcp - 1 * pitch;
+  const T *src1n = srcp + 1 * pitch;
+  const T *src3n = srcp + 3 * pitch;
+  // See interpLineFP()
+  const float beta_s = beta * (1 << (bits - 8));
+  const float gamma_s = gamma * (1 << (bits - 8));
+  const int pix_max = (1 << bits) - 1;
   const int tpitch = mdis * 4 + 1;
   float *ccosts = temp;
   float *pcosts = ccosts + width * tpitch;
-  int *pbackt = (int*)(pcosts + width * tpitch);
-  int *fpath = pbackt + width * tpitch;
-  uint8_t *hp3p = (uint8_t*)fpath;
-  uint8_t *hp1p = hp3p + width;
-  uint8_t *hp1n = hp1p + width;
-  uint8_t *hp3n = hp1n + width;
-  bool *bmask = (bool *)(hp3n + width);
+  // Directions are within [-mdis*2 ; mdis*2], so they fit in a byte.
+  int8_t *pbackt = (int8_t*)(pcosts + width * tpitch);
+  int8_t *fpath = pbackt + width * tpitch;
+  // The half pel lines have HPEL_MARGIN pixels on each side, because the
+  // nrad window goes beyond the line boundaries.
+  const int hpitch = width + HPEL_MARGIN * 2;
+  T *hp3p = (T*)(fpath + width) + HPEL_MARGIN;
+  T *hp1p = hp3p + hpitch;
+  T *hp1n = hp1p + hpitch;
+  T *hp3n = hp1n + hpitch;
+  bool *bmask = (bool *)(hp3n + width + HPEL_MARGIN);
   // calculate half pel values
-  for (int x = 0; x < width - 1; ++x)
+  for (int x = -HPEL_MARGIN; x < width - 1 + HPEL_MARGIN; ++x)
   {
-    if (!ucubic || (x == 0 || x == width - 2))
+    if (!ucubic || (x <= 0 || x >= width - 2))
     {
       hp3p[x] = (src3p[x] + src3p[x + 1] + 1) >> 1;
       hp1p[x] = (src1p[x] + src1p[x + 1] + 1) >> 1;
@@ -392,16 +943,22 @@ void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
     }
     else
     {
-      hp3p[x] = min(max((9 * (src3p[x] + src3p[x + 1]) - (src3p[x - 1] + src3p[x + 2]) + 8) >> 4, 0), 255);
-      hp1p[x] = min(max((9 * (src1p[x] + src1p[x + 1]) - (src1p[x - 1] + src1p[x + 2]) + 8) >> 4, 0), 255);
-      hp1n[x] = min(max((9 * (src1n[x] + src1n[x + 1]) - (src1n[x - 1] + src1n[x + 2]) + 8) >> 4, 0), 255);
-      hp3n[x] = min(max((9 * (src3n[x] + src3n[x + 1]) - (src3n[x - 1] + src3n[x + 2]) + 8) >> 4, 0), 255);
+      hp3p[x] = min(max((9 * (src3p[x] + src3p[x + 1]) - (src3p[x - 1] + src3p[x + 2]) + 8) >> 4, 0), pix_max);
+      hp1p[x] = min(max((9 * (src1p[x] + src1p[x + 1]) - (src1p[x - 1] + src1p[x + 2]) + 8) >> 4, 0), pix_max);
+      hp1n[x] = min(max((9 * (src1n[x] + src1n[x + 1]) - (src1n[x - 1] + src1n[x + 2]) + 8) >> 4, 0), pix_max);
+      hp3n[x] = min(max((9 * (src3n[x] + src3n[x + 1]) - (src3n[x - 1] + src3n[x + 2]) + 8) >> 4, 0), pix_max);
     }
   }
   if (maskp != 0)
   {
     memset(ccosts, 0, sizeof(ccosts[0]) * tpitch * width);
     expand_mask(bmask, maskp, width, mdis);
+    // Masked pixels copy the whole previous path costs and backtrack
+    // indexes, so parts which are never computed may be read later.
+    // Clears them to get results independent of the workspace content.
+    for (int i = 0; i < tpitch * width; ++i)
+      pcosts[i] = (float)(FLT_MAX*0.9);
+    memset(pbackt, 0, sizeof(pbackt[0]) * tpitch * width);
   }
   // calculate all connection costs
   if (!cost3)
@@ -434,7 +991,7 @@ void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
             ip = (hp1p[x + u2] + hp1n[x - u2 - 1] + 1) >> 1; // should use cubic if ucubic=true
           }
           const int v = abs(src1p[x] - ip) + abs(src1n[x] - ip);
-          ccosts[x*tpitch + mdis * 2 + u] = alpha * s + beta * abs(u)*0.5f + (1.0f - alpha - beta)*v;
+          ccosts[x*tpitch + mdis * 2 + u] = alpha * s + beta_s * abs(u)*0.5f + (1.0f - alpha - beta)*v;
         }
       }
     }
@@ -477,7 +1034,7 @@ void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
               abs(src1p[x + k] - src1n[x - u + k]) +
               abs(src1n[x + k] - src3n[x - u + k]);
           }
-          if ((u <= 0 && x >= -u) || (u >= 0 && x < width + u)) // LDS: fixed u -> -u
+          if ((u <= 0 && x >= -u) || (u >= 0 && x < width - u)) // LDS: fixed u -> -u, and x + u < width for u >= 0
           {
             s2 = 0;
             for (int k = -nrad; k <= nrad; ++k)
@@ -489,7 +1046,7 @@ void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
           s1 = s1 >= 0 ? s1 : (s2 >= 0 ? s2 : s0);
           s2 = s2 >= 0 ? s2 : (s1 >= 0 ? s1 : s0);
           const int v = abs(src1p[x] - ip) + abs(src1n[x] - ip);
-          ccosts[x*tpitch + mdis * 2 + u] = alpha * (s0 + s1 + s2)*0.333333f + beta * abs(u)*0.5f + (1.0f - alpha - beta)*v;
+          ccosts[x*tpitch + mdis * 2 + u] = alpha * (s0 + s1 + s2)*0.333333f + beta_s * abs(u)*0.5f + (1.0f - alpha - beta)*v;
         }
       }
     }
@@ -501,7 +1058,7 @@ void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
     float *tT = ccosts + x * tpitch;
     float *ppT = pcosts + (x - 1)*tpitch;
     float *pT = pcosts + x * tpitch;
-    int *piT = pbackt + (x - 1)*tpitch;
+    int8_t *piT = pbackt + (x - 1)*tpitch;
     if (maskp != 0 && !bmask[x])
     {
       if (x == 1)
@@ -537,7 +1094,7 @@ void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
         const int umax2 = min(min(x - 1, width - x), mdis);
         for (int v = max(-umax2 * 2, u - 2); v <= min(umax2 * 2, u + 2); ++v)
         {
-          const double y = ppT[mdis * 2 + v] + gamma * abs(u - v)*0.5f;
+          const double y = ppT[mdis * 2 + v] + gamma_s * abs(u - v)*0.5f;
           const float ccost = (float)min(y, FLT_MAX*0.9);
           if (ccost < bval)
           {
@@ -557,332 +1114,1236 @@ void interpLineHP(const uint8_t *srcp, const int width, const int pitch,
     fpath[x] = pbackt[x*tpitch + mdis * 2 + fpath[x + 1]];
   // interpolate
   for (int x = 0; x < width; ++x)
+    dmap[x] = (maskp != 0 && !bmask[x]) ? 0 : fpath[x];
+  interpDirs(dstp, src3p, src1p, src1n, src3n, dmap, width, true, ucubic, pix_max);
+}
+
+// Counts the combed pixels [x_beg ; x_end) of the line srcp, in cnt[x >> 4].
+// A pixel is combed when it is above or below both its vertical neighbours
+// by more than cthresh, and when the difference with them is also large
+// after a vertical [1 -3 4 -3 1] filter. cthresh is on the scale of the
+// data.
+template <class T>
+void countCombed(int cnt[], const T *src2p, const T *src1p,
+  const T *srcp, const T *src1n, const T *src2n,
+  const int x_beg, const int x_end, const typename PixAcc<T>::Acc cthresh)
+{
+  typedef typename PixAcc<T>::Acc Acc;
+  const Acc cthresh6 = cthresh * 6;
+  for (int x = x_beg; x < x_end; ++x)
   {
-    if (maskp != 0 && !bmask[x])
+    const Acc d1 = Acc(srcp[x]) - src1p[x];
+    const Acc d2 = Acc(srcp[x]) - src1n[x];
+    if (((d1 > cthresh && d2 > cthresh) || (d1 < -cthresh && d2 < -cthresh))
+      && std::abs(Acc(src2p[x]) + 4 * Acc(srcp[x]) + src2n[x] - 3 * (Acc(src1p[x]) + src1n[x])) > cthresh6)
+      ++cnt[x >> 4];
+  }
+}
+
+// Vertical consistency check of the pixels [x_beg ; x_end) of an
+// interpolated line. dstp is the line in the destination frame, dst2p the
+// previous interpolated line after its own check. The result goes to tline,
+// because the check of a pixel reads the unchecked line around it. The pitch
+// is in pixels.
+template <class T>
+void vCheckLine(T *tline, const T *dst2p, const T *dstp,
+  const int dpitch, const T *dst3p, const T *dst3n,
+  const T *scpp, const int8_t *dstpd, const int dmpitch, const int x_beg, const int x_end,
+  const int vcheck, const float vthresh0, const float vthresh1,
+  const float vthresh2, const bool hp, const int bits)
+{
+  typedef typename PixAcc<T>::Acc Acc;
+  const T *dst1p = dstp - 1 * dpitch;
+  const T *dst1n = dstp + 1 * dpitch;
+  const T *dst2n = dstp + 2 * dpitch;
+  // The thresholds on the pixel differences are calibrated for 8-bit content
+  const float vthresh0_s = vthresh0 * pixScale(bits);
+  const float vthresh1_s = vthresh1 * pixScale(bits);
+  const Acc pix_max = Acc((bits == 32) ? 1 : (1 << bits) - 1);
+  for (int x = x_beg; x < x_end; ++x)
+  {
+    const int dirc = dstpd[x];
+    const Acc cint = scpp ? Acc(scpp[x]) :
+      clipPix(divRound(9 * (Acc(dst1p[x]) + dst1n[x]) - (Acc(dst3p[x]) + dst3n[x]), 4), pix_max);
+    if (dirc == 0)
     {
-      dmap[x] = 0;
-      if (ucubic)
-        dstp[x] = min(max((9 * (src1p[x] + src1n[x]) -
-        (src3p[x] + src3n[x]) + 8) >> 4, 0), 255);
-      else
-        dstp[x] = (src1p[x] + src1n[x] + 1) >> 1;
+      tline[x] = T(cint);
+      continue;
     }
-    else
+    const int dirt = dstpd[x - dmpitch];
+    const int dirb = dstpd[x + dmpitch];
+    if (max(dirc*dirt, dirc*dirb) < 0 || (dirt == dirb && dirt == 0))
     {
-      const int dir = fpath[x];
-      dmap[x] = dir;
-      if (!(dir & 1))
-      {
-        const int d2 = dir >> 1;
-        const int ad = abs(d2);
-        if (ucubic && x >= ad * 3 && x <= width - 1 - ad * 3)
-          dstp[x] = min(max((9 * (src1p[x + d2] + src1n[x - d2]) -
-          (src3p[x + d2 * 3] + src3n[x - d2 * 3]) + 8) >> 4, 0), 255);
-        else
-          dstp[x] = (src1p[x + d2] + src1n[x - d2] + 1) >> 1;
+      tline[x] = T(cint);
+      continue;
+    }
+    Acc it, ib, vt, vb, vc;
+    vc = std::abs(Acc(dstp[x]) - dst1p[x]) + std::abs(Acc(dstp[x]) - dst1n[x]);
+    if (hp)
+    {
+      if (!(dirc & 1))
+      {
+        const int d2 = dirc >> 1;
+        it = divRound(Acc(dst2p[x + d2]) + dstp[x - d2], 1);
+        vt = std::abs(Acc(dst2p[x + d2]) - dst1p[x + d2]) + std::abs(Acc(dstp[x + d2]) - dst1p[x + d2]);
+        ib = divRound(Acc(dstp[x + d2]) + dst2n[x - d2], 1);
+        vb = std::abs(Acc(dst2n[x - d2]) - dst1n[x - d2]) + std::abs(Acc(dstp[x - d2]) - dst1n[x - d2]);
       }
       else
       {
-        const int d20 = dir >> 1;
-        const int d21 = (dir + 1) >> 1;
-        const int d30 = (dir * 3) >> 1;
-        const int d31 = (dir * 3 + 1) >> 1;
-        const int ad = max(abs(d30), abs(d31));
-        if (ucubic && x >= ad && x <= width - 1 - ad)
-        {
-          const int c0 = src3p[x + d30] + src3p[x + d31];
-          const int c1 = src1p[x + d20] + src1p[x + d21]; // should use cubic if ucubic=true
-          const int c2 = src1n[x - d20] + src1n[x - d21]; // should use cubic if ucubic=true
-          const int c3 = src3n[x - d30] + src3n[x - d31];
-          dstp[x] = min(max((9 * (c1 + c2) - (c0 + c3) + 16) >> 5, 0), 255);
-        }
-        else
-          dstp[x] = (src1p[x + d20] + src1p[x + d21] + src1n[x - d20] + src1n[x - d21] + 2) >> 2;
+        const int d20 = dirc >> 1;
+        const int d21 = (dirc + 1) >> 1;
+        const Acc pa2p = Acc(dst2p[x + d20]) + dst2p[x + d21];
+        const Acc pa1p = Acc(dst1p[x + d20]) + dst1p[x + d21];
+        const Acc ps0 = Acc(dstp[x - d20]) + dstp[x - d21];
+        const Acc pa0 = Acc(dstp[x + d20]) + dstp[x + d21];
+        const Acc ps1n = Acc(dst1n[x - d20]) + dst1n[x - d21];
+        const Acc ps2n = Acc(dst2n[x - d20]) + dst2n[x - d21];
+        it = divRound(pa2p + ps0, 2);
+        vt = divTrunc(std::abs(pa2p - pa1p) + std::abs(pa0 - pa1p), 1);
+        ib = divRound(pa0 + ps2n, 2);
+        vb = divTrunc(std::abs(ps2n - ps1n) + std::abs(ps0 - ps1n), 1);
       }
     }
+    else
+    {
+      it = divRound(Acc(dst2p[x + dirc]) + dstp[x - dirc], 1);
+      vt = std::abs(Acc(dst2p[x + dirc]) - dst1p[x + dirc]) + std::abs(Acc(dstp[x + dirc]) - dst1p[x + dirc]);
+      ib = divRound(Acc(dstp[x + dirc]) + dst2n[x - dirc], 1);
+      vb = std::abs(Acc(dst2n[x - dirc]) - dst1n[x - dirc]) + std::abs(Acc(dstp[x - dirc]) - dst1n[x - dirc]);
+    }
+    const Acc d0 = std::abs(it - dst1p[x]);
+    const Acc d1 = std::abs(ib - dst1n[x]);
+    const Acc d2 = std::abs(vt - vc);
+    const Acc d3 = std::abs(vb - vc);
+    const Acc mdiff0 = vcheck == 1 ? min(d0, d1) : vcheck == 2 ? divRound(d0 + d1, 1) : max(d0, d1);
+    const Acc mdiff1 = vcheck == 1 ? min(d2, d3) : vcheck == 2 ? divRound(d2 + d3, 1) : max(d2, d3);
+    const float a0 = mdiff0 / vthresh0_s;
+    const float a1 = mdiff1 / vthresh1_s;
+    const int dircv = hp ? (abs(dirc) >> 1) : abs(dirc);
+    const float a2 = max((vthresh2 - dircv) / vthresh2, 0.0f);
+    const float a = min(max(max(a0, a1), a2), 1.0f);
+    tline[x] = T((1.0 - a)*dstp[x] + a * cint);
   }
 }
 
-PVideoFrame __stdcall eedi3::GetFrame(int n, IScriptEnvironment *env)
+// Marks the interpolated lines [line_beg ; line_end) of the plane, then
+// checks the lines which are ready, unless another thread is already doing
+// it. The lines it leaves are checked by a later call or at the end of the
+// plane.
+void eedi3::vCheckFollow(VCheckPlane &vcp, const int line_beg, const int line_end)
+{
+  EnterCriticalSection(&vcp.done_lock);
+  for (int i = line_beg; i < line_end; ++i)
+    vcp.done[i] = 1;
+  while (vcp.ready < vcp.nlines && vcp.done[vcp.ready])
+    ++vcp.ready;
+  const int ready = vcp.ready;
+  LeaveCriticalSection(&vcp.done_lock);
+  if (TryEnterCriticalSection(&vcp.lock))
+  {
+    vCheckLines(vcp, ready);
+    LeaveCriticalSection(&vcp.lock);
+  }
+}
+
+// Checks the lines of the plane from vcp.next, while they and the next
+// interpolated line are available. A checked line depends on the previous
+// line after its check, so they are processed in order.
+void eedi3::vCheckLines(VCheckPlane &vcp, const int ready)
+{
+  const int line_end = min((ready < vcp.nlines) ? ready - 1 : ready, vcp.line_end);
+  const int dpitch = vcp.dpitch;
+  // The source lines may be read in place from the frame, the SIMD versions
+  // stop before the last incomplete group of pixels so they don't read past
+  // the end of the lines. They are 8-bit only.
+  const int x_simd = (bits > 8) ? 0 : (_avx2_vcheck_flag) ? (vcp.w & -8)
+    : (_sse2_flag) ? (vcp.w & -4) : 0;
+  for (; vcp.next < line_end; ++vcp.next)
+  {
+    const int i = vcp.next;
+    uint8_t *dstp = vcp.dstp + i * 2 * dpitch;
+    const uint8_t *scpp = vcp.scpp ? vcp.scpp + i * 2 * vcp.scpitch : NULL;
+    const int8_t *dstpd = vcp.dmap + i * vcp.dmpitch;
+    // Source lines 3 lines above and below, mirrored like copyPad does
+    int y3p = vcp.field_n + i * 2 - 3;
+    int y3n = vcp.field_n + i * 2 + 3;
+    if (y3p < 0)
+      y3p = -y3p;
+    if (y3n >= vcp.h)
+      y3n = vcp.h * 2 - 2 - y3n;
+    const uint8_t *dst3p = vcp.refp + ((y3p - 1 + vcp.field_n) >> 1) * vcp.rpitch;
+    const uint8_t *dst2p = dstp - 2 * dpitch;
+    const uint8_t *dst3n = vcp.refp + ((y3n - 1 + vcp.field_n) >> 1) * vcp.rpitch;
+    if (bits == 32)
+    {
+      vCheckLine((float*)vcp.line, (const float*)dst2p, (const float*)dstp,
+        dpitch / 4, (const float*)dst3p, (const float*)dst3n, (const float*)scpp,
+        dstpd, vcp.dmpitch, 0, vcp.w, vcheck, vthresh0, vthresh1, vthresh2, hp, bits);
+      memcpy(dstp, vcp.line, vcp.w * 4);
+      continue;
+    }
+    if (bits > 8)
+    {
+      vCheckLine((uint16_t*)vcp.line, (const uint16_t*)dst2p, (const uint16_t*)dstp,
+        dpitch / 2, (const uint16_t*)dst3p, (const uint16_t*)dst3n, (const uint16_t*)scpp,
+        dstpd, vcp.dmpitch, 0, vcp.w, vcheck, vthresh0, vthresh1, vthresh2, hp, bits);
+      memcpy(dstp, vcp.line, vcp.w * 2);
+      continue;
+    }
+    if (_avx2_vcheck_flag)
+      Eedi3Avx2::vcheck_line(vcp.line, dst2p, dstp, dpitch, dst3p, dst3n, scpp,
+        dstpd, vcp.dmpitch, 0, x_simd, vcheck, vthresh0, vthresh1, vthresh2, hp);
+    else if (_sse2_flag)
+      Eedi3Sse::vcheck_line(vcp.line, dst2p, dstp, dpitch, dst3p, dst3n, scpp,
+        dstpd, vcp.dmpitch, 0, x_simd, vcheck, vthresh0, vthresh1, vthresh2, hp);
+    vCheckLine(vcp.line, dst2p, dstp, dpitch, dst3p, dst3n, scpp, dstpd, vcp.dmpitch, x_simd,
+      vcp.w, vcheck, vthresh0, vthresh1, vthresh2, hp, 8);
+    memcpy(dstp, vcp.line, vcp.w);
+  }
+}
+
+// Interpolates the line off of a plane with the C++ version. T is the pixel
+// type, the pitches of the plane job are in bytes.
+template <class T>
+void eedi3::interpLineCpp(PlaneJob &pj, const int field_n, const int off, uint8_t *workspace)
+{
+  const int spitch = pj.spitch / sizeof(T);
+  const int dpitch = pj.dpitch / sizeof(T);
+  const int width = pj.width;
+  const T *srcp = (const T*)(pj.srcp + (MARGIN_V + field_n) * pj.spitch);
+  T *dstp = (T*)(pj.dstp + field_n * pj.dpitch);
+  uint8_t* maskp = 0;
+  if (pj.maskp_base != 0)
+  {
+    maskp = pj.maskp_base + pj.mpitch * off;
+  }
+  if (hp)
+    interpLineHP(srcp + MARGIN_H + off * 2 * spitch, width - MARGIN_H * 2, spitch, alpha, beta,
+      gamma, nrad, mdis, (float*)workspace, dstp + off * 2 * dpitch,
+      pj.dmap + off * pj.dmpitch, ucubic, cost3, maskp, bits);
+  else
+    interpLineFP(srcp + MARGIN_H + off * 2 * spitch, width - MARGIN_H * 2, spitch, alpha, beta,
+      gamma, nrad, mdis, (float*)workspace, dstp + off * 2 * dpitch,
+      pj.dmap + off * pj.dmpitch, ucubic, cost3, maskp, fixed, bits);
+  if (vcheck > 0)
+    vCheckFollow(pj.vcp, off, off + 1);
+}
+
+// Float version. The directions are searched on the lines quantized to
+// 16 bits, with the integer code, then the pixels are interpolated along
+// them from the float data.
+template <>
+void eedi3::interpLineCpp<float>(PlaneJob &pj, const int field_n, const int off, uint8_t *workspace)
+{
+  const int spitch = pj.spitch / sizeof(float);
+  const int dpitch = pj.dpitch / sizeof(float);
+  const int width = pj.width;
+  const float *srcp = (const float*)(pj.srcp + (MARGIN_V + field_n) * pj.spitch) + off * 2 * spitch;
+  float *dstp = (float*)(pj.dstp + field_n * pj.dpitch) + off * 2 * dpitch;
+  int8_t *dmap = pj.dmap + off * pj.dmpitch;
+  uint8_t* maskp = 0;
+  if (pj.maskp_base != 0)
+  {
+    maskp = pj.maskp_base + pj.mpitch * off;
+  }
+  // The quantized lines are 2 pitches apart, like the lines of the field
+  // in the padded frame.
+  const int qpitch = (width + 1) >> 1;
+  uint16_t *qsrcp = (uint16_t*)workspace;
+  for (int k = 0; k < 4; ++k)
+    Eedi3Sse::quantize_float(qsrcp + k * 2 * qpitch, srcp + (k * 2 - 3) * spitch,
+      width, pj.pix_ofs);
+  uint16_t *qdstp = qsrcp + 4 * 2 * qpitch;
+  float *temp = (float*)(((uintptr_t)(qdstp + width) + 63) & ~(uintptr_t)63);
+  const uint16_t *qp = qsrcp + 3 * qpitch + MARGIN_H;
+  if (hp)
+    interpLineHP(qp, width - MARGIN_H * 2, qpitch, alpha, beta, gamma, nrad, mdis,
+      temp, qdstp, dmap, ucubic, cost3, maskp, 16);
+  else
+    interpLineFP(qp, width - MARGIN_H * 2, qpitch, alpha, beta, gamma, nrad, mdis,
+      temp, qdstp, dmap, ucubic, cost3, maskp, fixed, 16);
+  srcp += MARGIN_H;
+  interpDirs(dstp, srcp - 3 * spitch, srcp - spitch, srcp + spitch, srcp + 3 * spitch,
+    dmap, width - MARGIN_H * 2, hp, ucubic, 1.0f);
+  if (vcheck > 0)
+    vCheckFollow(pj.vcp, off, off + 1);
+}
+
+// Interpolates the lines [line_beg ; line_end) of a float plane along the
+// directions found by the SIMD versions on the quantized data. The source
+// lines out of the plane are the ones the SIMD versions prepared: mirrored
+// in the frame like copyPad does with hp or fixed, else mirrored in the
+// field.
+void eedi3::interpFloatLines(PlaneJob &pj, const int field_n, const int line_beg, const int line_end)
+{
+  for (int i = line_beg; i < line_end; ++i)
+  {
+    const float *srcl[4];
+    for (int k = 0; k < 4; ++k)
+    {
+      int r = field_n + i * 2 + k * 2 - 3;
+      if (hp || fixed)
+      {
+        if (r < 0)
+          r = -r;
+        if (r >= pj.plane_h)
+          r = pj.plane_h * 2 - 2 - r;
+      }
+      int j = (r - 1 + field_n) >> 1;
+      if (j < 0)
+        j = -1 - j;
+      if (j >= pj.plane_hs)
+        j = pj.plane_hs * 2 - 1 - j;
+      j = max(j, 0);
+      srcl[k] = (const float*)(pj.refp + j * pj.rpitch);
+    }
+    float *dstp = (float*)(pj.dstp + (field_n + i * 2) * pj.dpitch);
+    interpDirs(dstp, srcl[0], srcl[1], srcl[2], srcl[3], pj.dmap + i * pj.dmpitch,
+      pj.plane_w, hp, ucubic, 1.0f);
+  }
+}
+
+void eedi3::interpTaskProc(void *data, int task, int thread_idx)
+{
+  FrameJob &fj = *reinterpret_cast <FrameJob *> (data);
+  fj.filter->interpTask(fj, task, thread_idx);
+}
+
+// Interpolates a block of lines of a plane. The blocks of a plane are
+// numbered from the top, tidx selects the work zone of the thread.
+void eedi3::interpTask(FrameJob &fj, const int task, const int tidx)
+{
+  int p = fj.nplanes - 1;
+  while (task < fj.planes[p].task_beg)
+    --p;
+  PlaneJob &pj = fj.planes[p];
+  FrameContext *ctx = fj.ctx;
+  // The pool workers run the tasks of any frame, their work zones belong
+  // to the filter
+  uint8_t *workspace = (pool) ? worker_ws[tidx] : ctx->workspace[tidx];
+  const int blk = task - pj.task_beg;
+  const int field_n = fj.field_n;
+  const int dpitch = pj.dpitch;
+  uint8_t *maskp_base = pj.maskp_base;
+  const int mpitch = pj.mpitch;
+
+  // SSE2 / AVX2 / AVX-512
+  if (_sse2_flag)
+  {
+    uint8_t *dstp = pj.dstp + field_n * dpitch;
+    const int   plane_w = pj.plane_w;
+    const int   plane_hs = pj.plane_hs;
+    const int   plane_hi = pj.plane_hi;
+    const int   col_h = (_avx512_flag) ? int(Eedi3Avx512::COL_H) : int(Eedi3Sse::COL_H);
+    const int   packedline_stride_pix = plane_w + 2 * Eedi3Sse::MARGIN_H;
+    const int   packedline_stride =
+      packedline_stride_pix * sizeof(uint16_t) * col_h;
+
+    const int      off = blk * col_h;
+    uint8_t* maskp = 0;
+    uint8_t *      src_ptr = workspace;
+    uint8_t *      dst_ptr = src_ptr + 4 * packedline_stride;
+    uint8_t *      dma_ptr = dst_ptr + plane_w * col_h * sizeof(uint16_t);
+    uint8_t *      msk_ptr = dma_ptr + ((plane_w * col_h * sizeof(uint8_t) + 15) & -16);
+    uint8_t *      tmp_ptr = msk_ptr + plane_w * col_h * sizeof(int16_t);
+    if (_avx512_flag)
+    {
+      tmp_ptr = (uint8_t *)(((uintptr_t)tmp_ptr + 63) & ~(uintptr_t)63);
+    }
+    else if (_avx2_flag)
+    {
+      tmp_ptr = (uint8_t *)(((uintptr_t)tmp_ptr + 31) & ~(uintptr_t)31);
+    }
+    if (maskp_base == 0)
+    {
+      msk_ptr = 0;
+    }
+    else
+    {
+      Eedi3Sse::prepare_mask_8bits(
+        msk_ptr,
+        maskp_base,
+        mpitch,
+        1,
+        plane_w,
+        plane_hs,
+        off,
+        col_h
+      );
+    }
+    // Float data is quantized to 16 bits for the direction search
+    const int   kbits = (bits == 32) ? 16 : bits;
+    if (hp || fixed)
+    {
+      // Mirrors the borders like copyPad to get the same results as the
+      // C++ version. The fixed-point mode is exact, so it must match
+      // on the borders too.
+      if (bits == 32)
+      {
+        Eedi3Sse::prepare_lines_mirror_float(
+          reinterpret_cast <uint16_t *> (src_ptr),
+          packedline_stride_pix,
+          reinterpret_cast <const float *> (pj.refp),
+          pj.rpitch,
+          pj.pix_ofs,
+          plane_w,
+          plane_hs,
+          off + field_n,
+          col_h,
+          1 - field_n,
+          pj.plane_h
+        );
+      }
+      else if (bits > 8)
+      {
+        Eedi3Sse::prepare_lines_mirror_16bits(
+          reinterpret_cast <uint16_t *> (src_ptr),
+          packedline_stride_pix,
+          reinterpret_cast <const uint16_t *> (pj.refp),
+          pj.rpitch,
+          bits,
+          plane_w,
+          plane_hs,
+          off + field_n,
+          col_h,
+          1 - field_n,
+          pj.plane_h
+        );
+      }
+      else
+      {
+        Eedi3Sse::prepare_lines_mirror_8bits(
+          reinterpret_cast <uint16_t *> (src_ptr),
+          packedline_stride_pix,
+          pj.refp,
+          pj.rpitch,
+          1,
+          plane_w,
+          plane_hs,
+          off + field_n,
+          col_h,
+          1 - field_n,
+          pj.plane_h
+        );
+      }
+    }
+    else if (bits == 32)
+    {
+      Eedi3Sse::prepare_lines_float(
+        reinterpret_cast <uint16_t *> (src_ptr),
+        packedline_stride_pix,
+        reinterpret_cast <const float *> (pj.refp),
+        pj.rpitch,
+        pj.pix_ofs,
+        plane_w,
+        plane_hs,
+        off + field_n,
+        col_h
+      );
+    }
+    else if (bits > 8)
+    {
+      Eedi3Sse::prepare_lines_16bits(
+        reinterpret_cast <uint16_t *> (src_ptr),
+        packedline_stride_pix,
+        reinterpret_cast <const uint16_t *> (pj.refp),
+        pj.rpitch,
+        bits,
+        plane_w,
+        plane_hs,
+        off + field_n,
+        col_h
+      );
+    }
+    else
+    {
+      Eedi3Sse::prepare_lines_8bits(
+        reinterpret_cast <uint16_t *> (src_ptr),
+        packedline_stride_pix,
+        pj.refp,
+        pj.rpitch,
+        1,
+        plane_w,
+        plane_hs,
+        off + field_n,
+        col_h
+      );
+    }
+    if (hp)
+    {
+      Eedi3Sse::interp_lines_half_pel(
+        reinterpret_cast <const __m128i *> (src_ptr),
+        reinterpret_cast <__m128i *> (dst_ptr),
+        msk_ptr,
+        tmp_ptr,
+        reinterpret_cast <__m128i *> (dma_ptr),
+        plane_w,
+        packedline_stride_pix,
+        alpha, beta, gamma,
+        nrad, mdis, ucubic, cost3
+      );
+    }
+    else if (_avx512_flag)
+    {
+      Eedi3Avx512::interp_lines_full_pel(
+        reinterpret_cast <const __m256i *> (src_ptr),
+        reinterpret_cast <__m256i *> (dst_ptr),
+        msk_ptr,
+        tmp_ptr,
+        reinterpret_cast <__m256i *> (dma_ptr),
+        plane_w,
+        packedline_stride_pix,
+        alpha, beta, gamma,
+        nrad, mdis, ucubic, cost3, fixed, kbits
+      );
+    }
+    else if (_avx2_flag)
+    {
+      Eedi3Avx2::interp_lines_full_pel(
+        reinterpret_cast <const __m128i *> (src_ptr),
+        reinterpret_cast <__m128i *> (dst_ptr),
+        msk_ptr,
+        tmp_ptr,
+        reinterpret_cast <__m128i *> (dma_ptr),
+        plane_w,
+        packedline_stride_pix,
+        alpha, beta, gamma,
+        nrad, mdis, ucubic, cost3, fixed, kbits
+      );
+    }
+    else
+    {
+      Eedi3Sse::interp_lines_full_pel(
+        reinterpret_cast <const __m128i *> (src_ptr),
+        reinterpret_cast <__m128i *> (dst_ptr),
+        msk_ptr,
+        tmp_ptr,
+        reinterpret_cast <__m128i *> (dma_ptr),
+        plane_w,
+        packedline_stride_pix,
+        alpha, beta, gamma,
+        nrad, mdis, ucubic, cost3, fixed, kbits
+      );
+    }
+    if (bits == 32)
+    {
+      // The interpolation from the float data needs the directions
+      Eedi3Sse::copy_result_dmap(
+        pj.dmap,
+        pj.dmpitch,
+        reinterpret_cast <int16_t *> (dma_ptr),
+        plane_w,
+        plane_w,
+        plane_hi,
+        off,
+        col_h
+      );
+      interpFloatLines(pj, field_n, off, min(off + col_h, plane_hi));
+      if (vcheck > 0)
+        vCheckFollow(pj.vcp, off, min(off + col_h, plane_hi));
+      return;
+    }
+    if (bits > 8)
+    {
+      Eedi3Sse::copy_result_lines_16bits(
+        reinterpret_cast <uint16_t *> (dstp),
+        dpitch * 2,
+        reinterpret_cast <const uint16_t *> (dst_ptr),
+        plane_w,
+        bits,
+        plane_w,
+        plane_hi,
+        off,
+        col_h
+      );
+    }
+    else
+    {
+      Eedi3Sse::copy_result_lines_8bits(
+        dstp,
+        dpitch * 2,
+        reinterpret_cast <const uint16_t *> (dst_ptr),
+        plane_w,
+        1,
+        plane_w,
+        plane_hi,
+        off,
+        col_h
+      );
+    }
+    if (vcheck > 0)
+    {
+      Eedi3Sse::copy_result_dmap(
+        pj.dmap,
+        pj.dmpitch,
+        reinterpret_cast <int16_t *> (dma_ptr),
+        plane_w,
+        plane_w,
+        plane_hi,
+        off,
+        col_h
+      );
+      vCheckFollow(pj.vcp, off, min(off + col_h, plane_hi));
+    }
+  }
+
+  // C++ only
+  else if (bits == 32)
+    interpLineCpp<float>(pj, field_n, blk, workspace);
+  else if (bits > 8)
+    interpLineCpp<uint16_t>(pj, field_n, blk, workspace);
+  else
+    interpLineCpp<uint8_t>(pj, field_n, blk, workspace);
+}
+
+// Prepares the source of output frame n from the source frame src (and msk
+// for mclip), and allocates its output.
+void eedi3::fetchFrame(FrameContext &ctx, const int n, PVideoFrame &src,
+  PVideoFrame &msk, IScriptEnvironment *env)
 {
   int field_n;
-  int field_s = n;
   if (field > 1)
   {
     if (n & 1) field_n = field == 3 ? 0 : 1;
     else field_n = field == 3 ? 1 : 0;
-    field_s >>= 1;
   }
   else
     field_n = field;
-  copyPad(field_s, field_n, env);
+  if (direct_src)
+    ctx.src = src;
+  else
+    copyPad(src, field_n, ctx, env);
   if (mclip)
   {
-    copyMask(field_s, field_n, env);
+    copyMask(msk, field_n, ctx, env);
   }
+  ctx.weave_flag = false;
   if (vcheck > 0 && sclip)
-    scpPF->copyFrom(sclip->GetFrame(n, env), vi);
-  int planecount = vi.IsY8() ? 1 : 3;
+  {
+    if (direct_dst)
+      ctx.scp = sclip->GetFrame(n, env);
+    else
+      ctx.scpPF->copyFrom(sclip->GetFrame(n, env), vi);
+  }
+  if (direct_dst)
+    ctx.dst = env->NewVideoFrame(vi);
+  ctx.fj.n = n;
+  ctx.fj.field_n = field_n;
+  ctx.fj.pass = 0;
+}
+
+// Splits the planes of a fetched frame in blocks of lines, and copies the
+// kept field to the output.
+void eedi3::setupPlanes(FrameContext &ctx, IScriptEnvironment *env)
+{
+  FrameJob &fj = ctx.fj;
+  const int field_n = fj.field_n;
+  const Pass &ps = passes[fj.pass];
+  // The source frame is read in place only by the first pass, the output
+  // frame is written in place only with a single pass.
+  const bool dsrc = (direct_src && fj.pass == 0);
+  const bool ddst = (direct_dst && passes.size() == 1);
+  PlanarFrame *srcPF = ctx.srcPF[fj.pass];
+  PlanarFrame *dstPF = ctx.dstPF[fj.pass];
+  const int csize = (bits + 7) >> 3;
+  fj.filter = this;
+  fj.ctx = &ctx;
+  fj.nplanes = 0;
+  int ntasks = 0;
+  const int *plane = plane_id;
+  int planecount = vi.IsY() ? 1 : 3;
+  // Parts of the direction map and vcheck buffers of the planes
+  int8_t *dmap = ctx.dmapa;
+  uint8_t *vcl = ctx.vcline;
+  uint8_t *vcd = ctx.vcdone;
   for (int b = 0; b < planecount; ++b)
   {
+    if (b > 0)
+    {
+      dmap += ps.dmap_pitch[b - 1] * ps.plane_height[b - 1];
+      vcl += ps.dmap_pitch[b - 1] * csize;
+      vcd += ps.plane_height[b - 1];
+    }
     if ((b == 0 && !Y) ||
       (b == 1 && !U) ||
       (b == 2 && !V))
       continue;
-    const uint8_t *srcp = srcPF->GetPtr(b);
-    const int spitch = srcPF->GetPitch(b);
-    const int width = srcPF->GetWidth(b);
-    const int height = srcPF->GetHeight(b);
-    uint8_t *dstp = dstPF->GetPtr(b);
-    const int dpitch = dstPF->GetPitch(b);
+    PlaneJob &pj = fj.planes[fj.nplanes];
+    uint8_t *dstp = (ddst) ? ctx.dst->GetWritePtr(plane[b]) : dstPF->GetPtr(b);
+    const int dpitch = (ddst) ? ctx.dst->GetPitch(plane[b]) : dstPF->GetPitch(b);
+    const int plane_w = ps.plane_width[b];
+    const int plane_h = ps.plane_height[b];
+    pj.plane_w = plane_w;
+    pj.plane_h = plane_h;
+    pj.plane_hs = (plane_h + field_n) >> 1;
+    pj.plane_hi = plane_h - pj.plane_hs;
+    if (dsrc)
+    {
+      // With dh=true, the source frame is the field
+      const int pitch = ctx.src->GetPitch(plane[b]);
+      pj.srcp = 0;
+      pj.spitch = 0;
+      pj.refp = ctx.src->GetReadPtr(plane[b]) + ((dh) ? 0 : (1 - field_n) * pitch);
+      pj.rpitch = (dh) ? pitch : pitch * 2;
+    }
+    else
+    {
+      pj.srcp = srcPF->GetPtr(b);
+      pj.spitch = srcPF->GetPitch(b);
+      pj.refp = pj.srcp + (MARGIN_V + 1 - field_n) * pj.spitch + MARGIN_H * csize;
+      pj.rpitch = pj.spitch * 2;
+    }
+    pj.width = plane_w + MARGIN_H * 2;
+    pj.height = plane_h + MARGIN_V * 2;
+    // Float chroma is centered on 0
+    pj.pix_ofs = (b > 0 && !vi.IsRGB()) ? 32768.f : 0.f;
     env->BitBlt(dstp + (1 - field_n)*dpitch,
-      dpitch * 2, srcp + (MARGIN_V + 1 - field_n)*spitch + MARGIN_H,
-      spitch * 2, width - MARGIN_H * 2, (height - MARGIN_V * 2) >> 1);
-    uint8_t *   maskp_base = 0;
-    int               mpitch = 0;
-    if (mclip)
+      dpitch * 2, pj.refp, pj.rpitch, plane_w * csize, pj.plane_hs);
+    pj.dstp = dstp;
+    pj.dpitch = dpitch;
+    pj.maskp_base = 0;
+    pj.mpitch = 0;
+    if (mclip || cthresh > 0)
     {
-      maskp_base = mcpPF->GetPtr(b);
-      mpitch = mcpPF->GetPitch(b);
+      pj.maskp_base = ctx.mcpPF->GetPtr(b);
+      pj.mpitch = ctx.mcpPF->GetPitch(b);
     }
-
-    // SSE2
-    if (_sse2_flag)
+    pj.dmap = dmap;
+    pj.dmpitch = ps.dmap_pitch[b];
+    VCheckPlane &vcp = pj.vcp;
+    if (vcheck > 0)
     {
-      assert(!hp);
+      vcp.refp = pj.refp;
+      vcp.rpitch = pj.rpitch;
+      vcp.field_n = field_n;
+      vcp.h = plane_h;
+      vcp.dstp = dstp + field_n * dpitch;
+      vcp.dpitch = dpitch;
+      vcp.scpp = NULL;
+      vcp.scpitch = 0;
+      if (sclip && ddst)
+      {
+        vcp.scpitch = ctx.scp->GetPitch(plane[b]);
+        vcp.scpp = ctx.scp->GetReadPtr(plane[b]) + field_n * vcp.scpitch;
+      }
+      else if (sclip)
+      {
+        vcp.scpitch = ctx.scpPF->GetPitch(b);
+        vcp.scpp = ctx.scpPF->GetPtr(b) + field_n * vcp.scpitch;
+      }
+      vcp.dmap = dmap;
+      vcp.dmpitch = ps.dmap_pitch[b];
+      vcp.line = vcl;
+      vcp.done = vcd;
+      vcp.w = plane_w;
+      vcp.nlines = pj.plane_hi;
+      // Lines 2 to plane_h - 3 of the plane
+      vcp.line_beg = (3 - field_n) >> 1;
+      vcp.line_end = min((plane_h - 1 - field_n) >> 1, vcp.nlines);
+      vcp.ready = 0;
+      vcp.next = vcp.line_beg;
+      memset(vcp.done, 0, vcp.nlines);
+      InitializeCriticalSection(&vcp.lock);
+      InitializeCriticalSection(&vcp.done_lock);
+    }
+    // The SIMD versions process col_h lines at once
+    const int col_h = (!_sse2_flag) ? 1
+      : (_avx512_flag) ? int(Eedi3Avx512::COL_H) : int(Eedi3Sse::COL_H);
+    pj.task_beg = ntasks;
+    ntasks += (pj.plane_hi + col_h - 1) / col_h;
+    ++fj.nplanes;
+  }
+  fj.ntasks = ntasks;
+}
 
-      srcp += MARGIN_V * spitch;
-      dstp += field_n * dpitch;
+// Prepares output frame n and starts its interpolation. With ctx_c, the
+// next output frame, from the same source frame in double rate mode, is
+// processed along. With the pool, the tasks run in the background until
+// finishFrame().
+void eedi3::startFrame(FrameContext &ctx, const int n, IScriptEnvironment *env,
+  FrameContext *ctx_c)
+{
+  const int field_s = (field > 1) ? (n >> 1) : n;
+  PVideoFrame src = child->GetFrame(field_s, env);
+  // A frame without combing is output as is, the fields are not
+  // interpolated at all.
+  if ((cprop[0] != '\0' && !isCombedProp(src, env))
+    || (cthresh > 0 && !detectCombing(src, ctx)))
+  {
+    ctx.dst = src;
+    ctx.fj.n = n;
+    ctx.weave_flag = true;
+    if (ctx_c)
+    {
+      ctx_c->dst = src;
+      ctx_c->fj.n = n + 1;
+      ctx_c->weave_flag = true;
+    }
+    return;
+  }
+  PVideoFrame msk;
+  if (mclip)
+    msk = mclip->GetFrame(field_s, env);
+  fetchFrame(ctx, n, src, msk, env);
+  if (ctx_c)
+    fetchFrame(*ctx_c, n + 1, src, msk, env);
+  if (cthresh > 0)
+  {
+    combMask(ctx, ctx.cmap);
+    if (ctx_c)
+      combMask(*ctx_c, ctx.cmap);
+  }
+  setupPlanes(ctx, env);
+  if (ctx_c)
+    setupPlanes(*ctx_c, env);
+  runTasks(ctx, ctx_c);
+}
 
-      const int   plane_w = width - MARGIN_H * 2;
-      const int   plane_h = height - MARGIN_V * 2;
-      const int   plane_hs = (plane_h + field_n) >> 1; // Number of existing source lines
-      const int   plane_hi = plane_h - plane_hs;       // Number of interpolated lines
-      const int   packedline_stride_pix = plane_w + 2 * Eedi3Sse::MARGIN_H;
-      const int   packedline_stride =
-        packedline_stride_pix * sizeof(uint16_t) * Eedi3Sse::COL_H;
+// Interpolates the planes set up by setupPlanes(), and the ones of ctx_c
+// along. With the pool, the tasks run in the background until
+// finishFrame().
+void eedi3::runTasks(FrameContext &ctx, FrameContext *ctx_c)
+{
+  // ~99% of the processing time is spent here. The blocks of all the planes
+  // are in a single list, so the chroma blocks keep the threads busy while
+  // the last luma blocks are finished. They are handed out in order, the
+  // vcheck can follow them closely. The blocks of the companion frame come
+  // after them.
+  if (pool)
+  {
+    pool->submit(ctx.pjob, &interpTaskProc, &ctx.fj, ctx.fj.ntasks);
+    if (ctx_c)
+      pool->submit(ctx_c->pjob, &interpTaskProc, &ctx_c->fj, ctx_c->fj.ntasks);
+  }
+  else
+  {
+    const int ntasks_0 = ctx.fj.ntasks;
+    const int ntasks = ntasks_0 + ((ctx_c) ? ctx_c->fj.ntasks : 0);
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+    for (int task = 0; task < ntasks; ++task)
+    {
+      if (task < ntasks_0)
+        interpTask(ctx.fj, task, omp_get_thread_num());
+      else
+        interpTask(ctx_c->fj, task - ntasks_0, omp_get_thread_num());
+    }
+  }
+}
 
-      // ~99% of the processing time is spent in this loop
-#pragma omp parallel for
-      for (int y = field_n; y < plane_h; y += 2 * Eedi3Sse::COL_H)
+// Starts output frame n. In double rate mode, the next output frame comes
+// from the same source frame: it is started along, unless it is already in
+// progress, and kept in pf_list for the next request. It is published
+// before it is fetched, so a concurrent request for it waits for it.
+void eedi3::startFrameAndCompanion(FrameContext &ctx, const int n, IScriptEnvironment *env)
+{
+  FrameContext *ctx_c = 0;
+  if (field > 1 && (n & 1) == 0 && n + 1 < vi.num_frames)
+  {
+    EnterCriticalSection(&pf_lock);
+    bool found_flag = false;
+    for (size_t i = 0; i < pf_list.size() && !found_flag; ++i)
+      found_flag = (pf_list[i]->pf_n == n + 1);
+    LeaveCriticalSection(&pf_lock);
+    // Without a free context, n + 1 is processed by its own request
+    if (!found_flag)
+      ctx_c = tryAcquireContext(env);
+    if (ctx_c)
+    {
+      EnterCriticalSection(&pf_lock);
+      for (size_t i = 0; i < pf_list.size() && !found_flag; ++i)
+        found_flag = (pf_list[i]->pf_n == n + 1);
+      if (!found_flag)
       {
-        const int      tidx = omp_get_thread_num();
-        const int      off = (y - field_n) >> 1;
-        uint8_t* maskp = 0;
-        uint8_t *      src_ptr = workspace[tidx];
-        uint8_t *      dst_ptr = src_ptr + 4 * packedline_stride;
-        uint8_t *      dma_ptr = dst_ptr + plane_w * Eedi3Sse::COL_H * sizeof(uint16_t);
-        uint8_t *      msk_ptr = dma_ptr + ((plane_w * Eedi3Sse::COL_H * sizeof(uint8_t) + 15) & -16);
-        uint8_t *      tmp_ptr = msk_ptr + plane_w * Eedi3Sse::COL_H * sizeof(int16_t);
-        if (maskp_base == 0)
-        {
-          msk_ptr = 0;
-        }
-        else
-        {
-          Eedi3Sse::prepare_mask_8bits(
-            msk_ptr,
-            maskp_base,
-            mpitch,
-            1,
-            plane_w,
-            plane_hs,
-            off
-          );
-        }
-        Eedi3Sse::prepare_lines_8bits(
-          reinterpret_cast <uint16_t *> (src_ptr),
-          packedline_stride_pix,
-          srcp + spitch * (1 - field_n) + MARGIN_H,  // +spitch* because the C++ version points on the interpolated line. We need the next one.
-          spitch * 2,
-          1,
-          plane_w,
-          plane_hs,
-          off + field_n
-        );
-        Eedi3Sse::interp_lines_full_pel(
-          reinterpret_cast <const __m128i *> (src_ptr),
-          reinterpret_cast <__m128i *> (dst_ptr),
-          msk_ptr,
-          tmp_ptr,
-          reinterpret_cast <__m128i *> (dma_ptr),
-          plane_w,
-          packedline_stride_pix,
-          alpha, beta, gamma,
-          nrad, mdis, ucubic, cost3
-        );
-        Eedi3Sse::copy_result_lines_8bits(
-          dstp,
-          dpitch * 2,
-          reinterpret_cast <const uint16_t *> (dst_ptr),
-          plane_w,
-          1,
-          plane_w,
-          plane_hi,
-          off
-        );
-        if (vcheck > 0)
-        {
-          Eedi3Sse::copy_result_dmap(
-            dmapa,
-            dpitch,
-            reinterpret_cast <int16_t *> (dma_ptr),
-            plane_w,
-            plane_w,
-            plane_hi,
-            off
-          );
-        }
+        ctx_c->pf_n = n + 1;
+        ctx_c->failed_flag = false;
+        ResetEvent(ctx_c->ready_evt);
+        pf_list.push_back(ctx_c);
       }
+      LeaveCriticalSection(&pf_lock);
+      if (found_flag)
+      {
+        releaseContext(ctx_c);
+        ctx_c = 0;
+      }
+    }
+  }
+  // Once ready_evt is set, ctx_c may belong to another request: it is not
+  // accessed anymore.
+  try
+  {
+    startFrame(ctx, n, env, ctx_c);
+  }
+  catch (...)
+  {
+    if (ctx_c)
+    {
+      ctx_c->failed_flag = true;
+      SetEvent(ctx_c->ready_evt);
+    }
+    throw;
+  }
+  if (ctx_c)
+    SetEvent(ctx_c->ready_evt);
+}
+
+// Runs the passes following the first one, with rstages. Each pass reads
+// the output of the previous one, turned to interpolate the other direction.
+void eedi3::runPasses(FrameContext &ctx, IScriptEnvironment *env)
+{
+  for (int p = 1; p < int(passes.size()); ++p)
+  {
+    copyPass(ctx, p, env);
+    ctx.fj.pass = p;
+    ctx.fj.field_n = passes[p].field;
+    setupPlanes(ctx, env);
+    runTasks(ctx);
+    finishFrame(ctx);
+  }
+}
 
-      srcp += field_n * spitch;
+// Waits for the interpolation of a frame started with startFrame(), and
+// completes its vcheck.
+void eedi3::finishFrame(FrameContext &ctx)
+{
+  if (ctx.weave_flag)
+    return;
+  FrameJob &fj = ctx.fj;
+  if (pool)
+  {
+    pool->wait(ctx.pjob);
+  }
+  if (vcheck > 0)
+  {
+    for (int p = 0; p < fj.nplanes; ++p)
+    {
+      VCheckPlane &vcp = fj.planes[p].vcp;
+      // Lines left by the interpolation threads
+      vCheckLines(vcp, vcp.nlines);
+      DeleteCriticalSection(&vcp.lock);
+      DeleteCriticalSection(&vcp.done_lock);
     }
+  }
+  ctx.src = NULL;
+  ctx.scp = NULL;
+}
 
-    // C++ only
-    else
+// Removes frame n from the prefetched frames and returns it once it is
+// started, or 0. When its start has failed, failed_flag is set and the
+// caller starts it again. The frames far from n are dropped: the host
+// threads request the frames out of order, but not that far.
+eedi3::FrameContext *eedi3::takePrefetched(const int n)
+{
+  FrameContext *ctx = 0;
+  std::vector <FrameContext *> drop_list;
+  const int range = max(prefetch, 1) + PF_SKEW;
+  EnterCriticalSection(&pf_lock);
+  for (size_t i = 0; i < pf_list.size(); )
+  {
+    FrameContext *pf = pf_list[i];
+    if (pf->pf_n == n || pf->pf_n < n - range || pf->pf_n > n + range)
     {
-      srcp += (MARGIN_V + field_n)*spitch;
-      dstp += field_n * dpitch;
+      if (pf->pf_n == n && ctx == 0)
+        ctx = pf;
+      else
+        drop_list.push_back(pf);
+      pf_list.erase(pf_list.begin() + i);
+    }
+    else
+      ++i;
+  }
+  LeaveCriticalSection(&pf_lock);
+  for (size_t i = 0; i < drop_list.size(); ++i)
+    dropFrame(drop_list[i]);
+  if (ctx)
+    WaitForSingleObject(ctx->ready_evt, INFINITE);
+  return ctx;
+}
 
-      // ~99% of the processing time is spent in this loop
-#pragma omp parallel for
-      for (int y = MARGIN_V + field_n; y < height - MARGIN_V; y += 2)
-      {
-        const int tidx = omp_get_thread_num();
-        const int off = (y - MARGIN_V - field_n) >> 1;
-        uint8_t* maskp = 0;
-        if (maskp_base != 0)
-        {
-          maskp = maskp_base + mpitch * off;
-        }
-        if (hp)
-          interpLineHP(srcp + MARGIN_H + off * 2 * spitch, width - MARGIN_H * 2, spitch, alpha, beta,
-            gamma, nrad, mdis, (float*)(workspace[tidx]), dstp + off * 2 * dpitch,
-            dmapa + off * dpitch, ucubic, cost3, maskp);
-        else
-          interpLineFP(srcp + MARGIN_H + off * 2 * spitch, width - MARGIN_H * 2, spitch, alpha, beta,
-            gamma, nrad, mdis, (float*)(workspace[tidx]), dstp + off * 2 * dpitch,
-            dmapa + off * dpitch, ucubic, cost3, maskp);
-      }
+// Discards a frame removed from pf_list and gives its context back. Its
+// tasks not started yet are cancelled, so they don't delay the requested
+// frames, and its vcheck is not completed.
+void eedi3::dropFrame(FrameContext *ctx)
+{
+  WaitForSingleObject(ctx->ready_evt, INFINITE);
+  if (!ctx->failed_flag && !ctx->weave_flag)
+  {
+    if (pool)
+    {
+      pool->cancel(ctx->pjob);
+      pool->wait(ctx->pjob);
     }
     if (vcheck > 0)
     {
-      int16_t *dstpd = dmapa;
-      const uint8_t *scpp = NULL;
-      int scpitch;
-      if (sclip)
+      for (int p = 0; p < ctx->fj.nplanes; ++p)
       {
-        scpitch = scpPF->GetPitch(b);
-        scpp = scpPF->GetPtr(b) + field_n * scpitch;
+        DeleteCriticalSection(&ctx->fj.planes[p].vcp.lock);
+        DeleteCriticalSection(&ctx->fj.planes[p].vcp.done_lock);
       }
-      for (int y = MARGIN_V + field_n; y < height - MARGIN_V; y += 2)
+    }
+  }
+  ctx->src = NULL;
+  ctx->scp = NULL;
+  ctx->dst = NULL;
+  releaseContext(ctx);
+}
+
+// Starts the frames following n which are not already in progress. Their
+// tasks are queued after the ones of the frames requested before, so the
+// workers only take them when idle. The frames are published in pf_list
+// under the lock, then fetched and started outside of it, so the other
+// requests don't wait for them.
+void eedi3::prefetchFrames(const int n, IScriptEnvironment *env)
+{
+  const int n_end = min(n + 1 + prefetch, vi.num_frames);
+  std::vector <int> frame_list;
+  EnterCriticalSection(&pf_lock);
+  for (int k = n + 1; k < n_end; ++k)
+  {
+    bool found_flag = false;
+    for (size_t i = 0; i < pf_list.size() && !found_flag; ++i)
+      found_flag = (pf_list[i]->pf_n == k);
+    // In double rate mode, an odd frame is started along with the previous
+    // one
+    if (!found_flag && !(field > 1 && (k & 1) != 0
+      && !frame_list.empty() && frame_list.back() == k - 1))
+      frame_list.push_back(k);
+  }
+  LeaveCriticalSection(&pf_lock);
+
+  std::vector <FrameContext *> start_list;
+  try
+  {
+    for (size_t j = 0; j < frame_list.size(); ++j)
+    {
+      FrameContext *ctx = tryAcquireContext(env);
+      if (!ctx)
+        break;
+      start_list.push_back(ctx);
+    }
+  }
+  catch (...)
+  {
+    // Prefetches what can be allocated, the error is reported by a request
+  }
+  EnterCriticalSection(&pf_lock);
+  for (size_t j = 0; j < start_list.size(); ++j)
+  {
+    bool found_flag = false;
+    for (size_t i = 0; i < pf_list.size() && !found_flag; ++i)
+      found_flag = (pf_list[i]->pf_n == frame_list[j]);
+    if (found_flag)
+    {
+      releaseContext(start_list[j]);
+      start_list[j] = 0;
+      continue;
+    }
+    FrameContext *ctx = start_list[j];
+    ctx->pf_n = frame_list[j];
+    ctx->failed_flag = false;
+    ResetEvent(ctx->ready_evt);
+    pf_list.push_back(ctx);
+  }
+  LeaveCriticalSection(&pf_lock);
+
+  // Once ready_evt is set, the context may belong to another request
+  for (size_t j = 0; j < start_list.size(); ++j)
+  {
+    FrameContext *ctx = start_list[j];
+    if (!ctx)
+      continue;
+    try
+    {
+      startFrameAndCompanion(*ctx, frame_list[j], env);
+    }
+    catch (...)
+    {
+      // The error is reported when the frame is actually requested
+      ctx->failed_flag = true;
+    }
+    SetEvent(ctx->ready_evt);
+  }
+}
+
+PVideoFrame __stdcall eedi3::GetFrame(int n, IScriptEnvironment *env)
+{
+  FrameContext *ctx = (prefetch > 0 || field > 1) ? takePrefetched(n) : 0;
+  const bool started_flag = (ctx != 0 && !ctx->failed_flag);
+  if (!ctx)
+    ctx = acquireContext(n, env);
+  ContextUse ctx_use(*this, ctx);
+  if (!started_flag)
+    startFrameAndCompanion(*ctx, n, env);
+  if (prefetch > 0)
+    prefetchFrames(n, env);
+  finishFrame(*ctx);
+  if (!ctx->weave_flag)
+    runPasses(*ctx, env);
+  PVideoFrame dst = ctx->dst;
+  ctx->dst = NULL;
+  if (!direct_dst && !ctx->weave_flag)
+  {
+    dst = env->NewVideoFrame(vi);
+    if (passes.size() > 1)
+      copyTurned(*ctx->dstPF.back(), dst);
+    else
+      ctx->dstPF[0]->copyTo(dst, vi);
+  }
+  return dst;
+}
+
+int __stdcall eedi3::SetCacheHints(int cachehints, int frame_range)
+{
+  // All the frame state is in the contexts, a single instance can serve
+  // concurrent requests.
+  return (cachehints == CACHE_GET_MTMODE) ? MT_NICE_FILTER : 0;
+}
+
+// Mirrors the left and right margins of the lines [y_beg ; y_end) of a
+// padded field, for copyPad(). The width is in pixels.
+template <class T>
+static void padLines(uint8_t *dstp, const int dst_pitch, const int width,
+  const int y_beg, const int y_end, const int margin)
+{
+  for (int y = y_beg; y < y_end; y += 2)
+  {
+    T *linep = (T*)(dstp + y * dst_pitch);
+    for (int x = 0; x < margin; ++x)
+      linep[x] = linep[margin * 2 - x];
+    int c = 2;
+    for (int x = width - margin; x < width; ++x, c += 2)
+      linep[x] = linep[x - c];
+  }
+}
+
+// Converts a pixel between the clip and the processed formats. The integer
+// pixels are widened by a left shift, and narrowed with rounding.
+template <class TD, class TS>
+static inline TD convPix(const TS v, const int lsh, const int rsh, const int pix_max)
+{
+  return TD(clipPix(divRound(int(v) << lsh, rsh), pix_max));
+}
+
+template <>
+inline float convPix<float, float>(const float v, const int lsh, const int rsh, const int pix_max)
+{
+  return v;
+}
+
+// Copies a plane of w x h source pixels, converted with convPix(). turn is
+// 0 for a straight copy, 1 to turn it to the right:
+// dst(x, y) = src(y, h - 1 - x), and -1 to turn it to the left:
+// dst(x, y) = src(w - 1 - y, x). The turned pixels are copied by tiles, so
+// the reads and the writes stay in a few lines at a time.
+template <class TD, class TS>
+static void copyPlane(const int turn, uint8_t *dstp, const int dst_pitch,
+  const uint8_t *srcp, const int src_pitch, const int w, const int h,
+  const int lsh, const int rsh, const int pix_max)
+{
+  if (turn == 0)
+  {
+    for (int y = 0; y < h; ++y)
+    {
+      TD *dstpt = (TD*)(dstp + y * dst_pitch);
+      const TS *srcpt = (const TS*)(srcp + y * src_pitch);
+      for (int x = 0; x < w; ++x)
+        dstpt[x] = convPix<TD, TS>(srcpt[x], lsh, rsh, pix_max);
+    }
+    return;
+  }
+  for (int y0 = 0; y0 < w; y0 += 16)
+  {
+    const int y1 = min(y0 + 16, w);
+    for (int x0 = 0; x0 < h; x0 += 16)
+    {
+      const int x1 = min(x0 + 16, h);
+      for (int y = y0; y < y1; ++y)
       {
-        if (y >= 6 && y < height - 6)
+        TD *dstpt = (TD*)(dstp + y * dst_pitch);
+        if (turn > 0)
         {
-          const uint8_t *dst3p = srcp - 3 * spitch + MARGIN_H;
-          const uint8_t *dst2p = dstp - 2 * dpitch;
-          const uint8_t *dst1p = dstp - 1 * dpitch;
-          const uint8_t *dst1n = dstp + 1 * dpitch;
-          const uint8_t *dst2n = dstp + 2 * dpitch;
-          const uint8_t *dst3n = srcp + 3 * spitch + MARGIN_H;
-          uint8_t *tline = workspace[0];
-          for (int x = 0; x < width - MARGIN_H * 2; ++x)
-          {
-            const int dirc = dstpd[x];
-            const int cint = scpp ? scpp[x] :
-              min(max((9 * (dst1p[x] + dst1n[x]) - (dst3p[x] + dst3n[x]) + 8) >> 4, 0), 255);
-            if (dirc == 0)
-            {
-              tline[x] = cint;
-              continue;
-            }
-            const int dirt = dstpd[x - dpitch];
-            const int dirb = dstpd[x + dpitch];
-            if (max(dirc*dirt, dirc*dirb) < 0 || (dirt == dirb && dirt == 0))
-            {
-              tline[x] = cint;
-              continue;
-            }
-            int it, ib, vt, vb, vc;
-            vc = abs(dstp[x] - dst1p[x]) + abs(dstp[x] - dst1n[x]);
-            if (hp)
-            {
-              if (!(dirc & 1))
-              {
-                const int d2 = dirc >> 1;
-                it = (dst2p[x + d2] + dstp[x - d2] + 1) >> 1;
-                vt = abs(dst2p[x + d2] - dst1p[x + d2]) + abs(dstp[x + d2] - dst1p[x + d2]);
-                ib = (dstp[x + d2] + dst2n[x - d2] + 1) >> 1;
-                vb = abs(dst2n[x - d2] - dst1n[x - d2]) + abs(dstp[x - d2] - dst1n[x - d2]);
-              }
-              else
-              {
-                const int d20 = dirc >> 1;
-                const int d21 = (dirc + 1) >> 1;
-                const int pa2p = dst2p[x + d20] + dst2p[x + d21] + 1;
-                const int pa1p = dst1p[x + d20] + dst1p[x + d21] + 1;
-                const int ps0 = dstp[x - d20] + dstp[x - d21] + 1;
-                const int pa0 = dstp[x + d20] + dstp[x + d21] + 1;
-                const int ps1n = dst1n[x - d20] + dst1n[x - d21] + 1;
-                const int ps2n = dst2n[x - d20] + dst2n[x - d21] + 1;
-                it = (pa2p + ps0) >> 2;
-                vt = (abs(pa2p - pa1p) + abs(pa0 - pa1p)) >> 1;
-                ib = (pa0 + ps2n) >> 2;
-                vb = (abs(ps2n - ps1n) + abs(ps0 - ps1n)) >> 1;
-              }
-            }
-            else
-            {
-              it = (dst2p[x + dirc] + dstp[x - dirc] + 1) >> 1;
-              vt = abs(dst2p[x + dirc] - dst1p[x + dirc]) + abs(dstp[x + dirc] - dst1p[x + dirc]);
-              ib = (dstp[x + dirc] + dst2n[x - dirc] + 1) >> 1;
-              vb = abs(dst2n[x - dirc] - dst1n[x - dirc]) + abs(dstp[x - dirc] - dst1n[x - dirc]);
-            }
-            const int d0 = abs(it - dst1p[x]);
-            const int d1 = abs(ib - dst1n[x]);
-            const int d2 = abs(vt - vc);
-            const int d3 = abs(vb - vc);
-            const int mdiff0 = vcheck == 1 ? min(d0, d1) : vcheck == 2 ? ((d0 + d1 + 1) >> 1) : max(d0, d1);
-            const int mdiff1 = vcheck == 1 ? min(d2, d3) : vcheck == 2 ? ((d2 + d3 + 1) >> 1) : max(d2, d3);
-            const float a0 = mdiff0 / vthresh0;
-            const float a1 = mdiff1 / vthresh1;
-            const int dircv = hp ? (abs(dirc) >> 1) : abs(dirc);
-            const float a2 = max((vthresh2 - dircv) / vthresh2, 0.0f);
-            const float a = min(max(max(a0, a1), a2), 1.0f);
-            tline[x] = (int)((1.0 - a)*dstp[x] + a * cint);
-          }
-          memcpy(dstp, tline, width - MARGIN_H * 2);
+          for (int x = x0; x < x1; ++x)
+            dstpt[x] = convPix<TD, TS>(((const TS*)(srcp + (h - 1 - x) * src_pitch))[y], lsh, rsh, pix_max);
+        }
+        else
+        {
+          for (int x = x0; x < x1; ++x)
+            dstpt[x] = convPix<TD, TS>(((const TS*)(srcp + x * src_pitch))[w - 1 - y], lsh, rsh, pix_max);
         }
-        srcp += 2 * spitch;
-        dstp += 2 * dpitch;
-        if (scpp)
-          scpp += 2 * scpitch;
-        dstpd += dpitch;
       }
     }
   }
-  PVideoFrame dst = env->NewVideoFrame(vi);
-  dstPF->copyTo(dst, vi);
-  return dst;
 }
 
-void eedi3::copyPad(int n, int fn, IScriptEnvironment *env)
+// Dispatches copyPlane() on the bit depths, 8 to 16 or 32 for float. Only
+// the integer formats can be converted.
+static void copyPlane(const int turn, const int dst_bits, const int src_bits,
+  uint8_t *dstp, const int dst_pitch, const uint8_t *srcp, const int src_pitch,
+  const int w, const int h)
 {
+  const int lsh = max(dst_bits - src_bits, 0);
+  const int rsh = max(src_bits - dst_bits, 0);
+  const int pix_max = (dst_bits == 32) ? 0 : (1 << dst_bits) - 1;
+  if (dst_bits == 32)
+    copyPlane<float, float>(turn, dstp, dst_pitch, srcp, src_pitch, w, h, lsh, rsh, pix_max);
+  else if (dst_bits > 8 && src_bits > 8)
+    copyPlane<uint16_t, uint16_t>(turn, dstp, dst_pitch, srcp, src_pitch, w, h, lsh, rsh, pix_max);
+  else if (dst_bits > 8)
+    copyPlane<uint16_t, uint8_t>(turn, dstp, dst_pitch, srcp, src_pitch, w, h, lsh, rsh, pix_max);
+  else if (src_bits > 8)
+    copyPlane<uint8_t, uint16_t>(turn, dstp, dst_pitch, srcp, src_pitch, w, h, lsh, rsh, pix_max);
+  else
+    copyPlane<uint8_t, uint8_t>(turn, dstp, dst_pitch, srcp, src_pitch, w, h, lsh, rsh, pix_max);
+}
+
+// Copies the planes of the last pass to the output frame, turned back to
+// the left and converted to the clip format.
+void eedi3::copyTurned(PlanarFrame &dstPF, PVideoFrame &dst)
+{
+  const Pass &ps = passes.back();
+  const int planecount = vi.NumComponents();
+  for (int b = 0; b < planecount; ++b)
+    copyPlane(-1, bits_clip, bits, dst->GetWritePtr(plane_id[b]), dst->GetPitch(plane_id[b]),
+      dstPF.GetPtr(b), dstPF.GetPitch(b), ps.plane_width[b], ps.plane_height[b]);
+}
+
+// Copies the output of pass p - 1 to the field kept by pass p, turned to
+// interpolate the other direction.
+void eedi3::copyPass(FrameContext &ctx, int p, IScriptEnvironment *env)
+{
+  PlanarFrame *srcPF = ctx.srcPF[p];
+  PlanarFrame *dstPF = ctx.dstPF[p - 1];
+  const Pass &ps = passes[p - 1];
+  const int off = 1 - passes[p].field;
+  const int csize = (bits + 7) >> 3;
+  const int planecount = vi.NumComponents();
+  for (int b = 0; b < planecount; ++b)
+    copyPlane((passes[p].turn) ? 1 : -1, bits, bits,
+      srcPF->GetPtr(b) + srcPF->GetPitch(b)*(MARGIN_V + off) + MARGIN_H * csize,
+      srcPF->GetPitch(b) * 2, dstPF->GetPtr(b), dstPF->GetPitch(b),
+      ps.plane_width[b], ps.plane_height[b]);
+  padPlanes(*srcPF, off, env);
+}
+
+void eedi3::copyPad(PVideoFrame &src, int fn, FrameContext &ctx, IScriptEnvironment *env)
+{
+  PlanarFrame *srcPF = ctx.srcPF[0];
   const int off = 1 - fn;
-  PVideoFrame src = child->GetFrame(n, env);
-  int planecount = 3; // rgb24 and YUY2 is converted to 3 planes too
+  const int csize = (bits + 7) >> 3;
+  // Without dh, the kept field has (h + 1 - off) / 2 lines of the frame,
+  // the last one included when the height is odd.
   if (!dh)
   {
-    if (vi.IsY8() || vi.IsYV12() || vi.IsYV16() || vi.IsYV24())
+    if (vi.IsPlanar())
     {
-      const int plane[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
-      planecount = vi.NumComponents(); // override for Y8
+      const int *plane = plane_id;
+      const int planecount = vi.NumComponents(); // override for Y8
       for (int b = 0; b < planecount; ++b)
-        env->BitBlt(srcPF->GetPtr(b) + srcPF->GetPitch(b)*(MARGIN_V + off) + MARGIN_H,
+        env->BitBlt(srcPF->GetPtr(b) + srcPF->GetPitch(b)*(MARGIN_V + off) + MARGIN_H * csize,
           srcPF->GetPitch(b) * 2,
           src->GetReadPtr(plane[b]) + src->GetPitch(plane[b])*off,
           src->GetPitch(plane[b]) * 2, src->GetRowSize(plane[b]),
-          src->GetHeight(plane[b]) >> 1);
+          (src->GetHeight(plane[b]) + 1 - off) >> 1);
     }
     else if (vi.IsYUY2())
     {
@@ -891,7 +2352,7 @@ void eedi3::copyPad(int n, int fn, IScriptEnvironment *env)
         srcPF->GetPtr(1) + srcPF->GetPitch(1)*(MARGIN_V + off) + MARGIN_H,
         srcPF->GetPtr(2) + srcPF->GetPitch(2)*(MARGIN_V + off) + MARGIN_H,
         src->GetPitch() * 2, srcPF->GetPitch(0) * 2, srcPF->GetPitch(1) * 2,
-        vi.width, vi.height >> 1);
+        vi.width, (vi.height + 1 - off) >> 1);
     }
     else
     {
@@ -900,20 +2361,28 @@ void eedi3::copyPad(int n, int fn, IScriptEnvironment *env)
         srcPF->GetPtr(1) + srcPF->GetPitch(1)*(MARGIN_V + off) + MARGIN_H,
         srcPF->GetPtr(2) + srcPF->GetPitch(2)*(MARGIN_V + off) + MARGIN_H,
         -src->GetPitch() * 2, srcPF->GetPitch(0) * 2, srcPF->GetPitch(1) * 2,
-        vi.width, vi.height >> 1);
+        vi.width, (vi.height + 1 - off) >> 1);
     }
   }
   else
   {
-    if (vi.IsY8() || vi.IsYV12() || vi.IsYV16() || vi.IsYV24())
+    if (vi.IsPlanar())
     {
-      const int plane[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
-      planecount = vi.NumComponents(); // override for Y8
+      const int *plane = plane_id;
+      const int planecount = vi.NumComponents(); // override for Y8
       for (int b = 0; b < planecount; ++b)
-        env->BitBlt(srcPF->GetPtr(b) + srcPF->GetPitch(b)*(MARGIN_V + off) + MARGIN_H,
-          srcPF->GetPitch(b) * 2, src->GetReadPtr(plane[b]),
-          src->GetPitch(plane[b]), src->GetRowSize(plane[b]),
-          src->GetHeight(plane[b]));
+      {
+        uint8_t *dstp = srcPF->GetPtr(b) + srcPF->GetPitch(b)*(MARGIN_V + off) + MARGIN_H * csize;
+        // With rstages, the source is widened to the processed format
+        if (bits != bits_clip)
+          copyPlane(0, bits, bits_clip, dstp, srcPF->GetPitch(b) * 2,
+            src->GetReadPtr(plane[b]), src->GetPitch(plane[b]),
+            src->GetRowSize(plane[b]) / vi.ComponentSize(), src->GetHeight(plane[b]));
+        else
+          env->BitBlt(dstp, srcPF->GetPitch(b) * 2, src->GetReadPtr(plane[b]),
+            src->GetPitch(plane[b]), src->GetRowSize(plane[b]),
+            src->GetHeight(plane[b]));
+      }
     }
     else if (vi.IsYUY2())
     {
@@ -934,41 +2403,77 @@ void eedi3::copyPad(int n, int fn, IScriptEnvironment *env)
         vi.width, vi.height >> 1);
     }
   }
+  padPlanes(*srcPF, off, env);
+}
+
+// Mirrors the margins of the field copied to srcPF, starting at line off
+void eedi3::padPlanes(PlanarFrame &srcPF, int off, IScriptEnvironment *env)
+{
+  const int csize = (bits + 7) >> 3;
+  const int planecount = (vi.IsY()) ? 1 : 3; // rgb24 and YUY2 is converted to 3 planes too
   for (int b = 0; b < planecount; ++b)
   {
-    uint8_t *dstp = srcPF->GetPtr(b);
-    const int dst_pitch = srcPF->GetPitch(b);
-    const int height = srcPF->GetHeight(b);
-    const int width = srcPF->GetWidth(b);
-    dstp += (MARGIN_V + off)*dst_pitch;
-    for (int y = MARGIN_V + off; y < height - MARGIN_V; y += 2)
-    {
-      for (int x = 0; x < MARGIN_H; ++x)
-        dstp[x] = dstp[MARGIN_H * 2 - x];
-      int c = 2;
-      for (int x = width - MARGIN_H; x < width; ++x, c += 2)
-        dstp[x] = dstp[x - c];
-      dstp += dst_pitch * 2;
-    }
-    dstp = srcPF->GetPtr(b);
+    uint8_t *dstp = srcPF.GetPtr(b);
+    const int dst_pitch = srcPF.GetPitch(b);
+    const int height = srcPF.GetHeight(b);
+    const int width = srcPF.GetWidth(b);	// In bytes
+    if (csize == 4)
+      padLines<float>(dstp, dst_pitch, width / 4, MARGIN_V + off, height - MARGIN_V, MARGIN_H);
+    else if (csize == 2)
+      padLines<uint16_t>(dstp, dst_pitch, width / 2, MARGIN_V + off, height - MARGIN_V, MARGIN_H);
+    else
+      padLines<uint8_t>(dstp, dst_pitch, width, MARGIN_V + off, height - MARGIN_V, MARGIN_H);
     for (int y = off; y < MARGIN_V; y += 2)
       env->BitBlt(dstp + y * dst_pitch, dst_pitch,
         dstp + (MARGIN_V * 2 - y)*dst_pitch, dst_pitch, width, 1);
-    int c = 2 + 2 * off;
-    for (int y = height - MARGIN_V + off; y < height; y += 2, c += 4)
+    // Mirrored on the last line of the plane, which is not in the field
+    // when the height is odd
+    const int y_end = height - MARGIN_V;
+    for (int y = y_end + ((y_end - MARGIN_V - off) & 1); y < height; y += 2)
       env->BitBlt(dstp + y * dst_pitch, dst_pitch,
-        dstp + (y - c)*dst_pitch, dst_pitch, width, 1);
+        dstp + (y_end * 2 - 2 - y)*dst_pitch, dst_pitch, width, 1);
   }
 }
 
-void	eedi3::copyMask(int n, int fn, IScriptEnvironment *env)
+// Narrows a line of a 16-bit or float mask to bytes. Only the nonzero
+// values of the mask count.
+template <class T>
+static void narrowMask(uint8_t *dstp, const uint8_t *srcp, const int w)
 {
+  const T *srcpt = (const T*)srcp;
+  for (int x = 0; x < w; ++x)
+    dstp[x] = (srcpt[x] != 0) ? 255 : 0;
+}
+
+void	eedi3::copyMask(PVideoFrame &src, int fn, FrameContext &ctx, IScriptEnvironment *env)
+{
+  PlanarFrame *mcpPF = ctx.mcpPF;
   const int off = (dh) ? 0 : fn;
   const int mul = (dh) ? 1 : 2;
-  PVideoFrame src = mclip->GetFrame(n, env);
-  if (vi.IsY8() || vi.IsYV12() || vi.IsYV16() || vi.IsYV24())
+  if (vi.IsPlanar() && vi.ComponentSize() > 1)
   {
-    const int plane[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+    // The mask is narrowed to bytes
+    const int *plane = plane_id;
+    int planecount = vi.NumComponents(); // override for Y
+    for (int b = 0; b < planecount; ++b)
+    {
+      const uint8_t *srcp = src->GetReadPtr(plane[b]) + src->GetPitch(plane[b]) * off;
+      const int spitch = src->GetPitch(plane[b]) * mul;
+      uint8_t *dstp = mcpPF->GetPtr(b);
+      const int w = mcpPF->GetWidth(b);
+      for (int y = 0; y < mcpPF->GetHeight(b); ++y)
+      {
+        if (vi.ComponentSize() == 4)
+          narrowMask<float>(dstp, srcp + y * spitch, w);
+        else
+          narrowMask<uint16_t>(dstp, srcp + y * spitch, w);
+        dstp += mcpPF->GetPitch(b);
+      }
+    }
+  }
+  else if (vi.IsPlanar())
+  {
+    const int *plane = plane_id;
     int planecount = vi.NumComponents(); // override for Y8
     for (int b = 0; b < planecount; ++b)
       env->BitBlt(
@@ -1010,13 +2515,187 @@ void	eedi3::copyMask(int n, int fn, IScriptEnvironment *env)
   }
 }
 
+// Looks for combing in the source frame, by blocks of 16x16 pixels of the
+// first plane (G for planar RGB, all the components for YUY2 and RGB24).
+// A block is combed when it has more than mi combed pixels. The combed
+// blocks and their neighbours go to ctx.cmap. Returns false when no block is combed.
+bool eedi3::detectCombing(PVideoFrame &src, FrameContext &ctx)
+{
+  const int nbx = (vi.width + 15) >> 4;
+  const int nby = (vi.height + 15) >> 4;
+  CombJob cj;
+  cj.filter = this;
+  cj.ctx = &ctx;
+  cj.srcp = src->GetReadPtr();
+  cj.pitch = src->GetPitch();
+  if (vi.IsRGB24())
+  {
+    // Bottom-up
+    cj.srcp += (vi.height - 1) * cj.pitch;
+    cj.pitch = -cj.pitch;
+  }
+  // The rows of blocks are counted by all the threads
+  if (pool)
+    pool->run(&combTaskProc, &cj, nby);
+  else
+  {
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+    for (int by = 0; by < nby; ++by)
+      combRow(cj, by, omp_get_thread_num());
+  }
+  uint8_t *cblk = ctx.cmap + nbx * nby;
+  bool combed_flag = false;
+  for (int b = 0; b < nbx * nby && !combed_flag; ++b)
+    combed_flag = (cblk[b] != 0);
+  if (!combed_flag)
+    return false;
+  // The detection misses the weak combing around the combed areas
+  for (int by = 0; by < nby; ++by)
+  {
+    for (int bx = 0; bx < nbx; ++bx)
+    {
+      uint8_t m = 0;
+      for (int j = max(by - 1, 0); j <= min(by + 1, nby - 1); ++j)
+        for (int i = max(bx - 1, 0); i <= min(bx + 1, nbx - 1); ++i)
+          m |= cblk[j * nbx + i];
+      ctx.cmap[by * nbx + bx] = m;
+    }
+  }
+  return true;
+}
+
+void eedi3::combTaskProc(void *data, int task, int thread_idx)
+{
+  CombJob &cj = *reinterpret_cast <CombJob *> (data);
+  cj.filter->combRow(cj, task, thread_idx);
+}
+
+// Flags the combed blocks of the row by. tidx selects the counters of the
+// thread.
+void eedi3::combRow(CombJob &cj, const int by, const int tidx)
+{
+  const int bpp = (vi.IsYUY2()) ? 2 : (vi.IsRGB24()) ? 3 : 1;
+  const int row_size = vi.width * bpp;
+  const int h = vi.height;
+  const int nbx = (vi.width + 15) >> 4;
+  const int nby = (h + 15) >> 4;
+  const uint8_t *srcp = cj.srcp;
+  const int pitch = cj.pitch;
+  // The SIMD version stops before the last incomplete group of 16 bytes.
+  // It is 8-bit only.
+  const int x_simd = (_sse2_flag && bits == 8) ? (row_size & -16) : 0;
+  const int mi_b = mi * bpp;
+  uint8_t *cblk = cj.ctx->cmap + nbx * nby;
+  int *cnt = cj.ctx->ccnt + tidx * nbx * 3;
+  memset(cnt, 0, nbx * bpp * sizeof(*cnt));
+  const int y_end = min(by * 16 + 16, h);
+  for (int y = by * 16; y < y_end; ++y)
+  {
+    // Lines mirrored at the top and bottom
+    int yl[5];
+    for (int k = 0; k < 5; ++k)
+    {
+      int r = y + k - 2;
+      if (r < 0)
+        r = -r;
+      if (r >= h)
+        r = h * 2 - 2 - r;
+      yl[k] = min(max(r, 0), h - 1);
+    }
+    const uint8_t *src2p = srcp + yl[0] * pitch;
+    const uint8_t *src1p = srcp + yl[1] * pitch;
+    const uint8_t *srccp = srcp + yl[2] * pitch;
+    const uint8_t *src1n = srcp + yl[3] * pitch;
+    const uint8_t *src2n = srcp + yl[4] * pitch;
+    if (bits == 32)
+    {
+      countCombed(cnt, (const float*)src2p, (const float*)src1p,
+        (const float*)srccp, (const float*)src1n, (const float*)src2n,
+        0, row_size, cthresh * pixScale(bits));
+      continue;
+    }
+    if (bits > 8)
+    {
+      countCombed(cnt, (const uint16_t*)src2p, (const uint16_t*)src1p,
+        (const uint16_t*)srccp, (const uint16_t*)src1n, (const uint16_t*)src2n,
+        0, row_size, cthresh << (bits - 8));
+      continue;
+    }
+    if (x_simd > 0)
+      Eedi3Sse::count_combed_8bits(cnt, src2p, src1p, srccp, src1n, src2n,
+        x_simd, cthresh);
+    countCombed(cnt, src2p, src1p, srccp, src1n, src2n, x_simd, row_size, cthresh);
+  }
+  for (int bx = 0; bx < nbx; ++bx)
+  {
+    int c = 0;
+    for (int k = 0; k < bpp; ++k)
+      c += cnt[bx * bpp + k];
+    cblk[by * nbx + bx] = (c > mi_b) ? 1 : 0;
+  }
+}
+
+// Reads the cprop frame property of the source frame. The frames without
+// the property are combed.
+bool eedi3::isCombedProp(PVideoFrame &src, IScriptEnvironment *env)
+{
+  const AVSMap *props = env->getFramePropsRO(src);
+  int err = 0;
+  const __int64 val = env->propGetInt(props, cprop, 0, &err);
+  return (err != 0 || val != 0);
+}
+
+// Masks the interpolated lines outside the blocks of cmap, on top of the
+// mclip mask if any.
+void eedi3::combMask(FrameContext &ctx, const uint8_t *cmap)
+{
+  PlanarFrame *mcpPF = ctx.mcpPF;
+  const int field_n = ctx.fj.field_n;
+  const int nbx = (vi.width + 15) >> 4;
+  const int nby = (vi.height + 15) >> 4;
+  const int planecount = vi.IsY() ? 1 : 3;
+  for (int b = 0; b < planecount; ++b)
+  {
+    uint8_t *maskp = mcpPF->GetPtr(b);
+    const int mpitch = mcpPF->GetPitch(b);
+    const int plane_w = passes[0].plane_width[b];
+    const int ssx = (plane_w < vi.width) ? 1 : 0;
+    const int ssy = (passes[0].plane_height[b] < vi.height) ? 1 : 0;
+    for (int i = 0; i < mcpPF->GetHeight(b); ++i)
+    {
+      const int by = min(((field_n + i * 2) << ssy) >> 4, nby - 1);
+      const uint8_t *cm = cmap + by * nbx;
+      for (int bx = 0; bx < nbx; ++bx)
+      {
+        const int x_beg = (bx * 16) >> ssx;
+        const int x_end = min(((bx + 1) * 16) >> ssx, plane_w);
+        if (cm[bx] == 0)
+          memset(maskp + x_beg, 0, x_end - x_beg);
+        else if (!mclip)
+          memset(maskp + x_beg, 255, x_end - x_beg);
+      }
+      maskp += mpitch;
+    }
+  }
+}
+
+// Greyscale, planar YUV and planar RGB without alpha, up to 16 bits or
+// float, YUY2 and RGB24
+static bool isSupportedFormat(const VideoInfo &vi)
+{
+  return (
+       (vi.IsY() || vi.Is420() || vi.Is422() || vi.Is444() || vi.IsPlanarRGB())
+    && (vi.BitsPerComponent() <= 16 || vi.BitsPerComponent() == 32)
+  ) || vi.IsYUY2() || vi.IsRGB24();
+}
+
 AVSValue __cdecl Create_eedi3(AVSValue args, void* user_data, IScriptEnvironment* env)
 {
   if (!args[0].IsClip())
     env->ThrowError("eedi3:  arg 0 must be a clip!");
   VideoInfo vi = args[0].AsClip()->GetVideoInfo();
-  if (!vi.IsY8() && !vi.IsYV12() && !vi.IsYV16() && !vi.IsYV24() && !vi.IsYUY2() && !vi.IsRGB24())
-    env->ThrowError("eedi3:  only Y8, YV12, YV16, YV24, YUY2, and RGB24 input are supported!");
+  if (!isSupportedFormat(vi))
+    env->ThrowError("eedi3:  only Y, YUV 4:2:0, 4:2:2 and 4:4:4, planar RGB (8 to 16 bits and float), YUY2, and RGB24 input are supported!");
   const bool dh = args[2].AsBool(false);
   if ((vi.height & 1) && !dh)
     env->ThrowError("eedi3:  height must be mod 2 when dh=false (%d)!", vi.height);
@@ -1027,7 +2706,8 @@ AVSValue __cdecl Create_eedi3(AVSValue args, void* user_data, IScriptEnvironment
     args[13].AsBool(true), args[14].AsInt(2), float(args[15].AsFloat(32.0f)),
     float(args[16].AsFloat(64.0f)), float(args[17].AsFloat(4.0f)), args[18].IsClip() ?
     args[18].AsClip() : NULL, args[19].AsInt(0), args[20].IsClip() ? args[20].AsClip() : NULL,
-    args[21].AsInt(0), env);
+    args[21].AsInt(0), args[22].AsBool(false), args[23].AsBool(false),
+    args[24].AsInt(0), args[25].AsInt(0), args[26].AsInt(80), args[27].AsString(""), 0, env);
 }
 
 AVSValue __cdecl Create_eedi3_rpow2(AVSValue args, void* user_data, IScriptEnvironment *env)
@@ -1035,8 +2715,8 @@ AVSValue __cdecl Create_eedi3_rpow2(AVSValue args, void* user_data, IScriptEnvir
   if (!args[0].IsClip())
     env->ThrowError("eedi3_rpow2:  arg 0 must be a clip!");
   VideoInfo vi = args[0].AsClip()->GetVideoInfo();
-  if (!vi.IsY8() && !vi.IsYV12() && !vi.IsYV16() && !vi.IsYV24() && !vi.IsYUY2() && !vi.IsRGB24())
-    env->ThrowError("eedi3_rpow2:  only Y8, YV12, YV16, YV24, YUY2, and RGB24 input are supported!");
+  if (!isSupportedFormat(vi))
+    env->ThrowError("eedi3_rpow2:  only Y, YUV 4:2:0, 4:2:2 and 4:4:4, planar RGB (8 to 16 bits and float), YUY2, and RGB24 input are supported!");
   if (vi.IsYUY2() && (vi.width & 3))
     env->ThrowError("eedi3_rpow2:  for yuy2 input width must be mod 4 (%d)!", vi.width);
   const int rfactor = args[1].AsInt(-1);
@@ -1060,6 +2740,9 @@ AVSValue __cdecl Create_eedi3_rpow2(AVSValue args, void* user_data, IScriptEnvir
   const float ep1 = args[18].IsFloat() ? float(args[18].AsFloat()) : -FLT_MAX;
   const int threads = args[19].AsInt(0);
   const int opt = args[20].AsInt(0);
+  const bool fixed = args[21].AsBool(false);
+  const bool tpool = args[22].AsBool(false);
+  const int prefetch = args[23].AsInt(0);
   if (rfactor < 2 || rfactor > 1024)
     env->ThrowError("eedi3_rpow2:  2 <= rfactor <= 1024, and rfactor be a power of 2!\n");
   int rf = 1, ct = 0;
@@ -1094,29 +2777,30 @@ AVSValue __cdecl Create_eedi3_rpow2(AVSValue args, void* user_data, IScriptEnvir
       {
         v = new eedi3(v.AsClip(), i == 0 ? 1 : 0, true, true, true, true, alpha,
           beta, gamma, nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0,
-          vthresh1, vthresh2, sclip, threads, 0, opt, env);
+          vthresh1, vthresh2, sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", 0, env);
         v = env->Invoke("TurnRight", v).AsClip();
         v = new eedi3(v.AsClip(), i == 0 ? 1 : 0, true, true, true, true, alpha,
           beta, gamma, nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0,
-          vthresh1, vthresh2, sclip, threads, 0, opt, env);
+          vthresh1, vthresh2, sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", 0, env);
         v = env->Invoke("TurnLeft", v).AsClip();
       }
       hshift = vshift = -0.5;
     }
-    else if (vi.IsPlanar()) // Y8, Y12, Y16, Y24
+    else if (vi.IsPlanarRGB())
     {
-      for (int i = 0; i < ct; ++i)
-      {
-        v = new eedi3(v.AsClip(), i == 0 ? 1 : 0, true, true, true, true, alpha, beta,
-          gamma, nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1,
-          vthresh2, sclip, threads, 0, opt, env);
-        v = env->Invoke("TurnRight", v).AsClip();
-        // always use field=1 to keep chroma/luma horizontal alignment
-        v = new eedi3(v.AsClip(), 1, true, true, true, true, alpha, beta, gamma,
-          nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1, vthresh2,
-          sclip, threads, 0, opt, env);
-        v = env->Invoke("TurnLeft", v).AsClip();
-      }
+      // All the doublings are made by a single filter, see eedi3::passes
+      v = new eedi3(v.AsClip(), 1, true, true, true, true, alpha, beta,
+        gamma, nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1,
+        vthresh2, sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", ct, env);
+      hshift = vshift = -0.5;
+    }
+    else if (vi.IsPlanar())
+    {
+      // Y, 4:2:0, 4:2:2 and 4:4:4, 8 to 16 bits and float. All the
+      // doublings are made by a single filter, then the chroma is shifted.
+      v = new eedi3(v.AsClip(), 1, true, true, true, true, alpha, beta,
+        gamma, nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1,
+        vthresh2, sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", ct, env);
       // Correct chroma shift (it's always 1/2 pixel upwards).
       // Need a cache here because v/vc will both request from this point.
       v = env->Invoke("InternalCache", v).AsClip();
@@ -1141,35 +2825,35 @@ AVSValue __cdecl Create_eedi3_rpow2(AVSValue args, void* user_data, IScriptEnvir
       for (int i = 0; i < ct; ++i)
       {
         v = new eedi3(v.AsClip(), i == 0 ? 1 : 0, true, true, false, false, alpha, beta, gamma,
-          nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1, vthresh2, sclip, threads, 0, opt, env);
+          nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1, vthresh2, sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", 0, env);
         v = env->Invoke("TurnRight", v).AsClip();
         // always use field=1 to keep chroma/luma horizontal alignment
         v = new eedi3(v.AsClip(), 1, true, true, false, false, alpha, beta, gamma, nrad,
-          mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1, vthresh2, sclip, threads, 0, opt, env);
+          mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1, vthresh2, sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", 0, env);
         v = env->Invoke("TurnLeft", v).AsClip();
       }
       for (int i = 0; i < ct; ++i)
       {
         vu = new eedi3(vu.AsClip(), i == 0 ? 1 : 0, true, true, false, false, alpha, beta,
           gamma, nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1,
-          vthresh2, sclip, threads, 0, opt, env);
+          vthresh2, sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", 0, env);
         vu = env->Invoke("TurnRight", vu).AsClip();
         // always use field=1 to keep chroma/luma horizontal alignment
         vu = new eedi3(vu.AsClip(), 1, true, true, false, false, alpha, beta, gamma,
           nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1, vthresh2,
-          sclip, threads, 0, opt, env);
+          sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", 0, env);
         vu = env->Invoke("TurnLeft", vu).AsClip();
       }
       for (int i = 0; i < ct; ++i)
       {
         vv = new eedi3(vv.AsClip(), i == 0 ? 1 : 0, true, true, false, false, alpha, beta,
           gamma, nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1, vthresh2,
-          sclip, threads, 0, opt, env);
+          sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", 0, env);
         vv = env->Invoke("TurnRight", vv).AsClip();
         // always use field=1 to keep chroma/luma horizontal alignment
         vv = new eedi3(vv.AsClip(), 1, true, true, false, false, alpha, beta, gamma,
           nrad, mdis, hp, ucubic, cost3, vcheck, vthresh0, vthresh1, vthresh2,
-          sclip, threads, 0, opt, env);
+          sclip, threads, 0, opt, fixed, tpool, prefetch, 0, 0, "", 0, env);
         vv = env->Invoke("TurnLeft", vv).AsClip();
       }
       AVSValue ytouvargs[3] = { vu, vv, v };
@@ -1231,11 +2915,12 @@ extern "C" __declspec(dllexport) const char* __stdcall AvisynthPluginInit3(IScri
   AVS_linkage = vectors;
 
   env->AddFunction("eedi3", "c[field]i[dh]b[Y]b[U]b[V]b[alpha]f[beta]f[gamma]f[nrad]i[mdis]i" \
-    "[hp]b[ucubic]b[cost3]b[vcheck]i[vthresh0]f[vthresh1]f[vthresh2]f[sclip]c[threads]i[mclip]c[opt]i",
+    "[hp]b[ucubic]b[cost3]b[vcheck]i[vthresh0]f[vthresh1]f[vthresh2]f[sclip]c[threads]i[mclip]c[opt]i" \
+    "[fixed]b[tpool]b[prefetch]i[cthresh]i[mi]i[cprop]s",
     Create_eedi3, 0);
   env->AddFunction("eedi3_rpow2", "c[rfactor]i[alpha]f[beta]f[gamma]f[nrad]i[mdis]i[hp]b" \
     "[ucubic]b[cost3]b[vcheck]i[vthresh0]f[vthresh1]f[vthresh2]f[cshift]s[fwidth]i" \
-    "[fheight]i[ep0]f[ep1]f[threads]i[opt]i",
+    "[fheight]i[ep0]f[ep1]f[threads]i[opt]i[fixed]b[tpool]b[prefetch]i",
     Create_eedi3_rpow2, 0);
   return "eedi3 plugin";
 }
@@ -25,6 +25,7 @@
 
 
 #include <cassert>
+#include <cmath>
 #include <float.h>
 #include <math.h>
 #include <omp.h>
@@ -32,8 +33,13 @@
 #include <stdio.h>
 #include <windows.h>
 
+#include <vector>
+
+#include "Eedi3Avx2.h"
+#include "Eedi3Avx512.h"
 #include "Eedi3Sse.h"
 #include "PlanarFrame.h"
+#include "ThreadPool.h"
 
 class eedi3 : public GenericVideoFilter
 {
@@ -41,43 +47,261 @@ private:
 	enum {         MARGIN_H = 12 };  // Left and right margins for the virtual source frame
 	enum {         MARGIN_V =  4 };  // Top and bottom margins
 
-	bool dh, Y, U, V, hp, ucubic, cost3;
+	bool dh, Y, U, V, hp, ucubic, cost3, fixed;
 	float alpha, beta, gamma,  vthresh0, vthresh1, vthresh2;
 	int field, nrad, mdis, vcheck;
-	int16_t *dmapa;
+	int bits;	// Bits per processed sample, 8 to 16, or 32 for float
+	int bits_clip;	// Bits per sample of the input and output clips, bits can be larger with rstages
+	int cthresh, mi;	// Combing detection, disabled with cthresh = 0
+	const char *cprop;	// Frame property, 0 for the frames without combing, or ""
+	int nthreads;	// Threads processing a frame
+	ThreadPool *pool;	// Runs the frame tasks instead of OpenMP, or 0
+	int cpuFlags;
 	bool _sse2_flag;
+	bool _avx2_flag;
+	bool _avx512_flag;
+	bool _avx2_vcheck_flag;	// The vcheck pass also uses AVX2 with hp=true
+	bool direct_src;	// The SIMD versions read the planar source frames in place
+	bool direct_dst;	// The planes are written to the output frame and sclip is read in place, planar formats
+	int plane_id [3];	// AviSynth planes processed as the planes 0 to 2
+
+	// Interpolation pass. eedi3 makes a single pass. With rstages, the
+	// eedi3_rpow2 doublings are processed by a single object: each one is a
+	// vertical pass and a horizontal pass, the intermediate planes stay in
+	// the processed format between the passes.
+	struct Pass
+	{
+		bool turn;	// Interpolates the columns, the planes are processed turned right
+		int field;	// Kept field, read by the passes following the first one
+		int plane_width [3];	// Size of the processed output planes, turned with turn
+		int plane_height [3];
+		int dmap_pitch [3];	// Pitch of the direction maps
+	};
+	std::vector <Pass> passes;
 
-	// Array of pointers (one per thread) to the temporary workzone.
+	// Size of the temporary workzone of a thread.
 	// Each zone is made of:
-	// CPP:
-	// - connection cost:     w * (mdis*2*pel+1) float
-	// - path cost      :     w * (mdis*2*pel+1) float
-	// - backtrack index:     w * (mdis*2*pel+1) int32
-	// - final path     :     w                  int32
-	// - mask           :     w                  bool
+	// CPP full-pel (connection and path costs are streamed, see interpLineFP):
+	// - connection cost:              (mdis*2+1) float
+	// - path cost      :     2      * (mdis*2+1) float
+	// - nrad sums      :              (mdis*2+1) int32
+	// - s0 table       : (mdis*2+1) * (mdis*2+1) int32 (cost3)
+	// - backtrack index:     w      * (mdis*2+1) int8
+	// - final path     :     w                   int8
+	// - mask           :     w                   bool
+	// - table mask     :     w                   bool (cost3)
+	// CPP half-pel:
+	// - connection cost:     w * (mdis*4+1) float
+	// - path cost      :     w * (mdis*4+1) float
+	// - backtrack index:     w * (mdis*4+1) int8
+	// - final path     :     w              int8
+	// - half pel lines : 4 * (w+2*4)        uint8 or uint16
+	// - mask           :     w              bool
+	// CPP float: before the above, the data for the direction search:
+	// - quantized lines: 4 * (w+2*MARGIN_H)     uint16
+	// - quantized dst  :     w                  uint16
 	// SSE/SSE2:
 	// - Temporary src  : 8 * (w+2*MARGIN_H) * 4 uint16
 	// - Temporary dst  : 8 * w                  uint16
 	// - Temporary dmap : 8 * w                  int16
-	// - connection cost: 8 * w * (mdis*2*pel+1) float
-	// - path cost      : 4 * w * (mdis*2*pel+1) float
-	// - backtrack index: 4 * w * (mdis*2*pel+1) int32
-	// - final path     : 4 * w                  int32
+	// - connection cost: 8 *     (mdis*2+1)     float
+	// - path cost      : 8 * 2 * (mdis*2+1)     float
+	// - nrad sums      : 8 * (mdis*2+1)         int32
+	// - s0 table       : 8 * (mdis*2+1)^2       int32 (cost3)
+	// - backtrack index: 8 * w * (mdis*2+1)     int8
+	// - final path     : 4 * w                  int8
 	// - mask           :     w                  bool
-	uint8_t **workspace;
-	PlanarFrame *srcPF, *dstPF, *scpPF;
-	PlanarFrame *mcpPF;	// Fields from the mask clip
+	// - table mask     :     w                  bool (cost3)
+	// SSE2 half-pel: the costs are not streamed:
+	// - connection cost: 8 * w * (mdis*4+1)     float
+	// - path cost      : 4 * w * (mdis*4+1)     float
+	// - nrad sums      : 8 * (mdis*4+1)         int32
+	// - backtrack index: 4 * w * (mdis*4+1)     int8
+	// - final path     : 4 * w                  int8
+	// plus the 4 half-pel lines (w+2*4 columns), 8 * w bytes of line mask
+	// and w bytes of column mask
+	// AVX2: same as SSE/SSE2 full-pel, but all the 8 lines at once (the
+	// final path is 8 * w int8).
+	// AVX-512: same as AVX2, with 16 lines instead of 8 (all the buffers
+	// are twice as large).
+	int workspace_size;
 	PClip sclip;
 	PClip mclip;
-	void copyPad(int n, int fn, IScriptEnvironment *env);
-	void copyMask(int n, int fn, IScriptEnvironment *env);
+
+	class FrameContext;
+
+	// State of the vcheck pass of a plane. The pass follows the
+	// interpolation: a line is checked as soon as its neighbours are
+	// interpolated, by the first thread which finds the lock free.
+	struct VCheckPlane
+	{
+		const uint8_t *refp;	// First line of the source field
+		int rpitch;	// From a line of the source field to the next one
+		int field_n;
+		int h;	// Height of the plane, for the mirrored source lines
+		uint8_t *dstp;	// First interpolated line in the destination
+		int dpitch;
+		const uint8_t *scpp;	// First interpolated line in sclip, or 0
+		int scpitch;
+		const int8_t *dmap;	// Directions of the first interpolated line
+		int dmpitch;
+		uint8_t *line;	// Results of the line being checked
+		uint8_t *done;	// Interpolated lines flags
+		int w;
+		int nlines;	// Number of interpolated lines
+		int line_beg;	// Range of the lines to check
+		int line_end;
+		int ready;	// The lines [0 ; ready) are interpolated
+		int next;	// Next line to check
+		CRITICAL_SECTION lock;	// Held by the thread checking the lines
+		CRITICAL_SECTION done_lock;	// Protects done and ready
+	};
+	void vCheckFollow(VCheckPlane &vcp, int line_beg, int line_end);
+	void vCheckLines(VCheckPlane &vcp, int ready);
+
+	// Interpolation of a plane, split in blocks of lines
+	struct PlaneJob
+	{
+		const uint8_t *srcp;	// Padded source, for the C++ version
+		int spitch;
+		int width;
+		int height;
+		const uint8_t *refp;	// First line of the source field, for the SIMD versions
+		int rpitch;
+		uint8_t *dstp;
+		int dpitch;
+		uint8_t *maskp_base;	// Mask fields, or 0
+		int mpitch;
+		int8_t *dmap;	// Directions of the interpolated lines
+		int dmpitch;
+		int plane_w;
+		int plane_h;
+		int plane_hs;	// Number of existing source lines
+		int plane_hi;	// Number of interpolated lines
+		int task_beg;	// Index of the first block in the frame task list
+		float pix_ofs;	// Offset of the float data quantized for the direction search
+		VCheckPlane vcp;
+	};
+	// The blocks of all the planes of a frame, in a single task list
+	struct FrameJob
+	{
+		eedi3 *filter;
+		FrameContext *ctx;
+		int n;	// Output frame number
+		int pass;	// Index in passes
+		int field_n;
+		int nplanes;
+		PlaneJob planes[3];
+		int ntasks;	// Blocks of all the planes
+	};
+	static void interpTaskProc(void *data, int task, int thread_idx);
+	void interpTask(FrameJob &fj, int task, int tidx);
+	template <class T>
+	void interpLineCpp(PlaneJob &pj, int field_n, int off, uint8_t *workspace);
+	void interpFloatLines(PlaneJob &pj, int field_n, int line_beg, int line_end);
+
+	// Buffers used to process a frame. Each GetFrame call checks one out of
+	// the pool, so concurrent calls don't share anything.
+	class FrameContext
+	{
+	public:
+		std::vector <PlanarFrame *> srcPF;	// Padded source of each pass, srcPF[0] is 0 with direct_src
+		std::vector <PlanarFrame *> dstPF;	// Output of each pass, 0 with direct_dst
+		PlanarFrame *scpPF;	// 0 with direct_dst or without sclip
+		PVideoFrame src;	// Source frames read in place with direct_src
+		PVideoFrame scp;
+		PVideoFrame dst;	// Output frame with direct_dst
+		PlanarFrame *mcpPF;	// Fields from the mask clip, or from the combing detection
+		bool weave_flag;	// The source frame has no combing, it is the output
+		uint8_t *cmap;	// Blocks to interpolate, then blocks with combing (cthresh)
+		int *ccnt;	// Combed pixels in the blocks of a row, by 16 bytes, a row per thread
+		// The planes are processed concurrently, so the buffers below have
+		// a part for each of them, sized for the largest pass.
+		int8_t *dmapa;	// Directions of the interpolated lines, |dir| <= mdis*2
+		uint8_t *vcline;	// Line receiving the vcheck results before the copy to the frame
+		uint8_t *vcdone;	// Flags of the interpolated lines, one per line
+		uint8_t **workspace;	// Array of pointers (one per thread) to the temporary workzone, unused with the pool
+		FrameJob fj;	// Processing of the frame
+		ThreadPool::Job pjob;	// Tasks of fj submitted to the pool
+		// Frames of pf_list. A frame is published before it is started, so
+		// the other requests for it wait instead of starting it again.
+		int pf_n;	// Frame number
+		HANDLE ready_evt;	// Reset until the frame is started
+		bool failed_flag;	// Starting the frame has thrown, the taker starts it again
+	};
+	// Frame requests processed at once, the other ones wait for a context
+	enum {         MAX_REQUESTS = 4 };
+	std::vector <FrameContext *> ctx_pool;	// Available contexts
+	int ctx_count;	// Created contexts, up to ctx_max
+	int ctx_max;
+	CRITICAL_SECTION ctx_lock;
+	HANDLE ctx_evt;	// Set when a context is given back
+	std::vector <uint8_t *> worker_ws;	// Work zone of each pool worker
+	FrameContext *createContext();
+	void deleteContext(FrameContext *ctx);
+	FrameContext *acquireContext(int n, IScriptEnvironment *env);
+	FrameContext *tryAcquireContext(IScriptEnvironment *env);
+	void releaseContext(FrameContext *ctx);
+
+	// Gives the context back to the pool when leaving GetFrame, exceptions
+	// included
+	class ContextUse
+	{
+	public:
+		ContextUse(eedi3 &filter, FrameContext *ctx) : _filter(filter), _ctx(ctx) {}
+		~ContextUse() { _filter.releaseContext(_ctx); }
+	private:
+		eedi3 &_filter;
+		FrameContext *_ctx;
+		ContextUse &operator =(const ContextUse &other);
+	};
+
+	void copyPad(PVideoFrame &src, int fn, FrameContext &ctx, IScriptEnvironment *env);
+	void copyPass(FrameContext &ctx, int p, IScriptEnvironment *env);
+	void padPlanes(PlanarFrame &srcPF, int off, IScriptEnvironment *env);
+	void copyTurned(PlanarFrame &dstPF, PVideoFrame &dst);
+	void copyMask(PVideoFrame &src, int fn, FrameContext &ctx, IScriptEnvironment *env);
+	bool detectCombing(PVideoFrame &src, FrameContext &ctx);
+	// Combing detection of a frame, split in rows of blocks
+	struct CombJob
+	{
+		eedi3 *filter;
+		FrameContext *ctx;
+		const uint8_t *srcp;	// First line of the source frame
+		int pitch;
+	};
+	static void combTaskProc(void *data, int task, int thread_idx);
+	void combRow(CombJob &cj, int by, int tidx);
+	bool isCombedProp(PVideoFrame &src, IScriptEnvironment *env);
+	void combMask(FrameContext &ctx, const uint8_t *cmap);
+	void fetchFrame(FrameContext &ctx, int n, PVideoFrame &src, PVideoFrame &msk, IScriptEnvironment *env);
+	void setupPlanes(FrameContext &ctx, IScriptEnvironment *env);
+	void runTasks(FrameContext &ctx, FrameContext *ctx_c = 0);
+	void runPasses(FrameContext &ctx, IScriptEnvironment *env);
+	void startFrame(FrameContext &ctx, int n, IScriptEnvironment *env, FrameContext *ctx_c = 0);
+	void startFrameAndCompanion(FrameContext &ctx, int n, IScriptEnvironment *env);
+	void finishFrame(FrameContext &ctx);
+
+	// Frames processed ahead: by the pool for prefetch > 0, and the second
+	// output frame of a source frame in double rate mode
+	// The host threads can request the frames out of order: the frames
+	// up to PF_SKEW before or after the prefetch range are kept.
+	enum {         PF_SKEW = 32 };
+	int prefetch;
+	std::vector <FrameContext *> pf_list;	// Frames in progress or done
+	CRITICAL_SECTION pf_lock;
+	FrameContext *takePrefetched(int n);
+	void dropFrame(FrameContext *ctx);
+	void prefetchFrames(int n, IScriptEnvironment *env);
 
 public:
 	eedi3::eedi3(PClip _child, int _field, bool _dh, bool _Y, bool _U, bool _V, 
 		float _alpha, float _beta, float _gamma, int _nrad, int _mdis, bool _hp, 
 		bool _ucubic, bool _cost3, int _vcheck, float _vthresh0, float _vthresh1, 
 		float _vthresh2, PClip _sclip, int _threads, PClip _mclip, int opt,
-		IScriptEnvironment *env);
+		bool _fixed, bool _tpool, int _prefetch, int _cthresh, int _mi,
+		const char *_cprop, int _rstages, IScriptEnvironment *env);
 	eedi3::~eedi3();
 	PVideoFrame __stdcall eedi3::GetFrame(int n, IScriptEnvironment *env);
+	int __stdcall eedi3::SetCacheHints(int cachehints, int frame_range);
 };
\ No newline at end of file